@@ -17,64 +17,198 @@
 #include "count/c.h"
 
 #include <assert.h>
-#include <stdlib.h>
 
+#include "count/hash.h"
 #include "count/hll.h"
-
-#ifdef __cplusplus
-extern "C" {
-#endif
+#include "count/hll_pool.h"
 
 using libcount::HLL;
+using libcount::HLLPool;
+
+namespace {
+
+/* A context is the HLL object itself, which Create() allocates together
+   with its registers, and a pool is the HLLPool. The C types are never
+   defined, and pointers to them are converted to the C++ classes. */
+
+HLL* Rep(hll_t* ctx) { return reinterpret_cast<HLL*>(ctx); }
+
+const HLL* Rep(const hll_t* ctx) {
+  return reinterpret_cast<const HLL*>(ctx);
+}
+
+hll_t* Wrap(HLL* rep) { return reinterpret_cast<hll_t*>(rep); }
 
-#include <stdint.h>
+HLLPool* Rep(hll_pool_t* pool) {
+  return reinterpret_cast<HLLPool*>(pool);
+}
 
-/* Exported types */
+}  // namespace
 
-struct hll_t {
-  HLL* rep;
-};
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* HLL Operations */
 
 hll_t* HLL_create(int precision, int* opt_error) {
-  HLL* rep = HLL::Create(precision, opt_error);
-  if (rep == NULL) {
-    return NULL;
-  }
+  return HLL_create_with_options(precision, libcount::HLL_LAYOUT_BYTE,
+                                 opt_error);
+}
+
+hll_t* HLL_create_with_options(int precision, int options, int* opt_error) {
+  return Wrap(HLL::Create(precision, options, opt_error));
+}
+
+hll_t* HLL_create_mapped(const char* path, int precision, int options,
+                         int* opt_error) {
+  return Wrap(HLL::CreateMapped(path, precision, options, opt_error));
+}
+
+hll_t* HLL_create_in(void* buf, size_t len, int precision,
+                     int* opt_error) {
+  return Wrap(HLL::CreateIn(buf, len, precision, libcount::HLL_LAYOUT_BYTE,
+                            opt_error));
+}
 
-  hll_t* obj = reinterpret_cast<hll_t*>(malloc(sizeof(hll_t)));
-  if (obj == NULL) {
-    delete rep;
-    return NULL;
-  }
+size_t HLL_in_place_size(int precision) {
+  return HLL::InPlaceSize(precision);
+}
 
-  obj->rep = rep;
-  return obj;
+int HLL_checkpoint(hll_t* ctx) {
+  assert(ctx != NULL);
+  return Rep(ctx)->Checkpoint();
 }
 
 void HLL_update(hll_t* ctx, uint64_t hash) {
   assert(ctx != NULL);
-  ctx->rep->Update(hash);
+  Rep(ctx)->Update(hash);
+}
+
+void HLL_update_batch(hll_t* ctx, const uint64_t* hashes, size_t n) {
+  assert(ctx != NULL);
+  Rep(ctx)->UpdateBatch(hashes, n);
+}
+
+void HLL_update_u64(hll_t* ctx, uint64_t value) {
+  assert(ctx != NULL);
+  Rep(ctx)->UpdateU64(value);
+}
+
+void HLL_update_bytes(hll_t* ctx, const void* data, size_t size) {
+  assert(ctx != NULL);
+  Rep(ctx)->UpdateBytes(data, size);
+}
+
+void HLL_update_u64_batch(hll_t* ctx, const uint64_t* values, size_t n) {
+  assert(ctx != NULL);
+  Rep(ctx)->UpdateU64Batch(values, n);
+}
+
+void HLL_update_bytes_batch(hll_t* ctx, const void* const* data,
+                            const size_t* sizes, size_t n) {
+  assert(ctx != NULL);
+  Rep(ctx)->UpdateBytesBatch(data, sizes, n);
+}
+
+uint64_t HLL_hash_bytes(const void* data, size_t size, uint64_t seed) {
+  return libcount::HashBytes(data, size, seed);
+}
+
+uint64_t HLL_hash_u64(uint64_t value, uint64_t seed) {
+  return libcount::HashU64(value, seed);
 }
 
 int HLL_merge(hll_t* dest, const hll_t* src) {
   assert(dest != NULL);
   assert(src != NULL);
-  return dest->rep->Merge(src->rep);
+  return Rep(dest)->Merge(Rep(src));
+}
+
+int HLL_merge_many(hll_t* dest, const hll_t* const* srcs, size_t n,
+                   int threads) {
+  assert(dest != NULL);
+  assert((srcs != NULL) || (n == 0));
+  const HLL* const* sources = reinterpret_cast<const HLL* const*>(srcs);
+  return Rep(dest)->MergeMany(sources, n, threads);
+}
+
+int HLL_fold(hll_t* ctx, int precision) {
+  assert(ctx != NULL);
+  return Rep(ctx)->Fold(precision);
+}
+
+hll_t* HLL_clone(const hll_t* ctx) {
+  assert(ctx != NULL);
+  return Wrap(Rep(ctx)->Clone());
+}
+
+void HLL_reset(hll_t* ctx) {
+  assert(ctx != NULL);
+  Rep(ctx)->Reset();
+}
+
+int HLL_swap(hll_t* a, hll_t* b) {
+  assert(a != NULL);
+  assert(b != NULL);
+  return Rep(a)->Swap(Rep(b));
 }
 
 uint64_t HLL_estimate(hll_t* ctx) {
   assert(ctx != NULL);
-  return ctx->rep->Estimate();
+  return Rep(ctx)->Estimate();
+}
+
+size_t HLL_serialized_size(const hll_t* ctx) {
+  assert(ctx != NULL);
+  return Rep(ctx)->SerializedSize();
+}
+
+int HLL_serialize(const hll_t* ctx, void* buffer, size_t size) {
+  assert(ctx != NULL);
+  return Rep(ctx)->Serialize(buffer, size);
+}
+
+hll_t* HLL_deserialize(const void* buffer, size_t size, int* opt_error) {
+  return Wrap(HLL::Deserialize(buffer, size, opt_error));
+}
+
+int HLL_merge_serialized(hll_t* dest, const void* buffer, size_t size) {
+  assert(dest != NULL);
+  return Rep(dest)->MergeSerialized(buffer, size);
 }
 
 void HLL_free(hll_t* ctx) {
   assert(ctx != NULL);
-  assert(ctx->rep != NULL);
-  delete ctx->rep;
-  ctx->rep = NULL;
-  free(ctx);
+  delete Rep(ctx);
+}
+
+/* Pool Operations */
+
+hll_pool_t* HLL_pool_create(int precision, int options, int* opt_error) {
+  return reinterpret_cast<hll_pool_t*>(
+      HLLPool::Create(precision, options, opt_error));
+}
+
+hll_t* HLL_pool_alloc(hll_pool_t* pool, int* opt_error) {
+  assert(pool != NULL);
+  return Wrap(Rep(pool)->Allocate(opt_error));
+}
+
+void HLL_pool_release(hll_pool_t* pool, hll_t* ctx) {
+  assert(pool != NULL);
+  assert(ctx != NULL);
+  Rep(pool)->Free(Rep(ctx));
+}
+
+void HLL_pool_reset(hll_pool_t* pool) {
+  assert(pool != NULL);
+  Rep(pool)->Reset();
+}
+
+void HLL_pool_free(hll_pool_t* pool) {
+  assert(pool != NULL);
+  delete Rep(pool);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,157 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/concurrent_hll.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+#include "count/hll_limits.h"
+#include "count/kernels.h"
+#include "count/serialization.h"
+#include "count/utility.h"
+
+namespace {
+
+// Estimate() tallies the registers a block of words at a time, so that the
+// copy stays in L1 cache.
+const int kBlockWords = 512;
+
+// The registers start on a cache line, and the sequence counters sit on the
+// line after them, so that raising a register never writes the line that
+// holds the members every update reads.
+const size_t kCacheLineSize = 64;
+
+// The number of times Snapshot() tries for a copy no raise overlapped,
+// before it settles for a copy of each register in turn.
+const int kSnapshotAttempts = 8;
+
+}  // namespace
+
+namespace libcount {
+
+ConcurrentHLL::ConcurrentHLL(int precision, int options)
+    : precision_(precision),
+      estimator_(options & HLL_ESTIMATOR_MASK),
+      word_count_((1 << precision) / 8),
+      words_(NULL),
+      begun_(NULL),
+      ended_(NULL) {
+  const size_t size = std::max(size_t(1) << precision, kCacheLineSize);
+  const bool sequenced = (options & HLL_OPTION_SNAPSHOT) != 0;
+  const size_t total = size + (sequenced ? kCacheLineSize : 0);
+  void* block = NULL;
+  if (posix_memalign(&block, kCacheLineSize, total) != 0) {
+    throw std::bad_alloc();
+  }
+  memset(block, 0, total);
+  words_ = static_cast<uint64_t*>(block);
+  if (sequenced) {
+    begun_ = words_ + size / sizeof(uint64_t);
+    ended_ = begun_ + 1;
+  }
+}
+
+ConcurrentHLL::~ConcurrentHLL() { free(words_); }
+
+ConcurrentHLL* ConcurrentHLL::Create(int precision, int options, int* error) {
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  // The registers are always dense bytes, so HLL_OPTION_DENSE is harmless.
+  const int estimator = options & HLL_ESTIMATOR_MASK;
+  const int flags = HLL_OPTION_DENSE | HLL_OPTION_SNAPSHOT;
+  if (((options & ~(HLL_ESTIMATOR_MASK | flags)) != 0) ||
+      ((estimator != HLL_ESTIMATOR_EMPIRICAL) &&
+       (estimator != HLL_ESTIMATOR_IMPROVED) &&
+       (estimator != HLL_ESTIMATOR_MLE))) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  return new ConcurrentHLL(precision, options);
+}
+
+void ConcurrentHLL::CopyWords(int first, int count,
+                              uint8_t* registers) const {
+  for (int w = 0; w < count; ++w) {
+    // Acquire loads, so that Snapshot() sees every raise begun before a
+    // store that it copies.
+    const uint64_t word = __atomic_load_n(&words_[first + w], __ATOMIC_ACQUIRE);
+    StoreLittleEndian64(word, registers + w * sizeof(word));
+  }
+}
+
+int ConcurrentHLL::Merge(const HLL* other) {
+  assert(other != NULL);
+  std::vector<uint8_t> registers(size_t(1) << precision_);
+  const int status = other->MergeInto(&registers[0], precision_);
+  if (status != 0) {
+    return status;
+  }
+  for (int w = 0; w < word_count_; ++w) {
+    for (int i = 0; i < 8; ++i) {
+      const uint8_t value = registers[w * 8 + i];
+      if (value != 0) {
+        SetMax(&words_[w], i * 8, value);
+      }
+    }
+  }
+  return 0;
+}
+
+int ConcurrentHLL::MergeInto(HLL* other) const {
+  assert(other != NULL);
+  std::vector<uint8_t> registers(size_t(1) << precision_);
+  CopyWords(0, word_count_, &registers[0]);
+  return other->MergeRegisters(&registers[0], precision_);
+}
+
+bool ConcurrentHLL::Snapshot(uint8_t* registers) const {
+  assert(registers != NULL);
+  for (int attempt = 0; (begun_ != NULL) && (attempt < kSnapshotAttempts);
+       ++attempt) {
+    // A raise in progress at the first load, or begun since, leaves 'begun_'
+    // past the count of raises ended then.
+    const uint64_t ended = __atomic_load_n(ended_, __ATOMIC_ACQUIRE);
+    CopyWords(0, word_count_, registers);
+    if (__atomic_load_n(begun_, __ATOMIC_RELAXED) == ended) {
+      return true;
+    }
+  }
+  // Each word is loaded atomically, and registers only grow, so the copy is
+  // still a sketch of the elements added, short of some added meanwhile.
+  CopyWords(0, word_count_, registers);
+  return false;
+}
+
+uint64_t ConcurrentHLL::Estimate() const {
+  uint32_t histogram[kHistogramBuckets] = {0};
+  uint8_t block[kBlockWords * sizeof(uint64_t)];
+  for (int w = 0; w < word_count_; w += kBlockWords) {
+    const int count = std::min(kBlockWords, word_count_ - w);
+    CopyWords(w, count, block);
+    HistogramBytes(block, count * sizeof(uint64_t), histogram);
+  }
+  return HLL::EstimateHistogram(histogram, precision_, estimator_);
+}
+
+}  // namespace libcount
@@ -0,0 +1,226 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/concurrent_hll.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <set>
+#include <vector>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/hll_view.h"
+#include "count/test_util.h"
+
+using libcount::ConcurrentHLL;
+using libcount::HLL;
+using libcount::HLLView;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+using libcount::HLL_OPTION_INCREMENTAL;
+using libcount::HLL_OPTION_SNAPSHOT;
+
+// Return the registers of an HLL object.
+std::vector<uint8_t> RegistersOf(const HLL* hll, int precision) {
+  std::vector<uint8_t> registers(1 << precision);
+  hll->MergeInto(&registers[0], precision);
+  return registers;
+}
+
+// A single thread gets the same registers and estimates as a dense HLL.
+bool TestMatchesHLL() {
+  for (int precision = 4; precision <= 18; precision += 7) {
+    ConcurrentHLL* concurrent = ConcurrentHLL::Create(precision,
+                                                      HLL_ESTIMATOR_MLE);
+    HLL* hll = HLL::Create(precision, HLL_OPTION_DENSE | HLL_ESTIMATOR_MLE,
+                           NULL);
+    for (uint64_t n = 0; n < 200000; n = n * 3 + 1) {
+      for (uint64_t i = n / 3; i < n; ++i) {
+        concurrent->Update(Hash(i));
+        hll->Update(Hash(i));
+      }
+      EXPECT(concurrent->Estimate() == hll->Estimate());
+    }
+    HLL* copy = HLL::Create(precision);
+    EXPECT(concurrent->MergeInto(copy) == 0);
+    EXPECT(RegistersOf(copy, precision) == RegistersOf(hll, precision));
+
+    // Merging an HLL in, whatever its representation.
+    ConcurrentHLL* merged = ConcurrentHLL::Create(precision,
+                                                  HLL_ESTIMATOR_MLE);
+    HLL* sparse = HLL::Create(precision, HLL_LAYOUT_PACKED6, NULL);
+    sparse->Update(Hash(1));
+    EXPECT(merged->Merge(sparse) == 0);
+    EXPECT(merged->Merge(hll) == 0);
+    EXPECT(merged->Estimate() == hll->Estimate());
+
+    delete sparse;
+    delete merged;
+    delete copy;
+    delete hll;
+    delete concurrent;
+  }
+  return true;
+}
+
+struct Writer {
+  ConcurrentHLL* hll;
+  uint64_t first;
+  uint64_t count;
+};
+
+void* WriterThread(void* arg) {
+  const Writer* writer = static_cast<const Writer*>(arg);
+  for (uint64_t i = writer->first; i < writer->first + writer->count; ++i) {
+    writer->hll->Update(Hash(i));
+  }
+  return NULL;
+}
+
+// Threads updating at once lose no updates, and estimates may be taken
+// while they run.
+bool TestThreads() {
+  const int kThreads = 8;
+  const uint64_t kPerThread = 200000;
+  const int kPrecision = 10;
+  ConcurrentHLL* concurrent = ConcurrentHLL::Create(kPrecision);
+  pthread_t threads[kThreads];
+  Writer writers[kThreads];
+  for (int t = 0; t < kThreads; ++t) {
+    // Overlapping ranges, so that threads race for the same registers.
+    writers[t].hll = concurrent;
+    writers[t].first = t * kPerThread / 2;
+    writers[t].count = kPerThread;
+    EXPECT(pthread_create(&threads[t], NULL, WriterThread, &writers[t]) == 0);
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT(concurrent->Estimate() <= 2 * kThreads * kPerThread);
+  }
+  for (int t = 0; t < kThreads; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+
+  HLL* hll = HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL);
+  for (uint64_t i = 0; i < (kThreads + 1) * kPerThread / 2; ++i) {
+    hll->Update(Hash(i));
+  }
+  HLL* copy = HLL::Create(kPrecision);
+  EXPECT(concurrent->MergeInto(copy) == 0);
+  EXPECT(RegistersOf(copy, kPrecision) == RegistersOf(hll, kPrecision));
+  EXPECT(concurrent->Estimate() == hll->Estimate());
+
+  delete copy;
+  delete hll;
+  delete concurrent;
+  return true;
+}
+
+struct Prefix {
+  ConcurrentHLL* hll;
+  uint64_t count;
+};
+
+void* PrefixThread(void* arg) {
+  const Prefix* prefix = static_cast<const Prefix*>(arg);
+  for (uint64_t i = 0; i < prefix->count; ++i) {
+    prefix->hll->Update(Hash(i));
+  }
+  return NULL;
+}
+
+// A snapshot is the state of the registers at a single point in time. With
+// one writer adding elements in order, every snapshot must be the state
+// after some prefix of them; a copy torn by a concurrent raise need not be,
+// but must still lie below the final state.
+bool TestSnapshot() {
+  const int kPrecision = 4;
+  const uint64_t kCount = 2000000;
+  std::set<std::vector<uint8_t> > states;
+  std::vector<uint8_t> registers(1 << kPrecision);
+  states.insert(registers);
+  HLL* hll = HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL);
+  for (uint64_t i = 0; i < kCount; ++i) {
+    hll->Update(Hash(i));
+    hll->MergeInto(&registers[0], kPrecision);
+    states.insert(registers);
+  }
+
+  const std::vector<uint8_t> final_state = RegistersOf(hll, kPrecision);
+
+  ConcurrentHLL* concurrent =
+      ConcurrentHLL::Create(kPrecision, HLL_OPTION_SNAPSHOT);
+  Prefix prefix = {concurrent, kCount};
+  pthread_t thread;
+  EXPECT(pthread_create(&thread, NULL, PrefixThread, &prefix) == 0);
+  std::vector<uint8_t> snapshot(1 << kPrecision);
+  for (int i = 0; i < 10000; ++i) {
+    if (concurrent->Snapshot(&snapshot[0])) {
+      EXPECT(states.count(snapshot) == 1);
+    }
+    for (size_t r = 0; r < snapshot.size(); ++r) {
+      EXPECT(snapshot[r] <= final_state[r]);
+    }
+  }
+  pthread_join(thread, NULL);
+
+  EXPECT(concurrent->Snapshot(&snapshot[0]));
+  EXPECT(snapshot == final_state);
+  const HLLView view(&snapshot[0], kPrecision);
+  EXPECT(view.Estimate(0) == hll->Estimate());
+  delete concurrent;
+
+  // Without the option, the copy is made a register at a time.
+  concurrent = ConcurrentHLL::Create(kPrecision);
+  EXPECT(concurrent->Merge(hll) == 0);
+  EXPECT(!concurrent->Snapshot(&snapshot[0]));
+  EXPECT(snapshot == final_state);
+  delete concurrent;
+  delete hll;
+  return true;
+}
+
+bool TestErrors() {
+  int error = 0;
+  EXPECT(ConcurrentHLL::Create(3, 0, &error) == NULL);
+  EXPECT(error == EINVAL);
+  EXPECT(ConcurrentHLL::Create(10, HLL_LAYOUT_PACKED6, &error) == NULL);
+  EXPECT(ConcurrentHLL::Create(10, HLL_OPTION_INCREMENTAL, &error) == NULL);
+  EXPECT(ConcurrentHLL::Create(10, 0x300, &error) == NULL);
+  EXPECT(HLL::Create(10, HLL_OPTION_SNAPSHOT, &error) == NULL);
+  EXPECT(error == EINVAL);
+  ConcurrentHLL* concurrent = ConcurrentHLL::Create(10, HLL_OPTION_DENSE);
+  EXPECT(concurrent != NULL);
+  HLL* other = HLL::Create(11);
+  EXPECT(concurrent->Merge(other) == EINVAL);
+  EXPECT(concurrent->MergeInto(other) == EINVAL);
+  delete other;
+  delete concurrent;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestMatchesHLL() && ok;
+  ok = TestThreads() && ok;
+  ok = TestSnapshot() && ok;
+  ok = TestErrors() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
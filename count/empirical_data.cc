@@ -17,7 +17,9 @@
 #include "count/empirical_data.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <algorithm>
 #include <vector>
@@ -26,6 +28,86 @@
 #include "count/hll_limits.h"
 #include "count/utility.h"
 
+namespace {
+
+using libcount::HLL_MAX_EMPIRICAL_PRECISION;
+using libcount::HLL_MAX_PRECISION;
+using libcount::HLL_MIN_PRECISION;
+
+// There are up to 201 data points in each table of raw estimates, but the
+// number of points varies depending on the precision.
+const int kMaxEntries = 201;
+
+// The raw estimates of each table are close to evenly spaced, so a uniform
+// grid with a cell per entry or so narrows any search to one or two entries.
+const int kGridCells = 256;
+
+// Precomputed data for interpolating in the bias table of one precision.
+struct BiasIndex {
+  // Index the tables of raw estimates and biases for a precision. Aborts if
+  // the raw estimates aren't sorted, which would make interpolation
+  // meaningless.
+  void Build(const double* estimates, const double* biases) {
+    count = libcount::ValidTableEntries(estimates, kMaxEntries);
+    assert(count >= 2);
+    for (int i = 1; i < count; ++i) {
+      if (estimates[i] < estimates[i - 1]) {
+        fprintf(stderr, "libcount: empirical estimate data is not sorted\n");
+        abort();
+      }
+    }
+
+    // The slope of the bias between each pair of adjacent entries. Equal
+    // entries are never straddled, so their slope doesn't matter.
+    for (int i = 0; i + 1 < count; ++i) {
+      const double range = estimates[i + 1] - estimates[i];
+      slopes[i] = (range > 0.0) ? (biases[i + 1] - biases[i]) / range : 0.0;
+    }
+
+    // Grid cell c holds the number of entries that fall in cells below c;
+    // none of those can be the right-hand side of a raw estimate in cell c.
+    // Cells are computed with CellOf() throughout, so this holds exactly.
+    low = estimates[0];
+    scale = kGridCells / (estimates[count - 1] - estimates[0]);
+    int entry = 0;
+    for (int c = 0; c < kGridCells; ++c) {
+      while ((entry < count) && (CellOf(estimates[entry]) < c)) {
+        ++entry;
+      }
+      grid[c] = static_cast<uint8_t>(entry);
+    }
+  }
+
+  // Return the grid cell of a raw estimate within the range of the table.
+  int CellOf(double raw_estimate) const {
+    const int cell = static_cast<int>((raw_estimate - low) * scale);
+    return std::min(std::max(cell, 0), kGridCells - 1);
+  }
+
+  int count;
+  double low;
+  double scale;
+  double slopes[kMaxEntries];
+  uint8_t grid[kGridCells];
+};
+
+// Return the bias indexes for all precisions, building them the first time.
+const BiasIndex* BiasIndexes() {
+  struct Indexes {
+    Indexes() {
+      for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_EMPIRICAL_PRECISION; ++p) {
+        const int index = p - HLL_MIN_PRECISION;
+        values[index].Build(ESTIMATE_DATA[index], BIAS_DATA[index]);
+      }
+    }
+    BiasIndex values[HLL_MAX_EMPIRICAL_PRECISION - HLL_MIN_PRECISION + 1];
+  };
+  static const Indexes indexes;
+  return indexes.values;
+}
+
+}  // namespace
+
 namespace libcount {
 
 double EmpiricalAlpha(int precision) {
@@ -45,8 +127,9 @@ double EmpiricalAlpha(int precision) {
 
 double EmpiricalThreshold(int precision) {
   assert(precision >= HLL_MIN_PRECISION);
-  assert(precision <= HLL_MAX_PRECISION);
-  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+  assert(precision <= HLL_MAX_EMPIRICAL_PRECISION);
+  if ((precision < HLL_MIN_PRECISION) ||
+      (precision > HLL_MAX_EMPIRICAL_PRECISION)) {
     return 0.0;
   }
   return THRESHOLD_DATA[precision - HLL_MIN_PRECISION];
@@ -54,85 +137,44 @@ double EmpiricalThreshold(int precision) {
 
 double EmpiricalBias(double raw_estimate, int precision) {
   assert(precision >= HLL_MIN_PRECISION);
-  assert(precision <= HLL_MAX_PRECISION);
-  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+  assert(precision <= HLL_MAX_EMPIRICAL_PRECISION);
+  if ((precision < HLL_MIN_PRECISION) ||
+      (precision > HLL_MAX_EMPIRICAL_PRECISION)) {
     return 0.0;
   }
 
   // There are separate raw estimate range and bias tables for each precision
   // level. The table starts at precision 4, which is at index 0.
   const int index = (precision - HLL_MIN_PRECISION);
+  const BiasIndex& bias_index = BiasIndexes()[index];
 
   // Make aliases for the estimate, bias arrays we're interested in.
   const double* const estimates = ESTIMATE_DATA[index];
   const double* const biases = BIAS_DATA[index];
 
-  // There up to 201 data points in each table of raw estimates, but the
-  // number of points varies depending on the precision. Determine the
-  // actual number of valid entries in the table.
-  const int kMaxEntries = 201;
-  const int kNumValidEntries = ValidTableEntries(estimates, kMaxEntries);
+  // Outside the range of the table, return the first OR last element of the
+  // bias table, respectively.
+  if (raw_estimate < estimates[0]) {
+    return biases[0];
+  } else if (raw_estimate >= estimates[bias_index.count - 1]) {
+    return biases[bias_index.count - 1];
+  }
 
   // The raw estimate tables are sorted in ascending order. Search for the
   // pair of values in the table that straddle the input, 'raw_estimate'. We
-  // do this by searching (linearly) for the first value in the estimate
-  // table that is greater than 'raw_estimate'. We consider this to be the
-  // "right-hand-side" of the pair that straddle the value.
-  int rhs = 0;
-  for (; rhs < kNumValidEntries; ++rhs) {
-    if (estimates[rhs] > raw_estimate) {
-      break;
-    }
-  }
-
-  // Two boundary cases exist: if we exit the loop above and rhs is equal to
-  // zero OR kNumValidEntries, then we'll return the first OR last element
-  // of the bias table, respectively.
-  if (rhs == 0) {
-    return biases[0];
-  } else if (rhs == kNumValidEntries) {
-    return biases[kNumValidEntries - 1];
+  // do this by searching for the first value in the estimate table that is
+  // greater than 'raw_estimate'. We consider this to be the
+  // "right-hand-side" of the pair that straddle the value. The grid gets us
+  // to within a step or two of it.
+  int rhs = bias_index.grid[bias_index.CellOf(raw_estimate)];
+  while (estimates[rhs] <= raw_estimate) {
+    ++rhs;
   }
 
   // Use linear interpolation to find a bias value.
-
-  // Get values of left, right straddling table entries.
   const double left_neighbor = estimates[rhs - 1];
-  const double right_neighbor = estimates[rhs];
-
-  // Compute range (difference between entries) and scale factor.
-  const double range = right_neighbor - left_neighbor;
-  const double scale = (raw_estimate - left_neighbor) / range;
-
-  // Get values of corresponding left, right bias values.
-  const double left_bias = biases[rhs - 1];
-  const double right_bias = biases[rhs];
-
-  // Compute range of bias values and find interpolated value using
-  // the scale factor computed above.
-  const double bias_range = right_bias - left_bias;
-  const double interpolated_bias = (scale * bias_range) + left_bias;
-
-  // Sanity Check the interpolated bias. We assert in debug mode, and abort
-  // in release mode. This seems extreme, but recognize that if the value
-  // we interpolated above does not lie between the left, right entries in
-  // the bias table that this reflects a programmer error in the above
-  // code that intends to interpolate a value.
-  if (left_bias < right_bias) {
-    assert(interpolated_bias >= left_bias);
-    assert(interpolated_bias <= right_bias);
-    if ((interpolated_bias < left_bias) || (interpolated_bias > right_bias)) {
-      abort();
-    }
-  } else {
-    assert(interpolated_bias <= left_bias);
-    assert(interpolated_bias >= right_bias);
-    if ((interpolated_bias > left_bias) || (interpolated_bias < right_bias)) {
-      abort();
-    }
-  }
-
-  return interpolated_bias;
+  return biases[rhs - 1] +
+         (raw_estimate - left_neighbor) * bias_index.slopes[rhs - 1];
 }
 
 // The empirical bias tables contain varying numbers of entries, depending
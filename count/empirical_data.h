@@ -22,7 +22,8 @@ namespace libcount {
 double EmpiricalAlpha(int precision);
 
 // Return the cardinality threshold for the given precision value.
-// Valid values for precision are [4..18] inclusive.
+// Valid values for precision are [4..18] inclusive
+// (HLL_MAX_EMPIRICAL_PRECISION), as for EmpiricalBias().
 double EmpiricalThreshold(int precision);
 
 // Return the empirical bias value for the raw estimate and precision.
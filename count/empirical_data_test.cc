@@ -16,21 +16,68 @@
 #include "count/empirical_data.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "count/hll_data.h"
 #include "count/hll_limits.h"
 
-using libcount::HLL_MAX_PRECISION;
+using libcount::EmpiricalBias;
+using libcount::HLL_MAX_EMPIRICAL_PRECISION;
 using libcount::HLL_MIN_PRECISION;
 using libcount::ValidTableEntries;
 
-// Ensure that the empirical data set is sorted properly.
+// Interpolate a bias value the straightforward way, by scanning the table
+// for the pair of entries that straddle the raw estimate.
+double ReferenceBias(double raw_estimate, int precision_index) {
+  const double* const estimates = ESTIMATE_DATA[precision_index];
+  const double* const biases = BIAS_DATA[precision_index];
+  const int size = ValidTableEntries(estimates, 201);
+  int rhs = 0;
+  while ((rhs < size) && (estimates[rhs] <= raw_estimate)) {
+    ++rhs;
+  }
+  if (rhs == 0) {
+    return biases[0];
+  } else if (rhs == size) {
+    return biases[size - 1];
+  }
+  const double scale = (raw_estimate - estimates[rhs - 1]) /
+                       (estimates[rhs] - estimates[rhs - 1]);
+  return biases[rhs - 1] + scale * (biases[rhs] - biases[rhs - 1]);
+}
+
+// Ensure that the indexed bias lookup agrees with the reference at, between
+// and beyond the table entries.
+bool TestBiasLookup(int p) {
+  const int precision_index = p - HLL_MIN_PRECISION;
+  const double* const estimates = ESTIMATE_DATA[precision_index];
+  const int size = ValidTableEntries(estimates, 201);
+  const double low = estimates[0] - 10.0;
+  const double high = estimates[size - 1] + 10.0;
+  const int kSteps = 100000;
+  for (int i = 0; i <= kSteps + size; ++i) {
+    const double raw_estimate =
+        (i <= kSteps) ? low + (high - low) * i / kSteps
+                      : estimates[i - kSteps - 1];
+    const double expected = ReferenceBias(raw_estimate, precision_index);
+    const double actual = EmpiricalBias(raw_estimate, p);
+    if (fabs(actual - expected) > 1e-9 * (1.0 + fabs(expected))) {
+      fprintf(stderr, "empirical_data_test: bias of %f at p=%d: %f != %f\n",
+              raw_estimate, p, actual, expected);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Ensure that the empirical data set is sorted properly, and that bias
+// lookups interpolate in it correctly.
 
 int main(int argc, char* argv[]) {
   // Sweep through all precision levels.
-  for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; ++p) {
+  for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_EMPIRICAL_PRECISION; ++p) {
     // The arrays are zero indexed; calculate the array index for the
     // associated precision level.
     const int precision_index = p - HLL_MIN_PRECISION;
@@ -52,6 +99,10 @@ int main(int argc, char* argv[]) {
       }
       last = curr;
     }
+
+    if (!TestBiasLookup(p)) {
+      return EXIT_FAILURE;
+    }
   }
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,160 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/estimators.h"
+
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+
+namespace {
+
+using std::max;
+using std::min;
+
+// The sigma function of the paper, which corrects the estimate for the
+// fraction 'x' of registers that are zero.
+double Sigma(double x) {
+  if (x == 1.0) {
+    return HUGE_VAL;
+  }
+  double y = 1.0;
+  double z = x;
+  double z_prev;
+  do {
+    x *= x;
+    z_prev = z;
+    z += x * y;
+    y += y;
+  } while (z != z_prev);
+  return z;
+}
+
+// The tau function of the paper, which corrects the estimate for the
+// fraction '1 - x' of registers that are saturated.
+double Tau(double x) {
+  if ((x == 0.0) || (x == 1.0)) {
+    return 0.0;
+  }
+  double y = 1.0;
+  double z = 1.0 - x;
+  double z_prev;
+  do {
+    x = sqrt(x);
+    z_prev = z;
+    y *= 0.5;
+    z -= (1.0 - x) * (1.0 - x) * y;
+  } while (z != z_prev);
+  return z / 3.0;
+}
+
+}  // namespace
+
+namespace libcount {
+
+double ErtlImprovedEstimate(const uint32_t* histogram, int precision) {
+  assert(histogram != NULL);
+  const double m = static_cast<double>(1 << precision);
+  const int q = 64 - precision;
+
+  // Sum the terms 2 ^ -k by halving, largest k first; zero and saturated
+  // registers are accounted for by the correction functions.
+  double z = m * Tau(1.0 - histogram[q + 1] / m);
+  for (int k = q; k >= 1; --k) {
+    z = 0.5 * (z + histogram[k]);
+  }
+  z += m * Sigma(histogram[0] / m);
+  if (z == 0.0) {
+    return HUGE_VAL;
+  }
+
+  // The bias correction constant in the limit of many registers: 1 / 2ln2.
+  const double kAlphaInfinity = 0.5 / log(2.0);
+  return kAlphaInfinity * m * m / z;
+}
+
+double ErtlMaxLikelihoodEstimate(const uint32_t* histogram, int precision) {
+  assert(histogram != NULL);
+  const int m = 1 << precision;
+  const int q = 64 - precision;
+  if (histogram[q + 1] == static_cast<uint32_t>(m)) {
+    return HUGE_VAL;
+  }
+
+  // Only the range of register values actually present matters.
+  int k_min = 0;
+  while (histogram[k_min] == 0) {
+    ++k_min;
+  }
+  int k_max = q + 1;
+  while (histogram[k_max] == 0) {
+    --k_max;
+  }
+  const int k_min_prime = max(k_min, 1);
+  const int k_max_prime = min(k_max, q);
+
+  double z = 0.0;
+  for (int k = k_max_prime; k >= k_min_prime; --k) {
+    z = 0.5 * z + histogram[k];
+  }
+  z = ldexp(z, -k_min_prime);
+
+  double c_prime = histogram[q + 1];
+  if (q >= 1) {
+    c_prime += histogram[k_max_prime];
+  }
+  const double a = z + histogram[0];
+  const double b = z + ldexp(histogram[q + 1], -q);
+  const double m_prime = m - histogram[0];
+
+  // Start from a lower bound on the estimate, then solve for the root of
+  // the derivative of the log-likelihood with the secant method.
+  double x = (b <= 1.5 * a) ? m_prime / (0.5 * b + a)
+                            : (m_prime / b) * log1p(b / a);
+  const double epsilon = 1e-2 / sqrt(static_cast<double>(m));
+  double delta_x = x;
+  double g_prev = 0.0;
+  while (delta_x > x * epsilon) {
+    const int kappa = ilogb(x) + 2;
+    double x_prime = ldexp(x, -max(k_max_prime, kappa) - 1);
+    const double x_prime2 = x_prime * x_prime;
+    double h = x_prime - x_prime2 / 3.0 +
+               (x_prime2 * x_prime2) * (1.0 / 45.0 - x_prime2 / 472.5);
+    for (int k = kappa - 1; k >= k_max_prime; --k) {
+      const double h_prime = 1.0 - h;
+      h = (x_prime + h * h_prime) / (x_prime + h_prime);
+      x_prime += x_prime;
+    }
+    double g = c_prime * h;
+    for (int k = k_max_prime - 1; k >= k_min_prime; --k) {
+      const double h_prime = 1.0 - h;
+      h = (x_prime + h * h_prime) / (x_prime + h_prime);
+      x_prime += x_prime;
+      g += histogram[k] * h;
+    }
+    g += x * a;
+    if ((g > g_prev) && (m_prime >= g)) {
+      delta_x *= (g - m_prime) / (g_prev - g);
+    } else {
+      delta_x = 0.0;
+    }
+    x += delta_x;
+    g_prev = g;
+  }
+  return m * x;
+}
+
+}  // namespace libcount
@@ -0,0 +1,42 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_ESTIMATORS_H_
+#define COUNT_ESTIMATORS_H_
+
+#include <stdint.h>
+
+namespace libcount {
+
+// Cardinality estimators from "New cardinality estimation algorithms for
+// HyperLogLog sketches" by Otmar Ertl. Unlike the HyperLogLog++ estimator,
+// they need no empirically determined bias tables or thresholds, and so
+// apply at any precision. Both take the histogram of register values: the
+// 'histogram' has kHistogramBuckets entries, of which entry k is the number
+// of registers holding the value k. Both return HUGE_VAL if every register
+// holds its largest possible value, 65 - precision.
+
+// Return the improved raw estimate, which corrects the harmonic mean for
+// registers that are zero or saturated, and is nearly unbiased across the
+// whole range of cardinalities.
+double ErtlImprovedEstimate(const uint32_t* histogram, int precision);
+
+// Return the maximum likelihood estimate, which is slightly more accurate
+// than the improved estimate, but computed iteratively.
+double ErtlMaxLikelihoodEstimate(const uint32_t* histogram, int precision);
+
+}  // namespace libcount
+
+#endif  // COUNT_ESTIMATORS_H_
@@ -0,0 +1,120 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/fixed_hll.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::FixedHLL;
+using libcount::HLL;
+using libcount::HLL_ESTIMATOR_EMPIRICAL;
+using libcount::HLL_ESTIMATOR_IMPROVED;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+
+// A FixedHLL must estimate exactly as a dense HLL of the same precision that
+// has seen the same elements, with each estimator.
+template <int P>
+bool TestMatchesHLL() {
+  const int kEstimators[] = {HLL_ESTIMATOR_EMPIRICAL, HLL_ESTIMATOR_IMPROVED,
+                             HLL_ESTIMATOR_MLE};
+  const uint64_t kCardinalities[] = {0, 1, 100, 10000, 1000000};
+  for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+    FixedHLL<P>* fixed = new FixedHLL<P>;
+    HLL* hll = HLL::Create(P, HLL_OPTION_DENSE, NULL);
+    for (uint64_t i = 0; i < kCardinalities[c]; ++i) {
+      fixed->Update(Hash(i));
+      hll->Update(Hash(i));
+    }
+    EXPECT(fixed->Estimate() == hll->Estimate());
+    for (size_t e = 0; e < sizeof(kEstimators) / sizeof(int); ++e) {
+      HLL* other = HLL::Create(P, kEstimators[e] | HLL_OPTION_DENSE, NULL);
+      EXPECT(other->Merge(hll) == 0);
+      EXPECT(fixed->Estimate(kEstimators[e]) == other->Estimate());
+      delete other;
+    }
+    delete fixed;
+    delete hll;
+  }
+  return true;
+}
+
+// Merging and conversion between FixedHLL and HLL objects, in either
+// direction and for each layout, must match merging two HLL objects.
+bool TestInterop() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4};
+  const uint64_t kCardinalities[] = {50, 100000};
+  for (size_t l = 0; l < sizeof(kLayouts) / sizeof(int); ++l) {
+    for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+      // 'hll' is sparse for the smaller cardinality, and dense otherwise.
+      FixedHLL<12> fixed;
+      HLL* hll = HLL::Create(12, kLayouts[l], NULL);
+      HLL* expected = HLL::Create(12, HLL_OPTION_DENSE, NULL);
+      for (uint64_t i = 0; i < 20000; ++i) {
+        fixed.Update(Hash(i));
+        expected->Update(Hash(i));
+      }
+      for (uint64_t i = 0; i < kCardinalities[c]; ++i) {
+        hll->Update(Hash(i + 5000000));
+        expected->Update(Hash(i + 5000000));
+      }
+
+      // HLL into FixedHLL.
+      FixedHLL<12> merged = fixed;
+      EXPECT(merged.Merge(*hll) == 0);
+      EXPECT(merged.Estimate() == expected->Estimate());
+
+      // FixedHLL into HLL, and conversion.
+      EXPECT(fixed.MergeInto(hll) == 0);
+      EXPECT(hll->Estimate() == expected->Estimate());
+      HLL* converted = merged.ToHLL(kLayouts[l]);
+      EXPECT(converted != NULL);
+      EXPECT(converted->Estimate() == expected->Estimate());
+
+      delete hll;
+      delete expected;
+      delete converted;
+    }
+  }
+
+  // The precisions must match.
+  FixedHLL<12> fixed;
+  HLL* hll = HLL::Create(14);
+  EXPECT(fixed.Merge(*hll) == EINVAL);
+  EXPECT(fixed.MergeInto(hll) == EINVAL);
+  delete hll;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestMatchesHLL<4>() && ok;
+  ok = TestMatchesHLL<12>() && ok;
+  ok = TestMatchesHLL<14>() && ok;
+  ok = TestMatchesHLL<18>() && ok;
+  ok = TestInterop() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
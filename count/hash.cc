@@ -0,0 +1,88 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hash.h"
+
+#include "count/serialization.h"
+
+namespace {
+
+using libcount::LoadLittleEndian32;
+using libcount::LoadLittleEndian64;
+
+inline uint64_t Load32(const uint8_t* p) { return LoadLittleEndian32(p); }
+
+// Read a key of one to three bytes.
+inline uint64_t Load3(const uint8_t* p, size_t size) {
+  return (static_cast<uint64_t>(p[0]) << 16) |
+         (static_cast<uint64_t>(p[size >> 1]) << 8) | p[size - 1];
+}
+
+}  // namespace
+
+namespace libcount {
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint64_t* const secret = kHashSecret;
+  seed ^= HashMix(seed ^ secret[0], secret[1]);
+  uint64_t a = 0;
+  uint64_t b = 0;
+  if (size <= 16) {
+    // Up to sixteen bytes are read as four 32-bit words, which overlap for
+    // keys shorter than that.
+    if (size >= 4) {
+      const size_t middle = (size >> 3) << 2;
+      a = (Load32(p) << 32) | Load32(p + middle);
+      b = (Load32(p + size - 4) << 32) | Load32(p + size - 4 - middle);
+    } else if (size > 0) {
+      a = Load3(p, size);
+    }
+  } else {
+    // Longer keys are consumed in three independent lanes of 48 bytes, then
+    // 16 bytes at a time; the last 16 bytes are read whole, overlapping the
+    // ones before if need be.
+    size_t i = size;
+    if (i > 48) {
+      uint64_t seed1 = seed;
+      uint64_t seed2 = seed;
+      do {
+        seed = HashMix(LoadLittleEndian64(p) ^ secret[1],
+                       LoadLittleEndian64(p + 8) ^ seed);
+        seed1 = HashMix(LoadLittleEndian64(p + 16) ^ secret[2],
+                        LoadLittleEndian64(p + 24) ^ seed1);
+        seed2 = HashMix(LoadLittleEndian64(p + 32) ^ secret[3],
+                        LoadLittleEndian64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = HashMix(LoadLittleEndian64(p) ^ secret[1],
+                     LoadLittleEndian64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = LoadLittleEndian64(p + i - 16);
+    b = LoadLittleEndian64(p + i - 8);
+  }
+  a ^= secret[1];
+  b ^= seed;
+  HashMultiply(&a, &b);
+  return HashMix(a ^ secret[0] ^ size, b ^ secret[1]);
+}
+
+}  // namespace libcount
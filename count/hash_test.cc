@@ -0,0 +1,221 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hash.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "count/c.h"
+#include "count/test_util.h"
+
+using libcount::HashBytes;
+using libcount::HashU64;
+
+// The test vectors published with wyhash, whose seeds are their positions.
+bool TestVectors() {
+  const char* kMessages[] = {
+      "", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+      "1234567890123456789012345678901234567890"
+      "1234567890123456789012345678901234567890"};
+  const uint64_t kHashes[] = {0x93228a4de0eec5a2ULL, 0xc5bac3db178713c4ULL,
+                              0xa97f2f7b1d9b3314ULL, 0x786d1f1df3801df4ULL,
+                              0xdca5a8138ad37c87ULL, 0xb9e734f117cfaf70ULL,
+                              0x6cc5eab49a92d617ULL};
+  for (size_t i = 0; i < sizeof(kHashes) / sizeof(kHashes[0]); ++i) {
+    EXPECT(HashBytes(kMessages[i], strlen(kMessages[i]), i) == kHashes[i]);
+    EXPECT(HLL_hash_bytes(kMessages[i], strlen(kMessages[i]), i) ==
+           kHashes[i]);
+  }
+  return true;
+}
+
+// HashU64() is HashBytes() of the little-endian bytes of the integer.
+bool TestU64() {
+  Random random(1);
+  for (int i = 0; i < 100000; ++i) {
+    const uint64_t value = (i < 1000) ? i : random.Next();
+    const uint64_t seed = (i % 3 == 0) ? 0 : random.Next();
+    uint8_t bytes[8];
+    for (int b = 0; b < 8; ++b) {
+      bytes[b] = static_cast<uint8_t>(value >> (8 * b));
+    }
+    EXPECT(HashU64(value, seed) == HashBytes(bytes, sizeof(bytes), seed));
+    EXPECT(HLL_hash_u64(value, seed) == HashU64(value, seed));
+  }
+  return true;
+}
+
+// The hash depends on the bytes of the key alone, not their alignment or
+// what surrounds them, and keys that differ only in length don't collide.
+bool TestLengths() {
+  Random random(2);
+  std::vector<uint8_t> key(300);
+  random.Fill(&key[0], key.size());
+  std::vector<uint8_t> copy(key.size() + 16);
+  std::set<uint64_t> zeroes;
+  const std::vector<uint8_t> zero(key.size());
+  for (size_t size = 0; size <= 256; ++size) {
+    const uint64_t hash = HashBytes(&key[0], size);
+    for (size_t offset = 1; offset < 16; ++offset) {
+      random.Fill(&copy[0], copy.size());
+      memcpy(&copy[offset], &key[0], size);
+      EXPECT(HashBytes(&copy[offset], size) == hash);
+    }
+    zeroes.insert(HashBytes(&zero[0], size));
+  }
+  EXPECT(zeroes.size() == 257);
+  return true;
+}
+
+// Flipping any one bit of the key flips each bit of the hash with a
+// probability close to a half (SMHasher's avalanche test).
+bool TestAvalanche() {
+  const size_t kSizes[] = {3, 4, 8, 12, 16, 24, 48, 64};
+  const int kTrials = 4000;
+  Random random(3);
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+    const size_t size = kSizes[s];
+    const size_t bits = size * 8;
+    std::vector<int> flips(bits * 64);
+    std::vector<uint8_t> key(size);
+    for (int t = 0; t < kTrials; ++t) {
+      random.Fill(&key[0], size);
+      const uint64_t hash = HashBytes(&key[0], size);
+      for (size_t bit = 0; bit < bits; ++bit) {
+        key[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+        const uint64_t diff = hash ^ HashBytes(&key[0], size);
+        key[bit / 8] ^= static_cast<uint8_t>(1 << (bit % 8));
+        for (int out = 0; out < 64; ++out) {
+          flips[bit * 64 + out] += (diff >> out) & 1;
+        }
+      }
+    }
+    // The standard deviation of each fraction is 1 / (2 * sqrt(kTrials)),
+    // or 0.008; a bias of 0.05 is over six of them.
+    double worst = 0.0;
+    for (size_t i = 0; i < flips.size(); ++i) {
+      const double bias = fabs(static_cast<double>(flips[i]) / kTrials - 0.5);
+      worst = std::max(worst, bias);
+    }
+    EXPECT(worst < 0.05);
+  }
+  return true;
+}
+
+// Keys of 32 bytes with at most two bits set, which weak hashes map to few
+// distinct values (SMHasher's sparse key test), don't collide, not even in
+// the 32 leading bits that index the registers of a sketch beyond chance.
+bool TestSparseKeys() {
+  const size_t kSize = 32;
+  const int kBits = kSize * 8;
+  std::vector<uint64_t> hashes;
+  uint8_t key[kSize] = {0};
+  hashes.push_back(HashBytes(key, kSize));
+  for (int i = 0; i < kBits; ++i) {
+    key[i / 8] ^= static_cast<uint8_t>(1 << (i % 8));
+    hashes.push_back(HashBytes(key, kSize));
+    for (int j = i + 1; j < kBits; ++j) {
+      key[j / 8] ^= static_cast<uint8_t>(1 << (j % 8));
+      hashes.push_back(HashBytes(key, kSize));
+      key[j / 8] ^= static_cast<uint8_t>(1 << (j % 8));
+    }
+    key[i / 8] ^= static_cast<uint8_t>(1 << (i % 8));
+  }
+  std::sort(hashes.begin(), hashes.end());
+  EXPECT(std::unique(hashes.begin(), hashes.end()) == hashes.end());
+
+  // Some 0.13 collisions are expected among 32897 32-bit values.
+  int collisions = 0;
+  for (size_t i = 1; i < hashes.size(); ++i) {
+    collisions += ((hashes[i] >> 32) == (hashes[i - 1] >> 32)) ? 1 : 0;
+  }
+  EXPECT(collisions <= 3);
+  return true;
+}
+
+// Sequential integers and their decimal strings, the keys that most often
+// trip up a sketch, spread evenly over the registers, and the leading zeroes
+// beyond the register index follow the geometric distribution HyperLogLog
+// assumes. Different seeds give unrelated hashes.
+bool TestDistribution() {
+  const int kIndexBits = 10;
+  const int kBuckets = 1 << kIndexBits;
+  const uint64_t kCount = 1 << 20;
+  for (int kind = 0; kind < 3; ++kind) {
+    std::vector<uint64_t> buckets(kBuckets);
+    std::vector<uint64_t> at_least(20);
+    for (uint64_t i = 0; i < kCount; ++i) {
+      uint64_t hash = 0;
+      if (kind == 0) {
+        hash = HashU64(i);
+      } else if (kind == 1) {
+        char text[24];
+        const int size = snprintf(text, sizeof(text), "%llu",
+                                  static_cast<unsigned long long>(i));
+        hash = HashBytes(text, size);
+      } else {
+        hash = HashU64(7, i);
+      }
+      ++buckets[hash >> (64 - kIndexBits)];
+      const uint64_t rest = hash << kIndexBits;
+      for (int zeroes = 0; zeroes < 20; ++zeroes) {
+        if ((rest >> (63 - zeroes)) != 0) {
+          break;
+        }
+        ++at_least[zeroes];
+      }
+    }
+
+    // A chi-squared statistic with 1023 degrees of freedom has a standard
+    // deviation of 45; allow six of them.
+    const double expected = static_cast<double>(kCount) / kBuckets;
+    double chi_squared = 0.0;
+    for (int b = 0; b < kBuckets; ++b) {
+      const double delta = buckets[b] - expected;
+      chi_squared += delta * delta / expected;
+    }
+    EXPECT(chi_squared < (kBuckets - 1) + 6 * 45);
+
+    // Each count of at least 'zeroes + 1' leading zeroes is binomial with
+    // p = 2 ^ -(zeroes + 1); allow six standard deviations.
+    for (int zeroes = 0; zeroes < 20; ++zeroes) {
+      const double p = ldexp(1.0, -(zeroes + 1));
+      const double mean = kCount * p;
+      const double sigma = sqrt(kCount * p * (1 - p));
+      EXPECT(fabs(at_least[zeroes] - mean) < 6 * sigma + 1);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestVectors() && ok;
+  ok = TestU64() && ok;
+  ok = TestLengths() && ok;
+  ok = TestAvalanche() && ok;
+  ok = TestSparseKeys() && ok;
+  ok = TestDistribution() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
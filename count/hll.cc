@@ -18,45 +18,267 @@
 #include <assert.h>
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
 
 #include "count/empirical_data.h"
+#include "count/estimators.h"
+#include "count/kernels.h"
+#include "count/nibble_registers.h"
+#include "count/packed_registers.h"
+#include "count/register_file.h"
+#include "count/serialization.h"
+#include "count/sparse_registers.h"
 #include "count/utility.h"
 
 namespace {
 
+using libcount::ENCODING_BYTES;
+using libcount::ENCODING_PACKED6;
+using libcount::ENCODING_SPARSE;
 using libcount::CountLeadingZeroes;
+using libcount::EmpiricalAlpha;
+using libcount::EmpiricalBias;
+using libcount::EmpiricalThreshold;
+using libcount::ErtlImprovedEstimate;
+using libcount::ErtlMaxLikelihoodEstimate;
+using libcount::HLL_ESTIMATOR_EMPIRICAL;
+using libcount::HLL_ESTIMATOR_IMPROVED;
+using libcount::HLL_ESTIMATOR_MASK;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_MASK;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_MAX_EMPIRICAL_PRECISION;
+using libcount::HLL_OPTION_DENSE;
+using libcount::HLL_OPTION_INCREMENTAL;
+using libcount::IndexAndRankOf;
+using libcount::kHistogramBuckets;
+using libcount::SparseRegisters;
 using std::max;
+using std::min;
+
+// MergeMany() folds its sources into blocks of this many bytes of dense
+// registers at a time: small enough that the block stays in L1 cache while
+// the sources stream past it.
+const int kMergeBlockBytes = 16384;
+
+// UpdateU64Batch() and UpdateBytesBatch() hash this many elements at a time
+// before passing them to UpdateBatch().
+const size_t kHashBlockSize = 256;
+
+// The dense registers of an object allocated along with them start on a
+// cache line of their own.
+const size_t kCacheLineSize = 64;
+
+size_t RoundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+// Adapts a visitor of (index, rank) entries at one precision to entries at a
+// precision 'extra_bits' lower. The index bits dropped are the leading bits
+// of the rank at the lower precision, as in SparseRegisters::DenseRankOf():
+// if any are set, they alone determine the rank; otherwise the rank grows by
+// their count. Empty registers are passed over.
+template <typename Visitor>
+struct FoldVisitor {
+  FoldVisitor(int extra_bits, Visitor visitor)
+      : extra_bits_(extra_bits), visitor_(visitor) {}
+  void operator()(int index, uint8_t rank) const {
+    if (rank == 0) {
+      return;
+    }
+    const uint32_t extra = index & ((1u << extra_bits_) - 1u);
+    if (extra != 0) {
+      const int width = 64 - CountLeadingZeroes(extra);
+      rank = static_cast<uint8_t>(extra_bits_ - width + 1);
+    } else {
+      rank = static_cast<uint8_t>(rank + extra_bits_);
+    }
+    visitor_(index >> extra_bits_, rank);
+  }
+  int extra_bits_;
+  Visitor visitor_;
+};
+
+template <typename Visitor>
+FoldVisitor<Visitor> Folding(int extra_bits, Visitor visitor) {
+  return FoldVisitor<Visitor>(extra_bits, visitor);
+}
 
 // Helper that calculates cardinality according to LinearCounting
 double LinearCounting(double register_count, double zeroed_registers) {
   return register_count * log(register_count / zeroed_registers);
 }
 
-// Helper to calculate the index into the table of registers from the hash
-inline int RegisterIndexOf(uint64_t hash, int precision) {
-  return (hash >> (64 - precision));
+// Return a table of 2 ^ -k, for k in [0, kHistogramBuckets).
+const double* InversePowersOfTwo() {
+  struct Table {
+    Table() {
+      for (int k = 0; k < libcount::kHistogramBuckets; ++k) {
+        values[k] = ldexp(1.0, -k);
+      }
+    }
+    double values[libcount::kHistogramBuckets];
+  };
+  static const Table table;
+  return table.values;
+}
+
+// Convert an estimate to the nearest integer, saturating rather than
+// overflowing when the estimate is out of range (or infinite), and giving
+// zero for a negative one. Every estimator's result passes through here.
+// Rounding matters with many registers, where a handful of elements is
+// estimated a hair below the actual count.
+uint64_t SaturatingCast(double estimate) {
+  const double kLimit = 18446744073709551616.0;  // 2 ^ 64
+  estimate += 0.5;
+  if (!(estimate >= 1.0)) {
+    return 0;
+  }
+  return (estimate < kLimit) ? static_cast<uint64_t>(estimate) : ~uint64_t(0);
 }
 
-// Helper to count the leading zeros (less the bits used for the reg. index)
-inline uint8_t ZeroCountOf(uint64_t hash, int precision) {
-  // Make a mask for isolating the leading bits used for the register index.
-  const uint64_t ONE = 1;
-  const uint64_t mask = ~(((ONE << precision) - ONE) << (64 - precision));
+// Compute the raw estimate based on the HyperLogLog algorithm, given the
+// histogram of register values.
+double RawEstimate(const uint32_t* histogram, int precision) {
+  // Let 'm' be the number of registers.
+  const double m = static_cast<double>(1 << precision);
+
+  // For each register, let 'max' be the contents of the register.
+  // Let 'term' be the reciprocal of 2 ^ max.
+  // Finally, let 'sum' be the sum of all terms. Registers holding the same
+  // value contribute the same term, so we sum over the histogram instead,
+  // smallest terms first.
+  const double* const inverse_powers = InversePowersOfTwo();
+  double sum = 0.0;
+  for (int max = kHistogramBuckets - 1; max >= 0; --max) {
+    sum += histogram[max] * inverse_powers[max];
+  }
 
-  // Count zeroes, less the index bits we're masking off.
-  return (CountLeadingZeroes(hash & mask) - static_cast<uint8_t>(precision));
+  // Next, calculate the harmonic mean
+  const double harmonic_mean = m * (1.0 / sum);
+  assert(harmonic_mean >= 0.0);
+
+  // The harmonic mean is scaled by a constant that depends on the precision.
+  const double estimate = EmpiricalAlpha(precision) * m * harmonic_mean;
+  assert(estimate >= 0.0);
+
+  return estimate;
+}
+
+// Compute the bias-corrected HyperLogLog++ estimate from the histogram.
+double EmpiricalEstimate(const uint32_t* histogram, int precision) {
+  // TODO(tdial): The logic below was more or less copied from the research
+  // paper. It is correct, but seems a little awkward. Have someone else
+  // review this.
+
+  // First, calculate the raw estimate per original HyperLogLog.
+  const double E = RawEstimate(histogram, precision);
+
+  // Determine the threshold under which we apply a bias correction.
+  const int register_count = 1 << precision;
+  const double BiasThreshold = 5 * register_count;
+
+  // Calculate E', the bias corrected estimate.
+  const double EP =
+      (E < BiasThreshold) ? (E - EmpiricalBias(E, precision)) : E;
+
+  // The number of zeroed registers decides whether we use LinearCounting.
+  const int V = histogram[0];
+
+  // H is either the LinearCounting estimate or the bias-corrected estimate.
+  double H = 0.0;
+  if (V != 0) {
+    H = LinearCounting(register_count, V);
+  } else {
+    H = EP;
+  }
+
+  // Under an empirically-determined threshold we return H, otherwise E'.
+  if (H < EmpiricalThreshold(precision)) {
+    return H;
+  } else {
+    return EP;
+  }
+}
+
+// Compute the estimate from the histogram, using the given estimator. There
+// is no bias data beyond HLL_MAX_EMPIRICAL_PRECISION, so the empirical
+// estimator gives way to the improved one there.
+uint64_t EstimateFromHistogram(const uint32_t* histogram, int precision,
+                               int estimator) {
+  if ((estimator == HLL_ESTIMATOR_IMPROVED) ||
+      ((estimator == HLL_ESTIMATOR_EMPIRICAL) &&
+       (precision > HLL_MAX_EMPIRICAL_PRECISION))) {
+    return SaturatingCast(ErtlImprovedEstimate(histogram, precision));
+  } else if (estimator == HLL_ESTIMATOR_MLE) {
+    return SaturatingCast(ErtlMaxLikelihoodEstimate(histogram, precision));
+  }
+  return SaturatingCast(EmpiricalEstimate(histogram, precision));
+}
+
+// Return true if the options passed to HLL::Create() are understood.
+bool ValidOptions(int options) {
+  const int layout = options & HLL_LAYOUT_MASK;
+  if ((layout != HLL_LAYOUT_BYTE) && (layout != HLL_LAYOUT_PACKED6) &&
+      (layout != HLL_LAYOUT_PACKED4)) {
+    return false;
+  }
+  const int estimator = options & HLL_ESTIMATOR_MASK;
+  if ((estimator != HLL_ESTIMATOR_EMPIRICAL) &&
+      (estimator != HLL_ESTIMATOR_IMPROVED) &&
+      (estimator != HLL_ESTIMATOR_MLE)) {
+    return false;
+  }
+  const int fields = HLL_LAYOUT_MASK | HLL_ESTIMATOR_MASK;
+  const int flags = HLL_OPTION_DENSE | HLL_OPTION_INCREMENTAL;
+  return ((options & ~(fields | flags)) == 0);
 }
 
 }  // namespace
 
 namespace libcount {
 
-HLL::HLL(int precision)
-    : precision_(precision), register_count_(0), registers_(NULL) {
+// Visitor that folds sparse register entries into the dense registers.
+struct HLL::MaxVisitor {
+  explicit MaxVisitor(HLL* hll) : hll_(hll) {}
+  void operator()(int index, uint8_t rank) const {
+    hll_->SetRegisterMax(index, rank);
+  }
+  HLL* hll_;
+};
+
+struct HLL::ArrayMaxVisitor {
+  explicit ArrayMaxVisitor(uint8_t* registers) : registers_(registers) {}
+  void operator()(int index, uint8_t rank) const {
+    registers_[index] = max(registers_[index], rank);
+  }
+  uint8_t* registers_;
+};
+
+HLL::HLL(int precision, int options)
+    : precision_(precision),
+      register_count_(0),
+      layout_(options & HLL_LAYOUT_MASK),
+      estimator_(options & HLL_ESTIMATOR_MASK),
+      incremental_((options & HLL_OPTION_INCREMENTAL) != 0),
+      external_(false),
+      borrowed_(false),
+      registers_(NULL),
+      words_(NULL),
+      nibbles_(NULL),
+      sparse_(NULL),
+      file_(NULL),
+      histogram_(NULL) {
   // The precision is vetted by the Create() function.  Assertions nonetheless.
   assert(precision >= HLL_MIN_PRECISION);
   assert(precision <= HLL_MAX_PRECISION);
@@ -64,125 +286,1110 @@ HLL::HLL(int precision)
   // We employ (2 ^ precision) "registers" to store max leading zeroes.
   register_count_ = (1 << precision);
 
-  // Allocate space for the registers. We can safely economize by using bytes
-  // for the counters because we know the value can't ever exceed ~60.
-  registers_ = new uint8_t[register_count_];
-  memset(registers_, 0, register_count_ * sizeof(registers_[0]));
+  // Unless asked otherwise, the dense registers aren't allocated until the
+  // sparse representation grows larger than they would be. The sparse list
+  // can't resolve indexes beyond its own precision, so objects finer than
+  // that start out dense.
+  if (precision <= SparseRegisters::kPrecision) {
+    sparse_ = new SparseRegisters(precision);
+  }
+  if ((sparse_ == NULL) || (options & HLL_OPTION_DENSE)) {
+    ConvertToDense();
+  }
+}
+
+HLL::HLL(int precision, int options, uint8_t* storage, bool borrowed)
+    : precision_(precision),
+      register_count_(1 << precision),
+      layout_(options & HLL_LAYOUT_MASK),
+      estimator_(options & HLL_ESTIMATOR_MASK),
+      incremental_((options & HLL_OPTION_INCREMENTAL) != 0),
+      external_(true),
+      borrowed_(borrowed),
+      registers_(NULL),
+      words_(NULL),
+      nibbles_(NULL),
+      sparse_(NULL),
+      file_(NULL),
+      histogram_(NULL) {
+  assert(storage != NULL);
+  assert(layout_ != HLL_LAYOUT_PACKED4);
+  const size_t dense_size = DenseSizeInBytes();
+  memset(storage, 0, dense_size);
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    words_ = reinterpret_cast<uint64_t*>(storage);
+  } else {
+    registers_ = storage;
+  }
+  // The dense size is a multiple of 8 bytes, so the histogram is aligned.
+  if (incremental_) {
+    histogram_ = reinterpret_cast<uint32_t*>(storage + dense_size);
+    memset(histogram_, 0, kHistogramBuckets * sizeof(histogram_[0]));
+    histogram_[0] = register_count_;
+  }
+}
+
+HLL::HLL(int precision, int options, RegisterFile* file)
+    : precision_(precision),
+      register_count_(1 << precision),
+      layout_(options & HLL_LAYOUT_MASK),
+      estimator_(options & HLL_ESTIMATOR_MASK),
+      incremental_((options & HLL_OPTION_INCREMENTAL) != 0),
+      external_(false),
+      borrowed_(false),
+      registers_(NULL),
+      words_(NULL),
+      nibbles_(NULL),
+      sparse_(NULL),
+      file_(file),
+      histogram_(NULL) {
+  assert(file != NULL);
+  assert(layout_ != HLL_LAYOUT_PACKED4);
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    words_ = reinterpret_cast<uint64_t*>(file->registers());
+  } else {
+    registers_ = file->registers();
+  }
+  if (incremental_) {
+    histogram_ = new uint32_t[kHistogramBuckets];
+    RegisterHistogram(histogram_);
+  }
 }
 
-HLL::~HLL() { delete[] registers_; }
+#if __cplusplus >= 201103L
+HLL::HLL(HLL&& other)
+    : precision_(other.precision_),
+      register_count_(other.register_count_),
+      layout_(other.layout_),
+      estimator_(other.estimator_),
+      incremental_(other.incremental_),
+      external_(false),
+      borrowed_(false),
+      registers_(NULL),
+      words_(NULL),
+      nibbles_(NULL),
+      sparse_(NULL),
+      file_(NULL),
+      histogram_(NULL) {
+  // Registers in a pool slot or a caller's buffer stay with 'other', which
+  // must never come to own memory outside them (see HLLPool::Reset()); the
+  // new object takes a copy, and 'other' is emptied.
+  if (other.borrowed_) {
+    external_ = true;
+    registers_ = other.registers_;
+    words_ = other.words_;
+    histogram_ = other.histogram_;
+    OwnRegisters();
+    other.Reset();
+    return;
+  }
+  other.OwnRegisters();
+  SwapMembers(&other);
+}
+
+HLL& HLL::operator=(HLL&& other) {
+  if (&other == this) {
+    return *this;
+  }
+  if (borrowed_) {
+    // The registers can't leave their storage, so the values move instead.
+    // A sketch of another precision has no place in it.
+    if (other.precision_ != precision_) {
+      fprintf(stderr,
+              "libcount: can't move a sketch of precision %d into one of "
+              "precision %d held by an HLLPool or a caller's buffer\n",
+              other.precision_, precision_);
+      abort();
+    }
+    Reset();
+    estimator_ = other.estimator_;
+    Merge(&other);
+    return *this;
+  }
+  HLL moved(std::move(other));
+  SwapMembers(&moved);
+  return *this;
+}
+#endif
+
+size_t HLL::StorageSize(int precision, int options) {
+  const int register_count = 1 << precision;
+  size_t size = register_count;
+  if ((options & HLL_LAYOUT_MASK) == HLL_LAYOUT_PACKED6) {
+    size = Packed6WordCount(register_count) * sizeof(uint64_t);
+  }
+  if (options & HLL_OPTION_INCREMENTAL) {
+    size += kHistogramBuckets * sizeof(uint32_t);
+  }
+  return size;
+}
+
+void* HLL::operator new(size_t size) { return ::operator new(size); }
+
+void HLL::operator delete(void* object) { ::operator delete(object); }
+
+HLL::~HLL() {
+  delete sparse_;
+  if ((file_ == NULL) && !external_) {
+    delete[] registers_;
+    delete[] words_;
+  }
+  delete file_;
+  delete nibbles_;
+  if (!external_) {
+    delete[] histogram_;
+  }
+}
 
 HLL* HLL::Create(int precision, int* error) {
+  return Create(precision, HLL_LAYOUT_BYTE, error);
+}
+
+HLL* HLL::Create(int precision, int options, int* error) {
   if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
     MaybeAssign(error, EINVAL);
     return NULL;
   }
-  return new HLL(precision);
+  if (!ValidOptions(options)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  return New(precision, options);
+}
+
+HLL* HLL::New(int precision, int options) {
+  // Objects that start out sparse, and the 4-bit layout, whose exceptions
+  // live on the heap regardless, allocate their registers separately.
+  if (((options & HLL_LAYOUT_MASK) == HLL_LAYOUT_PACKED4) ||
+      (((options & HLL_OPTION_DENSE) == 0) &&
+       (precision <= SparseRegisters::kPrecision))) {
+    return new HLL(precision, options);
+  }
+  void* const block = ::operator new(InPlaceSize(precision, options));
+  return Place(block, precision, options, false);
+}
+
+HLL* HLL::CreateIn(void* buffer, size_t size, int precision, int options,
+                   int* error) {
+  assert(buffer != NULL);
+  assert(reinterpret_cast<uintptr_t>(buffer) % sizeof(void*) == 0);
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION) ||
+      !ValidOptions(options) ||
+      ((options & HLL_LAYOUT_MASK) == HLL_LAYOUT_PACKED4)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  if (size < InPlaceSize(precision, options)) {
+    MaybeAssign(error, ERANGE);
+    return NULL;
+  }
+  return Place(buffer, precision, options, true);
+}
+
+size_t HLL::InPlaceSize(int precision, int options) {
+  return sizeof(HLL) + kCacheLineSize - 1 + StorageSize(precision, options);
+}
+
+HLL* HLL::Place(void* block, int precision, int options, bool borrowed) {
+  // The registers start on the first cache line past the object.
+  const uintptr_t start = reinterpret_cast<uintptr_t>(block) + sizeof(HLL);
+  uint8_t* const storage =
+      reinterpret_cast<uint8_t*>(RoundUp(start, kCacheLineSize));
+  return new (block) HLL(precision, options, storage, borrowed);
+}
+
+HLL* HLL::CreateMapped(const char* path, int precision, int options,
+                       int* error) {
+  assert(path != NULL);
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION) ||
+      !ValidOptions(options)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  // The 4-bit layout keeps its exceptions on the heap.
+  const int layout = options & HLL_LAYOUT_MASK;
+  if (layout == HLL_LAYOUT_PACKED4) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+
+  // The registers take the mapping's storage, less any running histogram.
+  int status = 0;
+  RegisterFile* file =
+      RegisterFile::Open(path, precision, layout,
+                         StorageSize(precision, layout), &status);
+  if (file == NULL) {
+    MaybeAssign(error, status);
+    return NULL;
+  }
+
+  // Check the registers as a serialized payload would be; the file may have
+  // been damaged. This reads packed words as little-endian, as the host's
+  // own are on the platforms that provide the mapping.
+  const int encoding =
+      (layout == HLL_LAYOUT_PACKED6) ? ENCODING_PACKED6 : ENCODING_BYTES;
+  if (!ValidDensePayload(file->registers(), encoding, precision)) {
+    delete file;
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  return new HLL(precision, options, file);
+}
+
+int HLL::Checkpoint() {
+  if (file_ == NULL) {
+    return EINVAL;
+  }
+  return file_->Checkpoint();
+}
+
+uint64_t HLL::CheckpointGeneration() const {
+  return (file_ != NULL) ? file_->generation() : 0;
 }
 
 void HLL::Update(uint64_t hash) {
-  // Which register will potentially receive the zero count of this hash?
-  const int index = RegisterIndexOf(hash, precision_);
-  assert(index < register_count_);
+  if (sparse_ != NULL) {
+    // The sparse list only needs to be re-checked for size when it changes.
+    if (sparse_->Update(hash)) {
+      MaybeConvertToDense();
+    }
+    return;
+  }
 
+  // Which register will potentially receive the zero count of this hash?
   // Count the zeroes for the hash, and add one, per the algorithm spec.
-  const uint8_t count = ZeroCountOf(hash, precision_) + 1;
+  int index;
+  uint8_t count;
+  IndexAndRankOf(hash, precision_, &index, &count);
+  assert(index < register_count_);
   assert(count <= 64);
 
+  // The running histogram needs to know the value being replaced.
+  if (histogram_ != NULL) {
+    SetRegisterMax(index, count);
+    return;
+  }
+
   // Update the appropriate register if the new count is greater than current.
-  if (count > registers_[index]) {
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    Packed6SetMax(words_, index, count);
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_->SetMax(index, count);
+  } else if (count > registers_[index]) {
     registers_[index] = count;
   }
 }
 
+void HLL::UpdateBatch(const uint64_t* hashes, size_t n) {
+  assert((hashes != NULL) || (n == 0));
+
+  // Sparse objects may convert to dense part way through the batch.
+  size_t i = 0;
+  while ((i < n) && (sparse_ != NULL)) {
+    Update(hashes[i++]);
+  }
+
+  // The 4-bit layout has no fast path: updates may touch the exception
+  // table. Nor does a running histogram, which must see every change.
+  if ((layout_ == HLL_LAYOUT_PACKED4) || (histogram_ != NULL)) {
+    for (; i < n; ++i) {
+      int index;
+      uint8_t count;
+      IndexAndRankOf(hashes[i], precision_, &index, &count);
+      SetRegisterMax(index, count);
+    }
+    return;
+  }
+
+  // Process hashes in blocks: first compute the register index and count
+  // for every hash in the block (a loop without dependencies between
+  // iterations), then apply them, prefetching the registers that will be
+  // touched a few iterations from now so that cache misses overlap. The
+  // register to prefetch is found from the hash itself, so prefetching
+  // carries on across block boundaries, up to the end of the batch.
+  const size_t kBlockSize = 256;
+  const size_t kPrefetchDistance = 16;
+  const int shift = 64 - precision_;
+  int indices[kBlockSize];
+  uint8_t counts[kBlockSize];
+  for (; i < n; i += kBlockSize) {
+    const size_t block = min(kBlockSize, n - i);
+    const size_t prefetch_end = (n - i > kPrefetchDistance)
+                                    ? n - i - kPrefetchDistance
+                                    : 0;
+    const uint64_t* const ahead = hashes + i + kPrefetchDistance;
+    for (size_t j = 0; j < block; ++j) {
+      IndexAndRankOf(hashes[i + j], precision_, &indices[j], &counts[j]);
+    }
+    if (layout_ == HLL_LAYOUT_PACKED6) {
+      for (size_t j = 0; j < block; ++j) {
+        if (j < prefetch_end) {
+          const int index = static_cast<int>(ahead[j] >> shift);
+          PrefetchForWrite(&words_[index / kPacked6PerWord]);
+        }
+        Packed6SetMax(words_, indices[j], counts[j]);
+      }
+    } else {
+      for (size_t j = 0; j < block; ++j) {
+        if (j < prefetch_end) {
+          PrefetchForWrite(&registers_[ahead[j] >> shift]);
+        }
+        // Unconditionally store the maximum, rather than branching on it.
+        uint8_t* const reg = &registers_[indices[j]];
+        *reg = max(*reg, counts[j]);
+      }
+    }
+  }
+}
+
+void HLL::UpdateU64Batch(const uint64_t* values, size_t n) {
+  assert((values != NULL) || (n == 0));
+  uint64_t hashes[kHashBlockSize];
+  for (size_t i = 0; i < n; i += kHashBlockSize) {
+    const size_t block = min(kHashBlockSize, n - i);
+    for (size_t j = 0; j < block; ++j) {
+      hashes[j] = HashU64(values[i + j]);
+    }
+    UpdateBatch(hashes, block);
+  }
+}
+
+void HLL::UpdateBytesBatch(const void* const* data, const size_t* sizes,
+                           size_t n) {
+  assert(((data != NULL) && (sizes != NULL)) || (n == 0));
+  uint64_t hashes[kHashBlockSize];
+  for (size_t i = 0; i < n; i += kHashBlockSize) {
+    const size_t block = min(kHashBlockSize, n - i);
+    for (size_t j = 0; j < block; ++j) {
+      hashes[j] = HashBytes(data[i + j], sizes[i + j]);
+    }
+    UpdateBatch(hashes, block);
+  }
+}
+
 int HLL::Merge(const HLL* other) {
   assert(other != NULL);
   if (other == NULL) {
     return EINVAL;
   }
 
-  // Ensure that the precision values of the two objects match.
-  if (precision_ != other->precision_) {
+  // The result has the lower of the two precisions.
+  if ((precision_ > other->precision_) && (Fold(other->precision_) != 0)) {
     return EINVAL;
   }
+  if (precision_ < other->precision_) {
+    const int extra_bits = other->precision_ - precision_;
+    if ((sparse_ != NULL) && (other->sparse_ != NULL)) {
+      // Sparse entries are kept at the same precision whatever the dense one.
+      sparse_->Merge(*other->sparse_);
+      MaybeConvertToDense();
+    } else if (other->sparse_ != NULL) {
+      other->sparse_->ForEach(Folding(extra_bits, MaxVisitor(this)));
+    } else {
+      if (sparse_ != NULL) {
+        ConvertToDense();
+      }
+      const FoldVisitor<MaxVisitor> visitor(extra_bits, MaxVisitor(this));
+      for (int i = 0; i < other->register_count_; ++i) {
+        visitor(i, other->GetRegister(i));
+      }
+    }
+    return 0;
+  }
+
+  // Two sparse objects merge into a sparse result, which may then be large
+  // enough to warrant conversion. Otherwise, the result is dense.
+  if (sparse_ != NULL) {
+    if (other->sparse_ != NULL) {
+      sparse_->Merge(*other->sparse_);
+      MaybeConvertToDense();
+      return 0;
+    }
+    ConvertToDense();
+  }
+
+  if (other->sparse_ != NULL) {
+    other->sparse_->ForEach(MaxVisitor(this));
+    return 0;
+  }
 
   // Choose the maximum of corresponding registers from self, other and
   // store it back in self, effectively merging the state of the counters.
-  for (int i = 0; i < register_count_; ++i) {
-    registers_[i] = max(registers_[i], other->registers_[i]);
+  if (layout_ != other->layout_) {
+    for (int i = 0; i < register_count_; ++i) {
+      SetRegisterMax(i, other->GetRegister(i));
+    }
+  } else if (layout_ == HLL_LAYOUT_PACKED6) {
+    Packed6Merge(words_, other->words_, Packed6WordCount(register_count_));
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_->Merge(*other->nibbles_);
+  } else {
+    MaxBytes(registers_, other->registers_, register_count_);
+  }
+
+  // The bulk merges above don't report which registers changed; the merge
+  // had to visit every register anyway, so recount them.
+  if ((histogram_ != NULL) && (layout_ == other->layout_)) {
+    RegisterHistogram(histogram_);
   }
 
   return 0;
 }
 
-double HLL::RawEstimate() const {
-  // Let 'm' be the number of registers.
-  const double m = static_cast<double>(register_count_);
+struct HLL::MergeBlocks {
+  HLL* hll;
+  const HLL* const* sources;
+  size_t n;
+  int first;
+  int last;
+};
 
-  // For each register, let 'max' be the contents of the register.
-  // Let 'term' be the reciprocal of 2 ^ max.
-  // Finally, let 'sum' be the sum of all terms.
-  double sum = 0.0;
+void* HLL::MergeBlocksThread(void* arg) {
+  const MergeBlocks* blocks = static_cast<const MergeBlocks*>(arg);
+  blocks->hll->MergeBlockRange(blocks->sources, blocks->n, blocks->first,
+                               blocks->last);
+  return NULL;
+}
+
+void HLL::MergeBlockRange(const HLL* const* sources, size_t n, int first,
+                          int last) {
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    const int kBlockWords = kMergeBlockBytes / sizeof(uint64_t);
+    const int word_count = Packed6WordCount(register_count_);
+    for (int b = first; b < last; ++b) {
+      const int w = b * kBlockWords;
+      const int count = min(kBlockWords, word_count - w);
+      for (size_t i = 0; i < n; ++i) {
+        Packed6Merge(words_ + w, sources[i]->words_ + w, count);
+      }
+    }
+  } else {
+    for (int b = first; b < last; ++b) {
+      const int offset = b * kMergeBlockBytes;
+      const int count = min(kMergeBlockBytes, register_count_ - offset);
+      for (size_t i = 0; i < n; ++i) {
+        MaxBytes(registers_ + offset, sources[i]->registers_ + offset, count);
+      }
+    }
+  }
+}
+
+int HLL::MergeMany(const HLL* const* sources, size_t n, int threads) {
+  assert((sources != NULL) || (n == 0));
+  if (threads < 1) {
+    return EINVAL;
+  }
+  int precision = precision_;
+  bool dense = false;
+  for (size_t i = 0; i < n; ++i) {
+    if (sources[i] == NULL) {
+      return EINVAL;
+    }
+    precision = min(precision, sources[i]->precision_);
+    dense = dense || (sources[i]->sparse_ == NULL);
+  }
+  if ((precision < precision_) && (Fold(precision) != 0)) {
+    return EINVAL;
+  }
+  if (dense && (sparse_ != NULL)) {
+    ConvertToDense();
+  }
+
+  // Sparse sources, and dense ones of another precision or layout, are
+  // merged one at a time. The rest are left for the pass over the blocks.
+  std::vector<const HLL*> blocked;
+  bool recount = false;
+  for (size_t i = 0; i < n; ++i) {
+    const HLL* other = sources[i];
+    if ((other->sparse_ != NULL) || (other->precision_ != precision_) ||
+        (other->layout_ != layout_)) {
+      Merge(other);
+    } else if (layout_ == HLL_LAYOUT_PACKED4) {
+      nibbles_->Merge(*other->nibbles_);
+      recount = true;
+    } else {
+      blocked.push_back(other);
+    }
+  }
+
+  if (!blocked.empty()) {
+    const int size = (layout_ == HLL_LAYOUT_PACKED6)
+                         ? Packed6WordCount(register_count_) * 8
+                         : register_count_;
+    const int block_count = (size + kMergeBlockBytes - 1) / kMergeBlockBytes;
+    threads = min(threads, block_count);
+    const int per_thread = (block_count + threads - 1) / threads;
+    std::vector<MergeBlocks> ranges(threads);
+    std::vector<pthread_t> ids(threads);
+    std::vector<bool> started(threads, false);
+    for (int t = 0; t < threads; ++t) {
+      MergeBlocks range = {this, &blocked[0], blocked.size(),
+                           min(t * per_thread, block_count),
+                           min((t + 1) * per_thread, block_count)};
+      ranges[t] = range;
+    }
+    for (int t = 1; t < threads; ++t) {
+      started[t] =
+          (pthread_create(&ids[t], NULL, MergeBlocksThread, &ranges[t]) == 0);
+    }
+    // The calling thread takes the first range, and any that couldn't be
+    // given a thread of their own.
+    for (int t = 0; t < threads; ++t) {
+      if (!started[t]) {
+        MergeBlocksThread(&ranges[t]);
+      }
+    }
+    for (int t = 1; t < threads; ++t) {
+      if (started[t]) {
+        pthread_join(ids[t], NULL);
+      }
+    }
+    recount = true;
+  }
+
+  if (recount && (histogram_ != NULL)) {
+    RegisterHistogram(histogram_);
+  }
+  return 0;
+}
+
+int HLL::Fold(int precision) {
+  if ((precision < HLL_MIN_PRECISION) || (precision > precision_) ||
+      (file_ != NULL) || borrowed_) {
+    return EINVAL;
+  }
+  if (precision == precision_) {
+    return 0;
+  }
+
+  // The sparse entries are kept at a higher precision still, and need only
+  // be translated differently; the smaller dense array may now be the
+  // cheaper representation.
+  if (sparse_ != NULL) {
+    sparse_->Fold(precision);
+    precision_ = precision;
+    register_count_ = 1 << precision;
+    MaybeConvertToDense();
+    return 0;
+  }
+
+  // Fold the registers into a new object, and take its registers over.
+  HLL* folded = new HLL(precision, Options() | HLL_OPTION_DENSE);
+  const FoldVisitor<MaxVisitor> visitor(precision_ - precision,
+                                        MaxVisitor(folded));
   for (int i = 0; i < register_count_; ++i) {
-    const double max = static_cast<double>(registers_[i]);
-    const double term = pow(2.0, -max);
-    sum += term;
+    visitor(i, GetRegister(i));
   }
+  std::swap(precision_, folded->precision_);
+  std::swap(register_count_, folded->register_count_);
+  std::swap(registers_, folded->registers_);
+  std::swap(words_, folded->words_);
+  std::swap(nibbles_, folded->nibbles_);
+  std::swap(histogram_, folded->histogram_);
+  // Registers that followed this object are now the folded one's, so that
+  // they aren't deleted with it; they are freed along with this object.
+  std::swap(external_, folded->external_);
+  delete folded;
+  return 0;
+}
 
-  // Next, calculate the harmonic mean
-  const double harmonic_mean = m * (1.0 / sum);
-  assert(harmonic_mean >= 0.0);
+HLL* HLL::Clone() const {
+  if (sparse_ != NULL) {
+    HLL* copy = new HLL(precision_, Options());
+    *copy->sparse_ = *sparse_;
+    return copy;
+  }
+  HLL* copy = New(precision_, Options() | HLL_OPTION_DENSE);
+  if (layout_ == HLL_LAYOUT_PACKED4) {
+    copy->nibbles_->CopyFrom(*nibbles_);
+  } else if (layout_ == HLL_LAYOUT_PACKED6) {
+    memcpy(copy->words_, words_, DenseSizeInBytes());
+  } else {
+    memcpy(copy->registers_, registers_, DenseSizeInBytes());
+  }
+  if (incremental_) {
+    memcpy(copy->histogram_, histogram_,
+           kHistogramBuckets * sizeof(histogram_[0]));
+  }
+  return copy;
+}
 
-  // The harmonic mean is scaled by a constant that depends on the precision.
-  const double estimate = EmpiricalAlpha(precision_) * m * harmonic_mean;
-  assert(estimate >= 0.0);
+void HLL::Reset() {
+  if (sparse_ != NULL) {
+    sparse_->Clear();
+    return;
+  }
+  if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_->Clear();
+  } else if (layout_ == HLL_LAYOUT_PACKED6) {
+    memset(words_, 0, DenseSizeInBytes());
+  } else {
+    memset(registers_, 0, DenseSizeInBytes());
+  }
+  if (incremental_) {
+    memset(histogram_, 0, kHistogramBuckets * sizeof(histogram_[0]));
+    histogram_[0] = register_count_;
+  }
+}
 
-  return estimate;
+int HLL::Swap(HLL* other) {
+  assert(other != NULL);
+  if (other == this) {
+    return 0;
+  }
+
+  // Registers that live with their object stay put where the other's have
+  // the same shape; their values change places instead.
+  if ((external_ || other->external_) && (sparse_ == NULL) &&
+      (other->sparse_ == NULL) && (file_ == NULL) &&
+      (other->file_ == NULL) && (precision_ == other->precision_) &&
+      (layout_ == other->layout_) && (incremental_ == other->incremental_)) {
+    uint8_t* const mine = (words_ != NULL)
+                              ? reinterpret_cast<uint8_t*>(words_)
+                              : registers_;
+    uint8_t* const theirs = (other->words_ != NULL)
+                                ? reinterpret_cast<uint8_t*>(other->words_)
+                                : other->registers_;
+    std::swap_ranges(mine, mine + DenseSizeInBytes(), theirs);
+    if (incremental_) {
+      std::swap_ranges(histogram_, histogram_ + kHistogramBuckets,
+                       other->histogram_);
+    }
+    std::swap(estimator_, other->estimator_);
+    return 0;
+  }
+  if (borrowed_ || other->borrowed_) {
+    return EINVAL;
+  }
+  OwnRegisters();
+  other->OwnRegisters();
+  SwapMembers(other);
+  return 0;
+}
+
+void HLL::OwnRegisters() {
+  if (!external_) {
+    return;
+  }
+  if (words_ != NULL) {
+    const int word_count = Packed6WordCount(register_count_);
+    uint64_t* const words = new uint64_t[word_count];
+    memcpy(words, words_, word_count * sizeof(words_[0]));
+    words_ = words;
+  } else {
+    uint8_t* const registers = new uint8_t[register_count_];
+    memcpy(registers, registers_, register_count_ * sizeof(registers_[0]));
+    registers_ = registers;
+  }
+  if (histogram_ != NULL) {
+    uint32_t* const histogram = new uint32_t[kHistogramBuckets];
+    memcpy(histogram, histogram_, kHistogramBuckets * sizeof(histogram_[0]));
+    histogram_ = histogram;
+  }
+  external_ = false;
+  borrowed_ = false;
+}
+
+void HLL::SwapMembers(HLL* other) {
+  std::swap(precision_, other->precision_);
+  std::swap(register_count_, other->register_count_);
+  std::swap(layout_, other->layout_);
+  std::swap(estimator_, other->estimator_);
+  std::swap(incremental_, other->incremental_);
+  std::swap(external_, other->external_);
+  std::swap(borrowed_, other->borrowed_);
+  std::swap(registers_, other->registers_);
+  std::swap(words_, other->words_);
+  std::swap(nibbles_, other->nibbles_);
+  std::swap(sparse_, other->sparse_);
+  std::swap(file_, other->file_);
+  std::swap(histogram_, other->histogram_);
+}
+
+void HLL::ConvertToDense() {
+  assert((registers_ == NULL) && (words_ == NULL) && (nibbles_ == NULL));
+
+  // Allocate space for the registers. We can safely economize by using bytes
+  // for the counters because we know the value can't ever exceed ~60. The
+  // packed layout goes further, and uses only the 6 bits that are needed.
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    const int word_count = Packed6WordCount(register_count_);
+    words_ = new uint64_t[word_count];
+    memset(words_, 0, word_count * sizeof(words_[0]));
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_ = new NibbleRegisters(register_count_);
+  } else {
+    registers_ = new uint8_t[register_count_];
+    memset(registers_, 0, register_count_ * sizeof(registers_[0]));
+  }
+
+  // All registers start out at zero.
+  if (incremental_) {
+    histogram_ = new uint32_t[kHistogramBuckets];
+    memset(histogram_, 0, kHistogramBuckets * sizeof(histogram_[0]));
+    histogram_[0] = register_count_;
+  }
+
+  // Transfer the contents of the sparse list, if any, which is no longer
+  // needed.
+  SparseRegisters* const sparse = sparse_;
+  sparse_ = NULL;
+  if (sparse != NULL) {
+    sparse->ForEach(MaxVisitor(this));
+    delete sparse;
+  }
+}
+
+void HLL::MaybeConvertToDense() {
+  assert(sparse_ != NULL);
+  if (sparse_->SizeInBytes() >= DenseSizeInBytes()) {
+    ConvertToDense();
+  }
+}
+
+size_t HLL::DenseSizeInBytes() const {
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    return Packed6WordCount(register_count_) * sizeof(uint64_t);
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    return register_count_ / 2;
+  }
+  return register_count_ * sizeof(uint8_t);
+}
+
+uint8_t HLL::GetRegister(int index) const {
+  assert(sparse_ == NULL);
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    return Packed6Get(words_, index);
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    return nibbles_->Get(index);
+  }
+  return registers_[index];
+}
+
+void HLL::SetRegisterMax(int index, uint8_t value) {
+  assert(sparse_ == NULL);
+  if (histogram_ != NULL) {
+    const uint8_t current = GetRegister(index);
+    if (value <= current) {
+      return;
+    }
+    --histogram_[current];
+    ++histogram_[value];
+  }
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    Packed6SetMax(words_, index, value);
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_->SetMax(index, value);
+  } else {
+    registers_[index] = max(registers_[index], value);
+  }
+}
+
+void HLL::RegisterHistogram(uint32_t* histogram) const {
+  assert(sparse_ == NULL);
+  memset(histogram, 0, kHistogramBuckets * sizeof(histogram[0]));
+  if (layout_ == HLL_LAYOUT_PACKED6) {
+    Packed6Histogram(words_, register_count_, histogram);
+  } else if (layout_ == HLL_LAYOUT_PACKED4) {
+    nibbles_->Histogram(histogram);
+  } else {
+    HistogramBytes(registers_, register_count_, histogram);
+  }
 }
 
 uint64_t HLL::Estimate() const {
-  // TODO(tdial): The logic below was more or less copied from the research
-  // paper, less the handling of the sparse register array, which is not
-  // implemented at this time. It is correct, but seems a little awkward.
-  // Have someone else review this.
+  // In the sparse representation, LinearCounting is applied to the registers
+  // at the (much higher) sparse precision, per the HyperLogLog++ paper.
+  if (sparse_ != NULL) {
+    const double m = static_cast<double>(1 << SparseRegisters::kPrecision);
+    const double V = m - sparse_->DistinctIndices();
+    return SaturatingCast(LinearCounting(m, V));
+  }
 
-  // First, calculate the raw estimate per original HyperLogLog.
-  const double E = RawEstimate();
+  // Tally the register values in a single pass, unless a running tally is
+  // kept; everything that follows is computed from the tally.
+  uint32_t scratch[kHistogramBuckets];
+  const uint32_t* histogram = histogram_;
+  if (histogram == NULL) {
+    RegisterHistogram(scratch);
+    histogram = scratch;
+  }
 
-  // Determine the threshold under which we apply a bias correction.
-  const double BiasThreshold = 5 * register_count_;
+  return EstimateFromHistogram(histogram, precision_, estimator_);
+}
 
-  // Calculate E', the bias corrected estimate.
-  const double EP =
-      (E < BiasThreshold) ? (E - EmpiricalBias(E, precision_)) : E;
+int HLL::MergeRegisters(const uint8_t* registers, int precision) {
+  assert(registers != NULL);
+  if ((registers == NULL) || (precision != precision_)) {
+    return EINVAL;
+  }
+  if (sparse_ != NULL) {
+    ConvertToDense();
+  }
+  if ((layout_ == HLL_LAYOUT_BYTE) && (histogram_ == NULL)) {
+    MaxBytes(registers_, registers, register_count_);
+  } else {
+    for (int i = 0; i < register_count_; ++i) {
+      SetRegisterMax(i, registers[i]);
+    }
+  }
+  return 0;
+}
 
-  // The number of zeroed registers decides whether we use LinearCounting.
-  const int V = RegistersEqualToZero();
+int HLL::MergeInto(uint8_t* registers, int precision) const {
+  assert(registers != NULL);
+  if ((registers == NULL) || (precision != precision_)) {
+    return EINVAL;
+  }
+  if (sparse_ != NULL) {
+    sparse_->ForEach(ArrayMaxVisitor(registers));
+  } else if (layout_ == HLL_LAYOUT_BYTE) {
+    MaxBytes(registers, registers_, register_count_);
+  } else {
+    for (int i = 0; i < register_count_; ++i) {
+      registers[i] = max(registers[i], GetRegister(i));
+    }
+  }
+  return 0;
+}
 
-  // H is either the LinearCounting estimate or the bias-corrected estimate.
-  double H = 0.0;
-  if (V != 0) {
-    H = LinearCounting(register_count_, V);
+int HLL::Options() const {
+  const int incremental = incremental_ ? HLL_OPTION_INCREMENTAL : 0;
+  return layout_ | estimator_ | incremental;
+}
+
+int HLL::SerializedEncoding() const {
+  if (sparse_ != NULL) {
+    return ENCODING_SPARSE;
+  }
+  // The 4-bit layout has no encoding of its own; its exception table makes
+  // it unsuitable for copying as is.
+  return (layout_ == HLL_LAYOUT_BYTE) ? ENCODING_BYTES : ENCODING_PACKED6;
+}
+
+size_t HLL::SerializedSize() const {
+  const int encoding = SerializedEncoding();
+  if (encoding == ENCODING_SPARSE) {
+    return kSerializedHeaderSize + 4 + sparse_->EncodedList().size();
+  }
+  return kSerializedHeaderSize + DensePayloadSize(encoding, precision_);
+}
+
+int HLL::Serialize(void* buffer, size_t size) const {
+  assert(buffer != NULL);
+  const size_t needed = SerializedSize();
+  if ((buffer == NULL) || (size < needed)) {
+    return ERANGE;
+  }
+
+  SerializedHeader header;
+  header.version = kSerializedVersion;
+  header.precision = precision_;
+  header.encoding = SerializedEncoding();
+  header.options = Options();
+  header.payload_size = static_cast<uint32_t>(needed - kSerializedHeaderSize);
+  uint8_t* const out = static_cast<uint8_t*>(buffer);
+  WriteSerializedHeader(header, out);
+
+  uint8_t* const payload = out + kSerializedHeaderSize;
+  if (header.encoding == ENCODING_SPARSE) {
+    const std::vector<uint8_t>& list = sparse_->EncodedList();
+    StoreLittleEndian32(sparse_->DistinctIndices(), payload);
+    if (!list.empty()) {
+      memcpy(payload + 4, &list[0], list.size());
+    }
+  } else if (layout_ == HLL_LAYOUT_BYTE) {
+    memcpy(payload, registers_, register_count_);
+  } else if (layout_ == HLL_LAYOUT_PACKED6) {
+    const int word_count = Packed6WordCount(register_count_);
+    for (int w = 0; w < word_count; ++w) {
+      StoreLittleEndian64(words_[w], payload + w * sizeof(words_[w]));
+    }
   } else {
-    H = EP;
+    // Repack the 4-bit registers into 6 bits apiece.
+    const int word_count = Packed6WordCount(register_count_);
+    for (int w = 0; w < word_count; ++w) {
+      uint64_t word = 0;
+      for (int lane = 0; lane < kPacked6PerWord; ++lane) {
+        const int index = w * kPacked6PerWord + lane;
+        if (index < register_count_) {
+          word |= static_cast<uint64_t>(GetRegister(index))
+                  << (lane * kPacked6Bits);
+        }
+      }
+      StoreLittleEndian64(word, payload + w * sizeof(word));
+    }
   }
+  return 0;
+}
 
-  // Under an empirically-determined threshold we return H, otherwise E'.
-  if (H < EmpiricalThreshold(precision_)) {
-    return H;
+HLL* HLL::Deserialize(const void* buffer, size_t size, int* error) {
+  const uint8_t* const in = static_cast<const uint8_t*>(buffer);
+  SerializedHeader header;
+  const int status = ReadSerializedHeader(in, size, &header);
+  if (status != 0) {
+    MaybeAssign(error, status);
+    return NULL;
+  }
+  if (!ValidOptions(header.options) || (header.options & HLL_OPTION_DENSE)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+
+  const uint8_t* const payload = in + kSerializedHeaderSize;
+  if (header.encoding == ENCODING_SPARSE) {
+    const uint32_t count = LoadLittleEndian32(payload);
+    HLL* hll = new HLL(header.precision, header.options);
+    if ((count > (uint32_t(1) << SparseRegisters::kPrecision)) ||
+        !hll->sparse_->LoadEncodedList(payload + 4, header.payload_size - 4,
+                                       static_cast<int>(count))) {
+      delete hll;
+      MaybeAssign(error, EINVAL);
+      return NULL;
+    }
+    // Like the original, the copy converts to dense on its next flush.
+    return hll;
+  }
+
+  if (!ValidDensePayload(payload, header.encoding, header.precision)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  HLL* hll = New(header.precision, header.options | HLL_OPTION_DENSE);
+  hll->LoadDense(payload, header.encoding);
+  return hll;
+}
+
+int HLL::MergeSerialized(const void* buffer, size_t size) {
+  const uint8_t* const in = static_cast<const uint8_t*>(buffer);
+  SerializedHeader header;
+  const int status = ReadSerializedHeader(in, size, &header);
+  if (status != 0) {
+    return status;
+  }
+  // As in Merge(), an object of higher precision is folded on the fly. This
+  // object can't be folded in turn, as the buffer may yet prove invalid.
+  if (!ValidOptions(header.options) || (header.options & HLL_OPTION_DENSE) ||
+      (header.precision < precision_)) {
+    return EINVAL;
+  }
+
+  // The payload is checked in full before anything is merged, so that a
+  // corrupt buffer doesn't leave the object partially updated.
+  const uint8_t* const payload = in + kSerializedHeaderSize;
+  if (header.encoding == ENCODING_SPARSE) {
+    const uint32_t count = LoadLittleEndian32(payload);
+    const uint8_t* const list = payload + 4;
+    const size_t list_size = header.payload_size - 4;
+    if (count > (uint32_t(1) << SparseRegisters::kPrecision)) {
+      return EINVAL;
+    }
+    // As in Merge(), sparse objects stay sparse until they outgrow it.
+    if (sparse_ != NULL) {
+      if (!sparse_->MergeEncodedList(list, list_size,
+                                     static_cast<int>(count))) {
+        return EINVAL;
+      }
+      MaybeConvertToDense();
+      return 0;
+    }
+    if (!SparseRegisters::ValidEncodedList(list, list_size,
+                                           static_cast<int>(count))) {
+      return EINVAL;
+    }
+    SparseRegisters::ForEachEncodedEntry(list, list_size, precision_,
+                                         MaxVisitor(this));
+    return 0;
+  }
+
+  if (!ValidDensePayload(payload, header.encoding, header.precision)) {
+    return EINVAL;
+  }
+  if (sparse_ != NULL) {
+    ConvertToDense();
+  }
+  if (header.precision > precision_) {
+    const FoldVisitor<MaxVisitor> visitor(header.precision - precision_,
+                                          MaxVisitor(this));
+    const int count = 1 << header.precision;
+    for (int i = 0; i < count; ++i) {
+      visitor(i, EncodedRegister(payload, header.encoding, i));
+    }
+    return 0;
+  }
+  MergeDense(payload, header.encoding);
+  return 0;
+}
+
+void HLL::LoadDense(const uint8_t* payload, int encoding) {
+  assert(sparse_ == NULL);
+  if ((encoding == ENCODING_BYTES) && (layout_ == HLL_LAYOUT_BYTE)) {
+    memcpy(registers_, payload, register_count_);
+  } else if ((encoding == ENCODING_PACKED6) &&
+             (layout_ == HLL_LAYOUT_PACKED6)) {
+    const int word_count = Packed6WordCount(register_count_);
+    for (int w = 0; w < word_count; ++w) {
+      words_[w] = LoadLittleEndian64(payload + w * sizeof(words_[w]));
+    }
   } else {
-    return EP;
+    // Merging into the empty registers transcodes the payload.
+    MergeDense(payload, encoding);
+    return;
+  }
+  if (histogram_ != NULL) {
+    RegisterHistogram(histogram_);
   }
 }
 
-int HLL::RegistersEqualToZero() const {
-  int zeroed_registers = 0;
-  for (int i = 0; i < register_count_; ++i) {
-    if (registers_[i] == 0) {
-      ++zeroed_registers;
+void HLL::MergeDense(const uint8_t* payload, int encoding) {
+  assert(sparse_ == NULL);
+  if ((encoding == ENCODING_BYTES) && (layout_ == HLL_LAYOUT_BYTE)) {
+    MaxBytes(registers_, payload, register_count_);
+  } else if ((encoding == ENCODING_PACKED6) &&
+             (layout_ == HLL_LAYOUT_PACKED6)) {
+    // Load the words a block at a time into host byte order, and merge each
+    // block with the SWAR kernel.
+    const int kBlockWords = 64;
+    uint64_t block[kBlockWords];
+    const int word_count = Packed6WordCount(register_count_);
+    for (int w = 0; w < word_count; w += kBlockWords) {
+      const int n = min(kBlockWords, word_count - w);
+      for (int i = 0; i < n; ++i) {
+        block[i] = LoadLittleEndian64(payload + (w + i) * sizeof(block[i]));
+      }
+      Packed6Merge(words_ + w, block, n);
     }
+  } else {
+    // SetRegisterMax() keeps the running histogram, if any, up to date.
+    for (int i = 0; i < register_count_; ++i) {
+      SetRegisterMax(i, EncodedRegister(payload, encoding, i));
+    }
+    return;
+  }
+
+  // As in Merge(), recount after a bulk merge.
+  if (histogram_ != NULL) {
+    RegisterHistogram(histogram_);
   }
-  return zeroed_registers;
+}
+
+uint64_t HLL::EstimateRegisters(const uint8_t* registers, int precision,
+                                int options) {
+  assert(registers != NULL);
+  assert(precision >= HLL_MIN_PRECISION);
+  assert(precision <= HLL_MAX_PRECISION);
+  uint32_t histogram[kHistogramBuckets] = {0};
+  HistogramBytes(registers, size_t(1) << precision, histogram);
+  return EstimateHistogram(histogram, precision, options);
+}
+
+uint64_t HLL::EstimateHistogram(const uint32_t* histogram, int precision,
+                                int options) {
+  assert(histogram != NULL);
+  assert(precision >= HLL_MIN_PRECISION);
+  assert(precision <= HLL_MAX_PRECISION);
+  return EstimateFromHistogram(histogram, precision,
+                               options & HLL_ESTIMATOR_MASK);
 }
 
 }  // namespace libcount
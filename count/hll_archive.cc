@@ -0,0 +1,299 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hll_archive.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "count/hll_limits.h"
+#include "count/serialization.h"
+#include "count/utility.h"
+
+namespace {
+
+using libcount::ENCODING_BYTES;
+using libcount::LoadLittleEndian64;
+using libcount::StoreLittleEndian64;
+
+const uint8_t kMagic[4] = {'L', 'C', 'N', 'A'};
+const int kVersion = 1;
+const size_t kHeaderSize = 64;
+const size_t kIndexEntrySize = 16;
+
+// The register blocks start on a page boundary.
+const uint64_t kBlocksOffset = 4096;
+
+// Offsets of the fields of the header.
+const size_t kCountField = 8;
+const size_t kBlocksOffsetField = 16;
+const size_t kIndexOffsetField = 24;
+
+}  // namespace
+
+namespace libcount {
+
+HLLArchiveWriter::HLLArchiveWriter(FILE* file, int precision)
+    : file_(file),
+      precision_(precision),
+      block_size_(size_t(1) << precision),
+      offset_(kBlocksOffset),
+      scratch_(block_size_) {}
+
+HLLArchiveWriter::~HLLArchiveWriter() {
+  if (file_ != NULL) {
+    fclose(file_);
+  }
+}
+
+HLLArchiveWriter* HLLArchiveWriter::Create(const char* path, int precision,
+                                           int* error) {
+  assert(path != NULL);
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    MaybeAssign(error, errno);
+    return NULL;
+  }
+
+  // The header is written by Finish(); until then, the space for it (and
+  // the padding up to the blocks) is zero, which no reader will accept.
+  const std::vector<uint8_t> zero(kBlocksOffset);
+  if (fwrite(&zero[0], 1, zero.size(), file) != zero.size()) {
+    fclose(file);
+    MaybeAssign(error, EIO);
+    return NULL;
+  }
+  return new HLLArchiveWriter(file, precision);
+}
+
+int HLLArchiveWriter::Add(uint64_t key, const HLL* hll) {
+  assert(hll != NULL);
+  memset(&scratch_[0], 0, block_size_);
+  const int status = hll->MergeInto(&scratch_[0], precision_);
+  if (status != 0) {
+    return status;
+  }
+  return AddBlock(key, &scratch_[0]);
+}
+
+int HLLArchiveWriter::Add(uint64_t key, const uint8_t* registers) {
+  assert(registers != NULL);
+  if (!ValidDensePayload(registers, ENCODING_BYTES, precision_)) {
+    return EINVAL;
+  }
+  return AddBlock(key, registers);
+}
+
+int HLLArchiveWriter::AddBlock(uint64_t key, const uint8_t* registers) {
+  if (file_ == NULL) {
+    return EINVAL;
+  }
+  if (fwrite(registers, 1, block_size_, file_) != block_size_) {
+    return EIO;
+  }
+  index_.push_back(std::make_pair(key, offset_));
+  offset_ += block_size_;
+  return 0;
+}
+
+int HLLArchiveWriter::Finish() {
+  if (file_ == NULL) {
+    return EINVAL;
+  }
+  FILE* const file = file_;
+  file_ = NULL;
+
+  // Keys must be unique for lookups to be well defined.
+  std::sort(index_.begin(), index_.end());
+  for (size_t i = 1; i < index_.size(); ++i) {
+    if (index_[i].first == index_[i - 1].first) {
+      fclose(file);
+      return EINVAL;
+    }
+  }
+
+  bool ok = true;
+  uint8_t entry[kIndexEntrySize];
+  for (size_t i = 0; ok && (i < index_.size()); ++i) {
+    StoreLittleEndian64(index_[i].first, entry);
+    StoreLittleEndian64(index_[i].second, entry + 8);
+    ok = (fwrite(entry, 1, sizeof(entry), file) == sizeof(entry));
+  }
+
+  uint8_t header[kHeaderSize] = {0};
+  memcpy(header, kMagic, sizeof(kMagic));
+  header[4] = kVersion;
+  header[5] = static_cast<uint8_t>(precision_);
+  StoreLittleEndian64(index_.size(), header + kCountField);
+  StoreLittleEndian64(kBlocksOffset, header + kBlocksOffsetField);
+  StoreLittleEndian64(offset_, header + kIndexOffsetField);
+  ok = ok && (fseek(file, 0, SEEK_SET) == 0) &&
+       (fwrite(header, 1, sizeof(header), file) == sizeof(header));
+  ok = (fclose(file) == 0) && ok;
+  return ok ? 0 : EIO;
+}
+
+HLLArchive::HLLArchive(const uint8_t* data, size_t size, int precision,
+                       size_t count, uint64_t blocks_offset,
+                       uint64_t index_offset)
+    : data_(data),
+      size_(size),
+      precision_(precision),
+      count_(count),
+      block_size_(size_t(1) << precision),
+      blocks_offset_(blocks_offset),
+      index_offset_(index_offset) {}
+
+HLLArchive::~HLLArchive() {
+  munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+HLLArchive* HLLArchive::Open(const char* path, int* error) {
+  assert(path != NULL);
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    MaybeAssign(error, errno);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    MaybeAssign(error, errno);
+    close(fd);
+    return NULL;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  if (size < kHeaderSize) {
+    MaybeAssign(error, EINVAL);
+    close(fd);
+    return NULL;
+  }
+
+  // The mapping outlives the descriptor.
+  void* const mapping = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  const int map_errno = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    MaybeAssign(error, map_errno);
+    return NULL;
+  }
+
+  // Lookups touch a few scattered pages, which read-ahead would only dilute.
+  madvise(mapping, size, MADV_RANDOM);
+
+  // Check the header, and that the regions it describes fit the file.
+  const uint8_t* const data = static_cast<const uint8_t*>(mapping);
+  const int precision = data[5];
+  const uint64_t count = LoadLittleEndian64(data + kCountField);
+  const uint64_t blocks_offset = LoadLittleEndian64(data + kBlocksOffsetField);
+  const uint64_t index_offset = LoadLittleEndian64(data + kIndexOffsetField);
+  bool ok = (memcmp(data, kMagic, sizeof(kMagic)) == 0) &&
+            (data[4] == kVersion) && (data[6] == 0) && (data[7] == 0) &&
+            (precision >= HLL_MIN_PRECISION) &&
+            (precision <= HLL_MAX_PRECISION) &&
+            (blocks_offset >= kHeaderSize) &&
+            (blocks_offset % kBlocksOffset == 0) &&
+            (blocks_offset <= index_offset) && (index_offset <= size);
+  for (size_t i = kIndexOffsetField + 8; ok && (i < kHeaderSize); ++i) {
+    ok = (data[i] == 0);
+  }
+  if (ok) {
+    const uint64_t block_size = uint64_t(1) << precision;
+    const uint64_t blocks_size = index_offset - blocks_offset;
+    const uint64_t index_size = size - index_offset;
+    ok = (blocks_size % block_size == 0) &&
+         (blocks_size / block_size == count) &&
+         (index_size % kIndexEntrySize == 0) &&
+         (index_size / kIndexEntrySize == count);
+  }
+  if (!ok) {
+    munmap(mapping, size);
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  return new HLLArchive(data, size, precision, static_cast<size_t>(count),
+                        blocks_offset, index_offset);
+}
+
+uint64_t HLLArchive::key(size_t i) const {
+  assert(i < count_);
+  return LoadLittleEndian64(data_ + index_offset_ + i * kIndexEntrySize);
+}
+
+uint64_t HLLArchive::BlockOffset(size_t i) const {
+  assert(i < count_);
+  const uint64_t offset =
+      LoadLittleEndian64(data_ + index_offset_ + i * kIndexEntrySize + 8);
+  if ((offset < blocks_offset_) || (offset >= index_offset_) ||
+      ((offset - blocks_offset_) % block_size_ != 0)) {
+    return 0;
+  }
+  return offset;
+}
+
+HLLView HLLArchive::view(size_t i) const {
+  const uint64_t offset = BlockOffset(i);
+  assert(offset != 0);
+  if (offset == 0) {
+    return HLLView();
+  }
+  return HLLView(data_ + offset, precision_);
+}
+
+bool HLLArchive::Find(uint64_t key, HLLView* view) const {
+  assert(view != NULL);
+  // Binary search of the index; only the pages probed are faulted in.
+  size_t lo = 0;
+  size_t hi = count_;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (this->key(mid) < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if ((lo == count_) || (this->key(lo) != key) || (BlockOffset(lo) == 0)) {
+    return false;
+  }
+  *view = HLLView(data_ + BlockOffset(lo), precision_);
+  return true;
+}
+
+int HLLArchive::Verify() const {
+  for (size_t i = 0; i < count_; ++i) {
+    if ((i > 0) && (key(i) <= key(i - 1))) {
+      return EINVAL;
+    }
+    const uint64_t offset = BlockOffset(i);
+    if ((offset == 0) ||
+        !ValidDensePayload(data_ + offset, ENCODING_BYTES, precision_)) {
+      return EINVAL;
+    }
+  }
+  return 0;
+}
+
+}  // namespace libcount
@@ -0,0 +1,251 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hll_archive.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "count/fixed_hll.h"
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/hll_view.h"
+#include "count/test_util.h"
+
+using libcount::FixedHLL;
+using libcount::HLL;
+using libcount::HLLArchive;
+using libcount::HLLArchiveWriter;
+using libcount::HLLView;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+
+const int kPrecision = 12;
+
+// Return a path for a scratch file, unique to this process.
+std::string ScratchPath() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/hll_archive_test.%d", getpid());
+  return path;
+}
+
+// Return the byte registers of an HLL object.
+std::vector<uint8_t> RegistersOf(const HLL* hll) {
+  std::vector<uint8_t> registers(1 << kPrecision);
+  hll->MergeInto(&registers[0], kPrecision);
+  return registers;
+}
+
+// Sketches of every layout and size survive the trip through an archive,
+// and views of them behave as the registers they came from.
+bool TestRoundTrip() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4};
+  const int kSketches = 60;
+  const std::string path = ScratchPath();
+  HLLArchiveWriter* writer = HLLArchiveWriter::Create(path.c_str(),
+                                                      kPrecision);
+  EXPECT(writer != NULL);
+
+  // Keys are added out of order.
+  std::vector<HLL*> sketches;
+  for (int s = 0; s < kSketches; ++s) {
+    HLL* hll = HLL::Create(kPrecision, kLayouts[s % 3], NULL);
+    for (int i = 0; i < s * s * 10; ++i) {
+      hll->Update(Hash(s * 1000000 + i));
+    }
+    sketches.push_back(hll);
+    EXPECT(writer->Add(uint64_t(s * 7919 % kSketches) << 32, hll) == 0);
+  }
+  FixedHLL<kPrecision> fixed;
+  for (int i = 0; i < 5000; ++i) {
+    fixed.Update(Hash(i));
+  }
+  EXPECT(writer->Add(1, fixed.registers()) == 0);
+  EXPECT(writer->Finish() == 0);
+  delete writer;
+
+  int error = 0;
+  HLLArchive* archive = HLLArchive::Open(path.c_str(), &error);
+  EXPECT(archive != NULL);
+  EXPECT(archive->precision() == kPrecision);
+  EXPECT(archive->size() == kSketches + 1);
+  EXPECT(archive->Verify() == 0);
+  for (size_t i = 1; i < archive->size(); ++i) {
+    EXPECT(archive->key(i - 1) < archive->key(i));
+  }
+
+  HLL* merged = HLL::Create(kPrecision);
+  HLL* expected = HLL::Create(kPrecision);
+  for (int s = 0; s < kSketches; ++s) {
+    HLLView view;
+    EXPECT(archive->Find(uint64_t(s * 7919 % kSketches) << 32, &view));
+    const std::vector<uint8_t> registers = RegistersOf(sketches[s]);
+    EXPECT(memcmp(view.registers(), &registers[0], registers.size()) == 0);
+    EXPECT(view.Estimate() == HLL::EstimateRegisters(&registers[0],
+                                                     kPrecision, 0));
+    EXPECT(view.Estimate(HLL_ESTIMATOR_MLE) ==
+           HLL::EstimateRegisters(&registers[0], kPrecision,
+                                  HLL_ESTIMATOR_MLE));
+    EXPECT(view.MergeInto(merged) == 0);
+    EXPECT(expected->Merge(sketches[s]) == 0);
+  }
+  EXPECT(merged->Estimate() == expected->Estimate());
+
+  HLLView view;
+  EXPECT(archive->Find(1, &view));
+  EXPECT(view.Estimate() == fixed.Estimate());
+  EXPECT(!archive->Find(2, &view));
+  EXPECT(!archive->Find(~uint64_t(0), &view));
+  EXPECT(archive->key(1) == 1);
+  EXPECT(archive->view(1).registers() == view.registers());
+
+  // A view merges only into objects of its own precision.
+  HLL* other = HLL::Create(kPrecision + 1);
+  EXPECT(view.MergeInto(other) == EINVAL);
+
+  for (int s = 0; s < kSketches; ++s) {
+    delete sketches[s];
+  }
+  delete other;
+  delete merged;
+  delete expected;
+  delete archive;
+  unlink(path.c_str());
+  return true;
+}
+
+// Return the error from opening the archive at 'path'.
+int OpenError(const std::string& path) {
+  int error = 0;
+  HLLArchive* archive = HLLArchive::Open(path.c_str(), &error);
+  delete archive;
+  return (archive != NULL) ? 0 : error;
+}
+
+// Overwrite a byte of a file.
+void Poke(const std::string& path, long offset, uint8_t value) {
+  FILE* file = fopen(path.c_str(), "r+b");
+  fseek(file, offset, SEEK_SET);
+  fputc(value, file);
+  fclose(file);
+}
+
+// Bad input to the writer, and damaged archives, are detected.
+bool TestErrors() {
+  const std::string path = ScratchPath();
+  int error = 0;
+  EXPECT(HLLArchiveWriter::Create(path.c_str(), 3, &error) == NULL);
+  EXPECT(error == EINVAL);
+  EXPECT(HLLArchiveWriter::Create("/nonexistent/archive", 10, &error) ==
+         NULL);
+  EXPECT(error == ENOENT);
+  EXPECT(OpenError("/nonexistent/archive") == ENOENT);
+
+  // An empty archive is fine, but an unfinished one is not.
+  HLLArchiveWriter* writer = HLLArchiveWriter::Create(path.c_str(), 10);
+  EXPECT(writer->Finish() == 0);
+  EXPECT(writer->Finish() == EINVAL);
+  delete writer;
+  EXPECT(OpenError(path) == 0);
+  writer = HLLArchiveWriter::Create(path.c_str(), 10);
+  HLL* hll = HLL::Create(10);
+  EXPECT(writer->Add(1, hll) == 0);
+  delete writer;
+  EXPECT(OpenError(path) == EINVAL);
+
+  // Mismatched or impossible registers, and repeated keys.
+  writer = HLLArchiveWriter::Create(path.c_str(), 10);
+  HLL* other = HLL::Create(11);
+  EXPECT(writer->Add(1, other) == EINVAL);
+  std::vector<uint8_t> registers(1 << 10);
+  registers[5] = 64;
+  EXPECT(writer->Add(1, &registers[0]) == EINVAL);
+  EXPECT(writer->Add(1, hll) == 0);
+  EXPECT(writer->Add(1, hll) == 0);
+  EXPECT(writer->Finish() == EINVAL);
+  delete writer;
+  EXPECT(OpenError(path) == EINVAL);
+
+  // Damage to the header is caught on opening, and to the blocks or index
+  // by Verify().
+  for (uint64_t i = 0; i < 1000; ++i) {
+    hll->Update(Hash(i));
+  }
+  writer = HLLArchiveWriter::Create(path.c_str(), 10);
+  EXPECT(writer->Add(2, hll) == 0);
+  EXPECT(writer->Add(1, hll) == 0);
+  EXPECT(writer->Finish() == 0);
+  delete writer;
+  EXPECT(OpenError(path) == 0);
+  Poke(path, 5, 30);  // precision
+  EXPECT(OpenError(path) == EINVAL);
+  Poke(path, 5, 10);
+  Poke(path, 8, 3);  // count
+  EXPECT(OpenError(path) == EINVAL);
+  Poke(path, 8, 2);
+  Poke(path, 4096 + 7, 60);  // a register of the first block
+  HLLArchive* archive = HLLArchive::Open(path.c_str());
+  EXPECT(archive != NULL);
+  EXPECT(archive->Verify() == EINVAL);
+  delete archive;
+
+  // An unverified block with registers out of any valid range can still be
+  // estimated safely, its registers counted as 63.
+  for (long i = 0; i < 200; ++i) {
+    Poke(path, 4096 + i * 5, static_cast<uint8_t>(64 + i));
+  }
+  archive = HLLArchive::Open(path.c_str());
+  EXPECT(archive != NULL);
+  for (size_t s = 0; s < archive->size(); ++s) {
+    const HLLView view = archive->view(s);
+    std::vector<uint8_t> clamped(view.registers(),
+                                 view.registers() + (1 << 10));
+    for (size_t i = 0; i < clamped.size(); ++i) {
+      clamped[i] = std::min<uint8_t>(clamped[i], 63);
+    }
+    EXPECT(view.Estimate() == HLL::EstimateRegisters(&clamped[0], 10, 0));
+  }
+  delete archive;
+  for (long i = 0; i < 200; ++i) {
+    Poke(path, 4096 + i * 5, 0);
+  }
+  Poke(path, 4096 + 2048, 2);  // the first key, now equal to the second
+  archive = HLLArchive::Open(path.c_str());
+  EXPECT(archive->Verify() == EINVAL);
+  delete archive;
+
+  delete hll;
+  delete other;
+  unlink(path.c_str());
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestRoundTrip() && ok;
+  ok = TestErrors() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
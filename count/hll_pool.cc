@@ -0,0 +1,143 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hll_pool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <new>
+
+#include "count/hll_limits.h"
+#include "count/utility.h"
+
+namespace {
+
+// Slots, and the registers within them, are aligned for any member of an
+// object; a cache line would cost more in padding than malloc() does in
+// chunk headers.
+const size_t kSlotAlignment = 16;
+
+// Slabs hold as many slots as fit in this many bytes, and at least one.
+const size_t kSlabBytes = 1 << 20;
+
+size_t RoundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+namespace libcount {
+
+HLLPool::HLLPool(int precision, int options)
+    : precision_(precision),
+      options_(options),
+      header_size_(RoundUp(sizeof(HLL), kSlotAlignment)),
+      slot_size_(header_size_ + RoundUp(HLL::StorageSize(precision, options),
+                                        kSlotAlignment)),
+      slots_per_slab_(std::max(size_t(1), kSlabBytes / slot_size_)),
+      slab_size_(slots_per_slab_ * slot_size_),
+      slab_(0),
+      slot_(0),
+      free_list_(NULL),
+      live_(0) {}
+
+HLLPool::~HLLPool() {
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    free(slabs_[i]);
+  }
+}
+
+HLLPool* HLLPool::Create(int precision, int options, int* error) {
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  // The 4-bit layout keeps its exceptions on the heap.
+  const int layout = options & HLL_LAYOUT_MASK;
+  const int estimator = options & HLL_ESTIMATOR_MASK;
+  const int fields = HLL_LAYOUT_MASK | HLL_ESTIMATOR_MASK;
+  const int flags = HLL_OPTION_DENSE | HLL_OPTION_INCREMENTAL;
+  if (((layout != HLL_LAYOUT_BYTE) && (layout != HLL_LAYOUT_PACKED6)) ||
+      ((estimator != HLL_ESTIMATOR_EMPIRICAL) &&
+       (estimator != HLL_ESTIMATOR_IMPROVED) &&
+       (estimator != HLL_ESTIMATOR_MLE)) ||
+      ((options & ~(fields | flags)) != 0)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  return new HLLPool(precision, options);
+}
+
+uint8_t* HLLPool::NextSlot() {
+  if (free_list_ != NULL) {
+    uint8_t* const slot = static_cast<uint8_t*>(free_list_);
+    free_list_ = *static_cast<void**>(free_list_);
+    return slot;
+  }
+  if (slot_ == slots_per_slab_) {
+    ++slab_;
+    slot_ = 0;
+  }
+  if (slab_ == slabs_.size()) {
+    void* slab = NULL;
+    if (posix_memalign(&slab, kSlotAlignment, slab_size_) != 0) {
+      return NULL;
+    }
+    try {
+      slabs_.push_back(static_cast<uint8_t*>(slab));
+    } catch (const std::bad_alloc&) {
+      free(slab);
+      return NULL;
+    }
+  }
+  return slabs_[slab_] + (slot_++ * slot_size_);
+}
+
+HLL* HLLPool::Allocate(int* error) {
+  uint8_t* const slot = NextSlot();
+  if (slot == NULL) {
+    MaybeAssign(error, ENOMEM);
+    return NULL;
+  }
+  HLL* const hll =
+      new (slot) HLL(precision_, options_, slot + header_size_, true);
+  ++live_;
+  return hll;
+}
+
+void HLLPool::Free(HLL* hll) {
+  assert(hll != NULL);
+  assert(live_ > 0);
+  hll->~HLL();
+  void* const slot = hll;
+  *static_cast<void**>(slot) = free_list_;
+  free_list_ = slot;
+  --live_;
+}
+
+void HLLPool::Reset() {
+  // Nothing is released object by object: HLL refuses any operation that
+  // would give a pooled object memory outside its slot (see HLL::Swap(),
+  // HLL::Fold() and the move operations), so the slots are all there is.
+  slab_ = 0;
+  slot_ = 0;
+  free_list_ = NULL;
+  live_ = 0;
+}
+
+}  // namespace libcount
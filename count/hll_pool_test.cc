@@ -0,0 +1,262 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hll_pool.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <utility>
+#include <vector>
+
+#include "count/c.h"
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::HLL;
+using libcount::HLLPool;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+using libcount::HLL_OPTION_INCREMENTAL;
+
+// Return the serialized form of an object.
+std::vector<uint8_t> Serialize(const HLL* hll) {
+  std::vector<uint8_t> bytes(hll->SerializedSize());
+  if (hll->Serialize(&bytes[0], bytes.size()) != 0) {
+    bytes.clear();
+  }
+  return bytes;
+}
+
+// Objects from a pool count, merge and serialize exactly as dense objects
+// created on their own.
+bool TestMatchesHLL() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED6 | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_BYTE | HLL_ESTIMATOR_MLE};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int precision = 4; precision <= 18; precision += 7) {
+      HLLPool* pool = HLLPool::Create(precision, kOptions[o]);
+      EXPECT(pool != NULL);
+      EXPECT(pool->precision() == precision);
+      HLL* pooled = pool->Allocate();
+      HLL* hll = HLL::Create(precision, kOptions[o] | HLL_OPTION_DENSE, NULL);
+      EXPECT(pooled->Estimate() == 0);
+      for (uint64_t n = 0; n < 100000; n = n * 3 + 1) {
+        for (uint64_t i = n / 3; i < n; ++i) {
+          pooled->Update(Hash(i));
+          hll->Update(Hash(i));
+        }
+        EXPECT(pooled->Estimate() == hll->Estimate());
+      }
+      EXPECT(Serialize(pooled) == Serialize(hll));
+
+      // Merging either way, with an object in either representation.
+      HLL* sparse = HLL::Create(precision, kOptions[o], NULL);
+      sparse->Update(Hash(1000000));
+      hll->Update(Hash(1000000));
+      EXPECT(pooled->Merge(sparse) == 0);
+      EXPECT(pooled->Estimate() == hll->Estimate());
+      EXPECT(sparse->Merge(pooled) == 0);
+      EXPECT(sparse->Estimate() == hll->Estimate());
+
+      pool->Free(pooled);
+      EXPECT(pool->size() == 0);
+      delete sparse;
+      delete hll;
+      delete pool;
+    }
+  }
+  return true;
+}
+
+// Freed slots are reused before the slabs grow, a reset makes all of them
+// available at once, and objects never share registers.
+bool TestReuse() {
+  const int kPrecision = 10;
+  const size_t kCount = 5000;
+  HLLPool* pool = HLLPool::Create(kPrecision);
+  std::vector<HLL*> objects(kCount);
+  for (size_t i = 0; i < kCount; ++i) {
+    objects[i] = pool->Allocate();
+    objects[i]->Update(Hash(i));
+  }
+  EXPECT(pool->size() == kCount);
+  const size_t size = pool->SizeInBytes();
+  EXPECT(size >= kCount * (1 << kPrecision));
+  for (size_t i = 0; i < kCount; ++i) {
+    EXPECT(objects[i]->Estimate() == 1);
+  }
+
+  for (size_t i = 0; i < kCount; i += 2) {
+    pool->Free(objects[i]);
+  }
+  EXPECT(pool->size() == kCount / 2);
+  for (size_t i = 0; i < kCount; i += 2) {
+    objects[i] = pool->Allocate();
+    EXPECT(objects[i]->Estimate() == 0);
+  }
+  EXPECT(pool->SizeInBytes() == size);
+  for (size_t i = 1; i < kCount; i += 2) {
+    EXPECT(objects[i]->Estimate() == 1);
+  }
+
+  pool->Reset();
+  EXPECT(pool->size() == 0);
+  for (size_t i = 0; i < kCount; ++i) {
+    objects[i] = pool->Allocate();
+    EXPECT(objects[i]->Estimate() == 0);
+  }
+  EXPECT(pool->SizeInBytes() == size);
+  delete pool;
+  return true;
+}
+
+bool TestErrors() {
+  int error = 0;
+  EXPECT(HLLPool::Create(3, HLL_LAYOUT_BYTE, &error) == NULL);
+  EXPECT(error == EINVAL);
+  error = 0;
+  EXPECT(HLLPool::Create(27, HLL_LAYOUT_BYTE, &error) == NULL);
+  EXPECT(error == EINVAL);
+  error = 0;
+  EXPECT(HLLPool::Create(10, HLL_LAYOUT_PACKED4, &error) == NULL);
+  EXPECT(error == EINVAL);
+  EXPECT(HLLPool::Create(10, 0x300, NULL) == NULL);
+
+  // The registers can't shrink in place.
+  HLLPool* pool = HLLPool::Create(12);
+  HLL* hll = pool->Allocate();
+  HLL* lower = HLL::Create(10);
+  EXPECT(hll->Fold(10) == EINVAL);
+  EXPECT(hll->Merge(lower) == EINVAL);
+  EXPECT(lower->Merge(hll) == 0);
+  delete lower;
+  delete pool;
+  return true;
+}
+
+// Pooled objects swap register values with objects of the same shape, and
+// can't swap with others.
+bool TestSwap() {
+  HLLPool* pool = HLLPool::Create(12, HLL_LAYOUT_PACKED6);
+  HLL* a = pool->Allocate();
+  HLL* b = pool->Allocate();
+  HLL* sparse = HLL::Create(10);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    a->Update(Hash(i));
+  }
+  b->Update(Hash(1));
+  sparse->Update(Hash(2));
+  const uint64_t estimate = a->Estimate();
+  EXPECT(a->Swap(b) == 0);
+  EXPECT(a->Estimate() == 1);
+  EXPECT(b->Estimate() == estimate);
+  EXPECT(b->Swap(sparse) == EINVAL);
+  EXPECT(b->Estimate() == estimate);
+  pool->Free(b);
+  b = pool->Allocate();
+  EXPECT(b->Estimate() == 0);
+  a->Reset();
+  EXPECT(a->Estimate() == 0);
+  delete sparse;
+  delete pool;
+  return true;
+}
+
+#if __cplusplus >= 201103L
+// A pooled object keeps its slot when moved to or from: it takes the
+// register values of a sketch moved into it, whatever that sketch's layout
+// or representation, and gives a copy of its own to one moved out of it.
+bool TestMove() {
+  HLLPool* pool =
+      HLLPool::Create(12, HLL_LAYOUT_PACKED6 | HLL_OPTION_INCREMENTAL);
+  HLL* pooled = pool->Allocate();
+  HLL* sparse = HLL::Create(12);
+  HLL* expected = HLL::Create(12, HLL_OPTION_DENSE, NULL);
+  for (uint64_t i = 0; i < 5000; ++i) {
+    pooled->Update(Hash(i));
+  }
+  for (uint64_t i = 10000; i < 10300; ++i) {
+    sparse->Update(Hash(i));
+    expected->Update(Hash(i));
+  }
+  const uint64_t estimate = expected->Estimate();
+  *pooled = std::move(*sparse);
+  EXPECT(pooled->Estimate() == estimate);
+
+  // Moving out leaves the slot empty, and the heap object independent.
+  HLL moved(std::move(*pooled));
+  EXPECT(moved.Estimate() == estimate);
+  EXPECT(pooled->Estimate() == 0);
+  pooled->Update(Hash(1));
+  EXPECT(moved.Estimate() == estimate);
+  HLL* heap = HLL::Create(10);
+  *heap = std::move(*pooled);
+  EXPECT(heap->Estimate() == 1);
+  EXPECT(heap->Fold(8) == 0);
+
+  // Nothing the pool holds has been lent to the heap.
+  pool->Reset();
+  delete heap;
+  delete sparse;
+  delete expected;
+  delete pool;
+  return true;
+}
+#endif
+
+bool TestCInterface() {
+  const int kCount = 3000;
+  hll_pool_t* pool = HLL_pool_create(12, HLL_LAYOUT_PACKED6, NULL);
+  EXPECT(pool != NULL);
+  std::vector<hll_t*> contexts(kCount);
+  for (int i = 0; i < kCount; ++i) {
+    contexts[i] = HLL_pool_alloc(pool, NULL);
+    HLL_update(contexts[i], Hash(i));
+    HLL_update(contexts[i], Hash(i + kCount));
+  }
+  for (int i = 0; i < kCount; ++i) {
+    EXPECT(HLL_estimate(contexts[i]) == 2);
+  }
+  HLL_pool_release(pool, contexts[7]);
+  contexts[7] = HLL_pool_alloc(pool, NULL);
+  EXPECT(HLL_estimate(contexts[7]) == 0);
+  HLL_pool_reset(pool);
+  hll_t* ctx = HLL_pool_alloc(pool, NULL);
+  EXPECT(HLL_estimate(ctx) == 0);
+  EXPECT(HLL_pool_create(12, HLL_LAYOUT_PACKED4, NULL) == NULL);
+  HLL_pool_free(pool);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestMatchesHLL() && ok;
+  ok = TestReuse() && ok;
+  ok = TestErrors() && ok;
+  ok = TestSwap() && ok;
+#if __cplusplus >= 201103L
+  ok = TestMove() && ok;
+#endif
+  ok = TestCInterface() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,761 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/hll.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "count/c.h"
+#include "count/hll_limits.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::HLL;
+using libcount::HLL_ESTIMATOR_IMPROVED;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_MASK;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+using libcount::HLL_OPTION_INCREMENTAL;
+using libcount::HLL_MAX_EMPIRICAL_PRECISION;
+using libcount::HLL_MAX_PRECISION;
+using libcount::HLL_MIN_PRECISION;
+
+// Insert the hashes of the integers [first, last) into the object.
+void Fill(HLL* hll, uint64_t first, uint64_t last) {
+  for (uint64_t i = first; i < last; ++i) {
+    hll->Update(Hash(i));
+  }
+}
+
+// Return the relative error of an estimate.
+double RelativeError(uint64_t estimate, uint64_t actual) {
+  return fabs(static_cast<double>(estimate) - static_cast<double>(actual)) /
+         static_cast<double>(actual);
+}
+
+// Small cardinalities are counted almost exactly in the sparse representation.
+bool TestSparseAccuracy() {
+  for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; ++p) {
+    HLL* hll = HLL::Create(p);
+    EXPECT(hll != NULL);
+    EXPECT(hll->Estimate() == 0);
+    Fill(hll, 0, 3);
+    EXPECT(hll->Estimate() == 3);
+    delete hll;
+  }
+  return true;
+}
+
+// Cardinalities large enough to force the switch to dense registers remain
+// within the expected error bounds, in each precision.
+bool TestConversionAccuracy() {
+  const uint64_t kCardinalities[] = {100, 1000, 10000, 100000};
+  for (int p = 10; p <= HLL_MAX_EMPIRICAL_PRECISION; ++p) {
+    for (size_t i = 0; i < sizeof(kCardinalities) / sizeof(uint64_t); ++i) {
+      HLL* hll = HLL::Create(p);
+      Fill(hll, 0, kCardinalities[i]);
+      // Allow roughly five standard errors.
+      const double tolerance = 5.0 * 1.04 / sqrt(static_cast<double>(1 << p));
+      EXPECT(RelativeError(hll->Estimate(), kCardinalities[i]) < tolerance);
+      delete hll;
+    }
+  }
+  return true;
+}
+
+// Merging must give the same result as counting the union, regardless of
+// the representations of the objects being merged.
+bool TestMergeRepresentations() {
+  const int kPrecision = 14;
+  const uint64_t kSmall = 200;
+  const uint64_t kLarge = 50000;
+
+  // Sparse + sparse.
+  HLL* a = HLL::Create(kPrecision);
+  HLL* b = HLL::Create(kPrecision);
+  HLL* u = HLL::Create(kPrecision);
+  Fill(a, 0, kSmall);
+  Fill(b, kSmall / 2, 2 * kSmall);
+  Fill(u, 0, 2 * kSmall);
+  EXPECT(a->Merge(b) == 0);
+  EXPECT(a->Estimate() == u->Estimate());
+  delete a;
+  delete b;
+  delete u;
+
+  // Dense + sparse, and sparse + dense.
+  HLL* dense = HLL::Create(kPrecision);
+  HLL* sparse = HLL::Create(kPrecision);
+  u = HLL::Create(kPrecision);
+  Fill(dense, 0, kLarge);
+  Fill(sparse, kLarge, kLarge + kSmall);
+  Fill(u, 0, kLarge + kSmall);
+  HLL* sparse_copy = HLL::Create(kPrecision);
+  Fill(sparse_copy, kLarge, kLarge + kSmall);
+  EXPECT(dense->Merge(sparse) == 0);
+  EXPECT(dense->Estimate() == u->Estimate());
+  HLL* dense_copy = HLL::Create(kPrecision);
+  Fill(dense_copy, 0, kLarge);
+  EXPECT(sparse_copy->Merge(dense_copy) == 0);
+  EXPECT(sparse_copy->Estimate() == u->Estimate());
+  delete dense;
+  delete sparse;
+  delete sparse_copy;
+  delete dense_copy;
+  delete u;
+
+  // Precision mismatch: the result has the lower precision.
+  a = HLL::Create(kPrecision);
+  b = HLL::Create(kPrecision + 1);
+  EXPECT(a->Merge(b) == 0);
+  EXPECT(a->precision() == kPrecision);
+  EXPECT(b->Merge(a) == 0);
+  EXPECT(b->precision() == kPrecision);
+  delete a;
+  delete b;
+  return true;
+}
+
+// Every register layout must produce exactly the same estimates, and merge
+// with objects of either layout.
+bool TestRegisterLayouts() {
+  const int kLayouts[] = {HLL_LAYOUT_PACKED6, HLL_LAYOUT_PACKED4};
+  const uint64_t kCardinalities[] = {10, 1000, 100000};
+  for (size_t l = 0; l < sizeof(kLayouts) / sizeof(int); ++l) {
+    for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; ++p) {
+      for (size_t i = 0; i < sizeof(kCardinalities) / sizeof(uint64_t); ++i) {
+        const uint64_t n = kCardinalities[i];
+        // Start dense, since sparse objects convert at different sizes.
+        const int options = kLayouts[l] | HLL_OPTION_DENSE;
+        HLL* bytes = HLL::Create(p, HLL_LAYOUT_BYTE | HLL_OPTION_DENSE, NULL);
+        HLL* packed = HLL::Create(p, options, NULL);
+        HLL* other = HLL::Create(p, options, NULL);
+        EXPECT((bytes != NULL) && (packed != NULL) && (other != NULL));
+        Fill(bytes, 0, n);
+        Fill(packed, 0, n / 2);
+        Fill(other, n / 2, n);
+        EXPECT(packed->Merge(other) == 0);
+        EXPECT(packed->Estimate() == bytes->Estimate());
+        Fill(other, n, 2 * n);
+        Fill(bytes, n, 2 * n);
+        EXPECT(packed->Merge(other) == 0);
+        EXPECT(packed->Estimate() == bytes->Estimate());
+        EXPECT(other->Merge(bytes) == 0);
+        EXPECT(other->Estimate() == bytes->Estimate());
+        delete bytes;
+        delete packed;
+        delete other;
+      }
+    }
+  }
+  EXPECT(HLL::Create(14, HLL_LAYOUT_MASK, NULL) == NULL);
+
+  // Sparse objects of either layout convert to their own dense layout.
+  HLL* bytes = HLL::Create(14);
+  HLL* packed = HLL::Create(14, HLL_LAYOUT_PACKED6, NULL);
+  Fill(bytes, 0, 100000);
+  Fill(packed, 0, 100000);
+  EXPECT(packed->Estimate() == bytes->Estimate());
+  delete bytes;
+  delete packed;
+  return true;
+}
+
+// The 4-bit layout raises its offset as registers fill up; merging objects
+// with different offsets must give the same result as the byte layout.
+bool TestNibbleOffsets() {
+  for (int p = HLL_MIN_PRECISION; p <= 10; ++p) {
+    const int bytes_options = HLL_LAYOUT_BYTE | HLL_OPTION_DENSE;
+    const int nibble_options = HLL_LAYOUT_PACKED4 | HLL_OPTION_DENSE;
+    HLL* full_bytes = HLL::Create(p, bytes_options, NULL);
+    HLL* full_nibbles = HLL::Create(p, nibble_options, NULL);
+    HLL* few_bytes = HLL::Create(p, bytes_options, NULL);
+    HLL* few_nibbles = HLL::Create(p, nibble_options, NULL);
+    Fill(full_bytes, 0, 1000000);
+    Fill(full_nibbles, 0, 1000000);
+    Fill(few_bytes, 2000000, 2000100);
+    Fill(few_nibbles, 2000000, 2000100);
+    EXPECT(full_nibbles->Estimate() == full_bytes->Estimate());
+    EXPECT(few_nibbles->Merge(full_nibbles) == 0);
+    EXPECT(few_bytes->Merge(full_bytes) == 0);
+    EXPECT(few_nibbles->Estimate() == few_bytes->Estimate());
+    EXPECT(full_nibbles->Merge(few_nibbles) == 0);
+    EXPECT(full_nibbles->Estimate() == few_bytes->Estimate());
+    delete full_bytes;
+    delete full_nibbles;
+    delete few_bytes;
+    delete few_nibbles;
+  }
+  return true;
+}
+
+// At low precision the 4-bit layout's offset can reach far enough that the
+// upper nibble values would lie past the last histogram bucket. Saturating
+// every register must still estimate like the byte layout.
+bool TestSaturatedNibbles() {
+  for (int p = HLL_MIN_PRECISION; p <= 8; ++p) {
+    HLL* bytes = HLL::Create(p, HLL_LAYOUT_BYTE | HLL_OPTION_DENSE, NULL);
+    HLL* nibbles = HLL::Create(p, HLL_LAYOUT_PACKED4 | HLL_OPTION_DENSE, NULL);
+    // A hash with only index bits set carries the largest possible rank.
+    for (uint64_t i = 0; i < (uint64_t(1) << p); ++i) {
+      bytes->Update(i << (64 - p));
+      nibbles->Update(i << (64 - p));
+    }
+    EXPECT(nibbles->Estimate() == bytes->Estimate());
+    delete bytes;
+    delete nibbles;
+  }
+  return true;
+}
+
+// UpdateBatch() must be equivalent to a sequence of calls to Update().
+bool TestUpdateBatch() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_DENSE};
+  const size_t kCount = 100000;
+  uint64_t* hashes = new uint64_t[kCount];
+  for (size_t i = 0; i < kCount; ++i) {
+    hashes[i] = Hash(i % (kCount / 2));
+  }
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; ++p) {
+      HLL* single = HLL::Create(p, kOptions[o], NULL);
+      HLL* batch = HLL::Create(p, kOptions[o], NULL);
+      for (size_t i = 0; i < kCount; ++i) {
+        single->Update(hashes[i]);
+      }
+      // Use uneven batch sizes to exercise partial blocks.
+      batch->UpdateBatch(hashes, 7);
+      batch->UpdateBatch(hashes + 7, kCount - 7);
+      batch->UpdateBatch(hashes, 0);
+      EXPECT(batch->Estimate() == single->Estimate());
+      delete single;
+      delete batch;
+    }
+  }
+  delete[] hashes;
+  return true;
+}
+
+// An object that maintains its register histogram incrementally must give
+// the same estimates as one that recomputes it, through updates, batches and
+// merges of either representation and any layout.
+bool TestIncremental() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4};
+  const int kPrecision = 12;
+  uint64_t hashes[5000];
+  for (size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); ++i) {
+    hashes[i] = Hash(3000000 + i);
+  }
+  for (size_t l = 0; l < sizeof(kLayouts) / sizeof(int); ++l) {
+    HLL* scan = HLL::Create(kPrecision, kLayouts[l], NULL);
+    HLL* tally =
+        HLL::Create(kPrecision, kLayouts[l] | HLL_OPTION_INCREMENTAL, NULL);
+    EXPECT(tally != NULL);
+    for (uint64_t n = 0; n < 100000; n += 5000) {
+      Fill(scan, n, n + 5000);
+      Fill(tally, n, n + 5000);
+      EXPECT(tally->Estimate() == scan->Estimate());
+    }
+    scan->UpdateBatch(hashes, sizeof(hashes) / sizeof(hashes[0]));
+    tally->UpdateBatch(hashes, sizeof(hashes) / sizeof(hashes[0]));
+    EXPECT(tally->Estimate() == scan->Estimate());
+
+    // Merge in a sparse object, a dense one of the same layout, and a dense
+    // one of a different layout.
+    HLL* sparse = HLL::Create(kPrecision);
+    HLL* same = HLL::Create(kPrecision, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+    const int other_layout = (kLayouts[(l + 1) % 3]) | HLL_OPTION_DENSE;
+    HLL* other = HLL::Create(kPrecision, other_layout, NULL);
+    Fill(sparse, 5000000, 5000050);
+    Fill(same, 6000000, 6050000);
+    Fill(other, 7000000, 7200000);
+    HLL* inputs[] = {sparse, same, other};
+    for (int i = 0; i < 3; ++i) {
+      EXPECT(scan->Merge(inputs[i]) == 0);
+      EXPECT(tally->Merge(inputs[i]) == 0);
+      EXPECT(tally->Estimate() == scan->Estimate());
+    }
+
+    // Merging into a sparse object converts it to dense.
+    HLL* empty = HLL::Create(kPrecision, HLL_OPTION_INCREMENTAL, NULL);
+    EXPECT(empty->Merge(other) == 0);
+    EXPECT(empty->Estimate() == other->Estimate());
+
+    delete scan;
+    delete tally;
+    delete sparse;
+    delete same;
+    delete other;
+    delete empty;
+  }
+  return true;
+}
+
+// Return the registers of an object, a byte apiece.
+std::vector<uint8_t> RegistersOf(const HLL* hll, int precision) {
+  std::vector<uint8_t> registers(1 << precision);
+  hll->MergeInto(&registers[0], precision);
+  return registers;
+}
+
+// MergeMany() must give the same result as merging the sources one at a
+// time, whatever their representations and the number of threads.
+bool TestMergeMany() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_PACKED6 | HLL_OPTION_INCREMENTAL};
+  const int kSourceOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                                HLL_LAYOUT_PACKED4};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; p += 7) {
+      // Sources of every layout, some sparse and some dense, and the same
+      // layout as the destination several times over.
+      std::vector<HLL*> sources;
+      for (int i = 0; i < 12; ++i) {
+        const int options = (i < 3) ? kSourceOptions[i] : kOptions[o];
+        HLL* source = HLL::Create(p, options, NULL);
+        const uint64_t first = i * 1000000;
+        Fill(source, first, first + ((i % 4 == 3) ? 20 : 100000 + i * 1000));
+        sources.push_back(source);
+      }
+      for (int threads = 1; threads <= 4; threads += 3) {
+        HLL* one = HLL::Create(p, kOptions[o], NULL);
+        HLL* many = HLL::Create(p, kOptions[o], NULL);
+        Fill(one, 0, 10);
+        Fill(many, 0, 10);
+        for (size_t i = 0; i < sources.size(); ++i) {
+          EXPECT(one->Merge(sources[i]) == 0);
+        }
+        EXPECT(many->MergeMany(&sources[0], sources.size(), threads) == 0);
+        EXPECT(many->Estimate() == one->Estimate());
+        EXPECT(RegistersOf(many, p) == RegistersOf(one, p));
+        delete one;
+        delete many;
+      }
+
+      // Sparse sources alone merge as Merge() would; none at all is a
+      // no-op.
+      HLL* one = HLL::Create(p, kOptions[o], NULL);
+      HLL* many = HLL::Create(p, kOptions[o], NULL);
+      EXPECT(many->MergeMany(NULL, 0) == 0);
+      EXPECT(one->Merge(sources[3]) == 0);
+      EXPECT(one->Merge(sources[7]) == 0);
+      const HLL* sparse[] = {sources[3], sources[7]};
+      EXPECT(many->MergeMany(sparse, 2) == 0);
+      EXPECT(many->Estimate() == one->Estimate());
+      delete one;
+      delete many;
+
+      for (size_t i = 0; i < sources.size(); ++i) {
+        delete sources[i];
+      }
+    }
+  }
+
+  // A missing source leaves the object unchanged.
+  HLL* hll = HLL::Create(12);
+  HLL* same = HLL::Create(12);
+  Fill(same, 0, 100);
+  const HLL* missing[] = {same, NULL};
+  EXPECT(hll->MergeMany(missing, 2) == EINVAL);
+  EXPECT(hll->Estimate() == 0);
+  EXPECT(hll->MergeMany(missing, 1, 0) == EINVAL);
+  EXPECT(hll->MergeMany(missing, 1, 2) == 0);
+  EXPECT(hll->Estimate() == 100);
+  delete hll;
+  delete same;
+  return true;
+}
+
+// Folding an object to a lower precision gives exactly the registers of an
+// object of that precision that saw the same elements, in any layout and
+// either representation; so does merging objects of different precisions.
+bool TestFold() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL};
+  const uint64_t kCardinalities[] = {10, 1000, 100000};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int p = 8; p <= HLL_MAX_EMPIRICAL_PRECISION; p += 5) {
+      for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+        const uint64_t n = kCardinalities[c];
+        const int lower = (p + HLL_MIN_PRECISION) / 2;
+        HLL* hll = HLL::Create(p, kOptions[o], NULL);
+        HLL* expected = HLL::Create(lower, kOptions[o], NULL);
+        Fill(hll, 0, n);
+        Fill(expected, 0, n);
+        EXPECT(hll->Fold(p) == 0);
+        EXPECT(hll->Fold(lower) == 0);
+        EXPECT(hll->precision() == lower);
+        EXPECT(hll->Estimate() == expected->Estimate());
+        EXPECT(RegistersOf(hll, lower) == RegistersOf(expected, lower));
+        Fill(hll, n, 2 * n);
+        Fill(expected, n, 2 * n);
+        EXPECT(hll->Estimate() == expected->Estimate());
+
+        // Either side of a merge may have the higher precision.
+        HLL* high = HLL::Create(p, kOptions[o], NULL);
+        HLL* low = HLL::Create(lower, kOptions[o], NULL);
+        HLL* other = HLL::Create(p, HLL_LAYOUT_PACKED6, NULL);
+        Fill(high, 2 * n, 3 * n);
+        Fill(low, 2 * n, 3 * n);
+        Fill(other, 2 * n, 3 * n);
+        Fill(expected, 2 * n, 3 * n);
+        EXPECT(hll->Merge(high) == 0);
+        EXPECT(hll->precision() == lower);
+        EXPECT(RegistersOf(hll, lower) == RegistersOf(expected, lower));
+        EXPECT(high->Merge(low) == 0);
+        EXPECT(high->precision() == lower);
+        EXPECT(RegistersOf(high, lower) == RegistersOf(low, lower));
+        const HLL* sources[] = {other, hll};
+        EXPECT(low->MergeMany(sources, 2) == 0);
+        EXPECT(RegistersOf(low, lower) == RegistersOf(expected, lower));
+
+        delete hll;
+        delete expected;
+        delete high;
+        delete low;
+        delete other;
+      }
+    }
+  }
+
+  HLL* hll = HLL::Create(10);
+  EXPECT(hll->Fold(11) == EINVAL);
+  EXPECT(hll->Fold(HLL_MIN_PRECISION - 1) == EINVAL);
+  EXPECT(hll->Fold(HLL_MIN_PRECISION) == 0);
+  EXPECT(hll->precision() == HLL_MIN_PRECISION);
+  delete hll;
+  return true;
+}
+
+// Ertl's estimators stay within a few standard errors, 1.04 / sqrt(m), of
+// the actual cardinality across the range, including the transition from
+// LinearCounting where HyperLogLog++ relies on bias correction.
+bool TestErtlEstimators() {
+  const int kEstimators[] = {HLL_ESTIMATOR_IMPROVED, HLL_ESTIMATOR_MLE};
+  const uint64_t kCardinalities[] = {10, 300, 3000, 30000, 300000};
+  for (size_t e = 0; e < sizeof(kEstimators) / sizeof(int); ++e) {
+    for (int p = 8; p <= HLL_MAX_PRECISION; p += 2) {
+      const double tolerance = 4 * 1.04 / sqrt(static_cast<double>(1 << p));
+      for (size_t i = 0; i < sizeof(kCardinalities) / sizeof(uint64_t); ++i) {
+        const int options = kEstimators[e] | HLL_OPTION_DENSE;
+        HLL* hll = HLL::Create(p, options, NULL);
+        EXPECT(hll != NULL);
+        Fill(hll, 0, kCardinalities[i]);
+        EXPECT(RelativeError(hll->Estimate(), kCardinalities[i]) < tolerance);
+        delete hll;
+      }
+    }
+  }
+  EXPECT(HLL::Create(10, HLL_ESTIMATOR_IMPROVED | HLL_ESTIMATOR_MLE, NULL) ==
+         NULL);
+  return true;
+}
+
+// Beyond the bias tables, the default estimator is the improved one, and it
+// stays as accurate. The finest precision has no sparse list and starts out
+// dense, and a sparse object of the next finest precision merges with it.
+bool TestExtendedPrecision() {
+  const uint64_t kCardinality = 200000;
+  for (int p = HLL_MAX_EMPIRICAL_PRECISION + 1; p <= HLL_MAX_PRECISION; ++p) {
+    HLL* hll = HLL::Create(p, HLL_OPTION_DENSE, NULL);
+    HLL* improved =
+        HLL::Create(p, HLL_ESTIMATOR_IMPROVED | HLL_OPTION_DENSE, NULL);
+    EXPECT(hll != NULL);
+    Fill(hll, 0, kCardinality);
+    Fill(improved, 0, kCardinality);
+    const double tolerance = 5.0 * 1.04 / sqrt(static_cast<double>(1 << p));
+    EXPECT(RelativeError(hll->Estimate(), kCardinality) < tolerance);
+    EXPECT(hll->Estimate() == improved->Estimate());
+    delete hll;
+    delete improved;
+  }
+
+  const int kFinest = HLL_MAX_PRECISION;
+  HLL* dense = HLL::Create(kFinest, HLL_LAYOUT_PACKED6, NULL);
+  HLL* sparse = HLL::Create(kFinest - 1, HLL_LAYOUT_PACKED6, NULL);
+  HLL* expected = HLL::Create(kFinest - 1, HLL_OPTION_DENSE, NULL);
+  Fill(dense, 0, 1000);
+  Fill(sparse, 1000, 2000);
+  Fill(expected, 0, 2000);
+  EXPECT(RelativeError(dense->Estimate(), 1000) < 0.01);
+  EXPECT(sparse->Merge(dense) == 0);
+  EXPECT(RegistersOf(sparse, kFinest - 1) ==
+         RegistersOf(expected, kFinest - 1));
+  delete dense;
+  delete sparse;
+  delete expected;
+  return true;
+}
+
+// An object constructed in a caller's buffer behaves as one created dense,
+// and so does one allocated together with its registers after a fold.
+bool TestCreateIn() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_PACKED6 | HLL_ESTIMATOR_MLE};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int p = HLL_MIN_PRECISION; p <= 16; p += 6) {
+      const size_t size = HLL::InPlaceSize(p, kOptions[o]);
+      std::vector<uint64_t> buffer(size / sizeof(uint64_t) + 1);
+      HLL* hll = HLL::CreateIn(&buffer[0], size, p, kOptions[o], NULL);
+      HLL* expected = HLL::Create(p, kOptions[o] | HLL_OPTION_DENSE, NULL);
+      EXPECT(hll != NULL);
+      Fill(hll, 0, 50000);
+      Fill(expected, 0, 50000);
+      EXPECT(hll->Estimate() == expected->Estimate());
+      EXPECT(RegistersOf(hll, p) == RegistersOf(expected, p));
+      EXPECT(hll->Fold(HLL_MIN_PRECISION) == EINVAL);
+      EXPECT(expected->Fold(HLL_MIN_PRECISION) == 0);
+      Fill(expected, 50000, 60000);
+      EXPECT(expected->precision() == HLL_MIN_PRECISION);
+      delete expected;
+    }
+  }
+
+  int error = 0;
+  std::vector<uint64_t> buffer(HLL::InPlaceSize(12) / sizeof(uint64_t) + 1);
+  const size_t size = HLL::InPlaceSize(12);
+  EXPECT(HLL::CreateIn(&buffer[0], size - 1, 12, HLL_LAYOUT_BYTE, &error) ==
+         NULL);
+  EXPECT(error == ERANGE);
+  EXPECT(HLL::CreateIn(&buffer[0], size, 12, HLL_LAYOUT_PACKED4, &error) ==
+         NULL);
+  EXPECT(error == EINVAL);
+  EXPECT(HLL::CreateIn(&buffer[0], size, 3, HLL_LAYOUT_BYTE, &error) == NULL);
+
+  // The C interface.
+  EXPECT(HLL_in_place_size(12) == size);
+  error = 0;
+  EXPECT(HLL_create_in(&buffer[0], size - 1, 12, &error) == NULL);
+  EXPECT(error == ERANGE);
+  EXPECT(HLL_create_in(&buffer[0], size, 30, &error) == NULL);
+  EXPECT(error == EINVAL);
+  hll_t* ctx = HLL_create_in(&buffer[0], size, 12, NULL);
+  EXPECT(ctx != NULL);
+  HLL_update(ctx, Hash(1));
+  HLL_update(ctx, Hash(2));
+  EXPECT(HLL_estimate(ctx) == 2);
+  return true;
+}
+
+// A clone has the contents of the original and is independent of it, a
+// reset object fills as a new one does, and swapped objects exchange their
+// contents, whether or not they can exchange their memory.
+bool TestCloneResetSwap() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_PACKED6 | HLL_OPTION_DENSE};
+  const uint64_t kCardinalities[] = {100, 100000};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int p = 10; p <= 14; p += 4) {
+      for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+        const uint64_t n = kCardinalities[c];
+        HLL* hll = HLL::Create(p, kOptions[o], NULL);
+        Fill(hll, 0, n);
+        const uint64_t estimate = hll->Estimate();
+        HLL* clone = hll->Clone();
+        EXPECT(clone->precision() == p);
+        EXPECT(clone->Estimate() == estimate);
+        EXPECT(RegistersOf(clone, p) == RegistersOf(hll, p));
+        Fill(clone, n, 2 * n);
+        EXPECT(hll->Estimate() == estimate);
+
+        hll->Reset();
+        EXPECT(hll->Estimate() == 0);
+        HLL* fresh = HLL::Create(p, kOptions[o], NULL);
+        Fill(hll, 0, n);
+        Fill(fresh, 0, n);
+        EXPECT(hll->Estimate() == estimate);
+        EXPECT(RegistersOf(hll, p) == RegistersOf(fresh, p));
+
+        // Objects of the same shape, and of another precision.
+        for (int q = p; q >= p - 2; q -= 2) {
+          HLL* other = HLL::Create(q, kOptions[o], NULL);
+          Fill(other, n, 3 * n);
+          const std::vector<uint8_t> mine = RegistersOf(hll, p);
+          const std::vector<uint8_t> theirs = RegistersOf(other, q);
+          const uint64_t other_estimate = other->Estimate();
+          EXPECT(hll->Swap(other) == 0);
+          EXPECT(hll->precision() == q);
+          EXPECT(other->precision() == p);
+          EXPECT(RegistersOf(hll, q) == theirs);
+          EXPECT(RegistersOf(other, p) == mine);
+          EXPECT(hll->Estimate() == other_estimate);
+          EXPECT(hll->Swap(other) == 0);
+          EXPECT(hll->Estimate() == estimate);
+          delete other;
+        }
+
+        delete hll;
+        delete clone;
+        delete fresh;
+      }
+    }
+  }
+
+  // The registers of an object in a caller's buffer stay there, so it can
+  // only swap with an object of the same shape.
+  const size_t size = HLL::InPlaceSize(12);
+  std::vector<uint64_t> buffer(size / sizeof(uint64_t) + 1);
+  HLL* placed = HLL::CreateIn(&buffer[0], size, 12);
+  HLL* dense = HLL::Create(12, HLL_OPTION_DENSE, NULL);
+  HLL* sparse = HLL::Create(12);
+  Fill(placed, 0, 10);
+  Fill(dense, 10, 1000);
+  Fill(sparse, 1000, 1010);
+  const uint64_t estimate = dense->Estimate();
+  EXPECT(placed->Swap(dense) == 0);
+  EXPECT(placed->Estimate() == estimate);
+  EXPECT(dense->Estimate() == 10);
+  EXPECT(placed->Swap(sparse) == EINVAL);
+  EXPECT(sparse->Swap(placed) == EINVAL);
+  EXPECT(dense->Swap(sparse) == 0);
+  EXPECT(dense->Estimate() == 10);
+  EXPECT(sparse->Estimate() == 10);
+  delete dense;
+  delete sparse;
+  return true;
+}
+
+// The updates that hash their elements agree with Update() of the hashes,
+// one at a time or in batches, and the built-in hash keeps sketches of
+// sequential integers accurate.
+bool TestHashedUpdates() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4 | HLL_OPTION_INCREMENTAL};
+  const size_t kCount = 20000;
+  std::vector<uint64_t> values(kCount);
+  std::vector<std::vector<uint8_t> > keys(kCount);
+  std::vector<const void*> data(kCount);
+  std::vector<size_t> sizes(kCount);
+  for (size_t i = 0; i < kCount; ++i) {
+    values[i] = i * 7;
+    keys[i].resize(1 + i % 40, static_cast<uint8_t>(i));
+    keys[i][0] = static_cast<uint8_t>(i >> 8);
+    data[i] = &keys[i][0];
+    sizes[i] = keys[i].size();
+  }
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    HLL* one = HLL::Create(12, kOptions[o], NULL);
+    HLL* batch = HLL::Create(12, kOptions[o], NULL);
+    HLL* expected = HLL::Create(12, kOptions[o], NULL);
+    for (size_t i = 0; i < kCount; ++i) {
+      one->UpdateU64(values[i]);
+      one->UpdateBytes(data[i], sizes[i]);
+      expected->Update(libcount::HashU64(values[i]));
+      expected->Update(libcount::HashBytes(data[i], sizes[i]));
+    }
+    batch->UpdateU64Batch(&values[0], kCount);
+    batch->UpdateBytesBatch(&data[0], &sizes[0], kCount);
+    EXPECT(RegistersOf(one, 12) == RegistersOf(expected, 12));
+    EXPECT(RegistersOf(batch, 12) == RegistersOf(expected, 12));
+    EXPECT(batch->Estimate() == expected->Estimate());
+    delete one;
+    delete batch;
+    delete expected;
+  }
+
+  hll_t* ctx = HLL_create(12, NULL);
+  HLL* expected = HLL::Create(12);
+  HLL_update_u64(ctx, 1);
+  HLL_update_bytes(ctx, "one", 3);
+  HLL_update_u64_batch(ctx, &values[0], kCount);
+  HLL_update_bytes_batch(ctx, &data[0], &sizes[0], kCount);
+  expected->UpdateU64(1);
+  expected->UpdateBytes("one", 3);
+  expected->UpdateU64Batch(&values[0], kCount);
+  expected->UpdateBytesBatch(&data[0], &sizes[0], kCount);
+  EXPECT(HLL_estimate(ctx) == expected->Estimate());
+  HLL_free(ctx);
+  delete expected;
+
+  for (int p = 8; p <= HLL_MAX_EMPIRICAL_PRECISION; p += 2) {
+    const uint64_t kCardinalities[] = {100, 10000, 1000000};
+    const double tolerance = 4 * 1.04 / sqrt(static_cast<double>(1 << p));
+    for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+      HLL* hll = HLL::Create(p);
+      for (uint64_t i = 0; i < kCardinalities[c]; ++i) {
+        hll->UpdateU64(i);
+      }
+      EXPECT(RelativeError(hll->Estimate(), kCardinalities[c]) < tolerance);
+      delete hll;
+    }
+  }
+  return true;
+}
+
+#if __cplusplus >= 201103L
+// Objects can be kept by value, and moved between.
+bool TestMove() {
+  std::vector<HLL> sketches;
+  std::vector<uint64_t> estimates;
+  for (int i = 0; i < 20; ++i) {
+    const int options = (i % 2 == 0) ? HLL_OPTION_DENSE : HLL_LAYOUT_PACKED6;
+    HLL* hll = HLL::Create(8 + i % 5, options, NULL);
+    Fill(hll, 0, 100 * i);
+    estimates.push_back(hll->Estimate());
+    sketches.push_back(std::move(*hll));
+    delete hll;
+  }
+  for (int i = 0; i < 20; ++i) {
+    EXPECT(sketches[i].precision() == 8 + i % 5);
+    EXPECT(sketches[i].Estimate() == estimates[i]);
+  }
+  sketches[0] = std::move(sketches[19]);
+  EXPECT(sketches[0].Estimate() == estimates[19]);
+  Fill(&sketches[0], 0, 5000);
+  EXPECT(sketches[0].Estimate() > estimates[19]);
+  return true;
+}
+#endif
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestSparseAccuracy() && ok;
+  ok = TestConversionAccuracy() && ok;
+  ok = TestMergeRepresentations() && ok;
+  ok = TestRegisterLayouts() && ok;
+  ok = TestNibbleOffsets() && ok;
+  ok = TestSaturatedNibbles() && ok;
+  ok = TestUpdateBatch() && ok;
+  ok = TestIncremental() && ok;
+  ok = TestMergeMany() && ok;
+  ok = TestFold() && ok;
+  ok = TestErtlEstimators() && ok;
+  ok = TestExtendedPrecision() && ok;
+  ok = TestCreateIn() && ok;
+  ok = TestCloneResetSwap() && ok;
+  ok = TestHashedUpdates() && ok;
+#if __cplusplus >= 201103L
+  ok = TestMove() && ok;
+#endif
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
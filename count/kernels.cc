@@ -0,0 +1,303 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/kernels.h"
+
+#include <algorithm>
+
+// The vector kernels are compiled with per-function target attributes, so
+// the library as a whole need not be built for a particular CPU.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define COUNT_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using libcount::HistogramBytesKernel;
+using libcount::KernelIsa;
+using libcount::MaxBytesKernel;
+using libcount::kHistogramBuckets;
+
+void MaxBytesScalar(uint8_t* dest, const uint8_t* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dest[i] = std::max(dest[i], src[i]);
+  }
+}
+
+// Return the histogram bucket for a register value. Registers may come
+// from a damaged file that was never verified (see HLLArchive::Verify()),
+// so values past the last bucket are counted in it rather than written out
+// of bounds.
+inline int Bucket(uint8_t value) {
+  return std::min(static_cast<int>(value), kHistogramBuckets - 1);
+}
+
+void HistogramBytesScalar(const uint8_t* registers, size_t n,
+                          uint32_t* histogram) {
+  // Four interleaved sub-histograms, so that runs of equal values don't
+  // serialize on a single counter.
+  uint32_t counts[4][kHistogramBuckets] = {{0}};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    ++counts[0][Bucket(registers[i])];
+    ++counts[1][Bucket(registers[i + 1])];
+    ++counts[2][Bucket(registers[i + 2])];
+    ++counts[3][Bucket(registers[i + 3])];
+  }
+  for (; i < n; ++i) {
+    ++counts[0][Bucket(registers[i])];
+  }
+  for (int b = 0; b < kHistogramBuckets; ++b) {
+    histogram[b] += counts[0][b] + counts[1][b] + counts[2][b] + counts[3][b];
+  }
+}
+
+// The vector histogram kernels below rely on the fact that the registers of
+// a sketch cluster in a narrow range of values. The input is processed in
+// chunks small enough to stay in L1 cache and for per-byte counts to fit in
+// 8 bits. For each chunk, the range of values present is found first, and
+// then for each value in the range, matching bytes are counted with vector
+// compares. The last value's count is deduced from the others. The range is
+// capped at the last bucket, which so takes the count of any larger values,
+// as in the scalar kernel.
+const size_t kHistogramChunkVectors = 255;
+
+#ifdef COUNT_X86_KERNELS
+
+__attribute__((target("sse2"))) void MaxBytesSse2(uint8_t* dest,
+                                                  const uint8_t* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i*>(dest + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_max_epu8(a, b));
+  }
+  MaxBytesScalar(dest + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) void MaxBytesAvx2(uint8_t* dest,
+                                                  const uint8_t* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<__m256i*>(dest + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+                        _mm256_max_epu8(a, b));
+  }
+  MaxBytesScalar(dest + i, src + i, n - i);
+}
+
+__attribute__((target("avx512bw"))) void MaxBytesAvx512(uint8_t* dest,
+                                                        const uint8_t* src,
+                                                        size_t n) {
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    const __m512i a = _mm512_loadu_si512(dest + i);
+    const __m512i b = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dest + i, _mm512_max_epu8(a, b));
+  }
+  MaxBytesScalar(dest + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) void HistogramBytesAvx2(
+    const uint8_t* registers, size_t n, uint32_t* histogram) {
+  const size_t kWidth = 32;
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  while (i + kWidth <= n) {
+    const size_t vectors = std::min(kHistogramChunkVectors, (n - i) / kWidth);
+    const __m256i* const chunk =
+        reinterpret_cast<const __m256i*>(registers + i);
+
+    // Find the smallest and largest values in the chunk.
+    __m256i lo = _mm256_set1_epi8(-1);
+    __m256i hi = zero;
+    for (size_t v = 0; v < vectors; ++v) {
+      const __m256i x = _mm256_loadu_si256(chunk + v);
+      lo = _mm256_min_epu8(lo, x);
+      hi = _mm256_max_epu8(hi, x);
+    }
+    uint8_t lo_bytes[kWidth];
+    uint8_t hi_bytes[kWidth];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lo_bytes), lo);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hi_bytes), hi);
+    const int max = std::min<int>(
+        *std::max_element(hi_bytes, hi_bytes + kWidth), kHistogramBuckets - 1);
+    const int min =
+        std::min<int>(*std::min_element(lo_bytes, lo_bytes + kWidth), max);
+
+    // Count each value in turn; subtracting the all-ones compare result
+    // increments the per-byte counters of the matching lanes.
+    uint32_t remaining = static_cast<uint32_t>(vectors * kWidth);
+    for (int value = min; value < max; ++value) {
+      const __m256i target = _mm256_set1_epi8(static_cast<char>(value));
+      __m256i counts = zero;
+      for (size_t v = 0; v < vectors; ++v) {
+        const __m256i x = _mm256_loadu_si256(chunk + v);
+        counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(x, target));
+      }
+      const __m256i sums = _mm256_sad_epu8(counts, zero);
+      const uint32_t count = static_cast<uint32_t>(
+          _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1) +
+          _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3));
+      histogram[value] += count;
+      remaining -= count;
+    }
+    histogram[max] += remaining;
+    i += vectors * kWidth;
+  }
+  HistogramBytesScalar(registers + i, n - i, histogram);
+}
+
+__attribute__((target("avx512bw"))) void HistogramBytesAvx512(
+    const uint8_t* registers, size_t n, uint32_t* histogram) {
+  const size_t kWidth = 64;
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i ones = _mm512_set1_epi8(1);
+  size_t i = 0;
+  while (i + kWidth <= n) {
+    const size_t vectors = std::min(kHistogramChunkVectors, (n - i) / kWidth);
+    const uint8_t* const chunk = registers + i;
+
+    __m512i lo = _mm512_set1_epi8(-1);
+    __m512i hi = zero;
+    for (size_t v = 0; v < vectors; ++v) {
+      const __m512i x = _mm512_loadu_si512(chunk + v * kWidth);
+      lo = _mm512_min_epu8(lo, x);
+      hi = _mm512_max_epu8(hi, x);
+    }
+    uint8_t lo_bytes[kWidth];
+    uint8_t hi_bytes[kWidth];
+    _mm512_storeu_si512(lo_bytes, lo);
+    _mm512_storeu_si512(hi_bytes, hi);
+    const int max = std::min<int>(
+        *std::max_element(hi_bytes, hi_bytes + kWidth), kHistogramBuckets - 1);
+    const int min =
+        std::min<int>(*std::min_element(lo_bytes, lo_bytes + kWidth), max);
+
+    uint32_t remaining = static_cast<uint32_t>(vectors * kWidth);
+    for (int value = min; value < max; ++value) {
+      const __m512i target = _mm512_set1_epi8(static_cast<char>(value));
+      __m512i counts = zero;
+      for (size_t v = 0; v < vectors; ++v) {
+        const __m512i x = _mm512_loadu_si512(chunk + v * kWidth);
+        const __mmask64 match = _mm512_cmpeq_epi8_mask(x, target);
+        counts = _mm512_mask_add_epi8(counts, match, counts, ones);
+      }
+      // Sum the lanes by hand; _mm512_reduce_add_epi64() trips a spurious
+      // -Wmaybe-uninitialized in some versions of GCC.
+      uint64_t sums[8];
+      _mm512_storeu_si512(sums, _mm512_sad_epu8(counts, zero));
+      const uint32_t count =
+          static_cast<uint32_t>(sums[0] + sums[1] + sums[2] + sums[3] +
+                                sums[4] + sums[5] + sums[6] + sums[7]);
+      histogram[value] += count;
+      remaining -= count;
+    }
+    histogram[max] += remaining;
+    i += vectors * kWidth;
+  }
+  HistogramBytesScalar(registers + i, n - i, histogram);
+}
+
+#endif  // COUNT_X86_KERNELS
+
+// Return true if the CPU supports the instruction set.
+bool Supported(KernelIsa isa) {
+  switch (isa) {
+    case libcount::KERNEL_SCALAR:
+      return true;
+#ifdef COUNT_X86_KERNELS
+    case libcount::KERNEL_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case libcount::KERNEL_AVX2:
+      return __builtin_cpu_supports("avx2");
+    case libcount::KERNEL_AVX512BW:
+      return __builtin_cpu_supports("avx512bw");
+#endif
+    default:
+      return false;
+  }
+}
+
+// Return the most capable instruction set supported by the CPU.
+KernelIsa BestIsa() {
+  const KernelIsa kPreferred[] = {libcount::KERNEL_AVX512BW,
+                                  libcount::KERNEL_AVX2, libcount::KERNEL_SSE2};
+  for (size_t i = 0; i < sizeof(kPreferred) / sizeof(kPreferred[0]); ++i) {
+    if (Supported(kPreferred[i])) {
+      return kPreferred[i];
+    }
+  }
+  return libcount::KERNEL_SCALAR;
+}
+
+}  // namespace
+
+namespace libcount {
+
+MaxBytesKernel GetMaxBytesKernel(KernelIsa isa) {
+  if (!Supported(isa)) {
+    return NULL;
+  }
+  switch (isa) {
+#ifdef COUNT_X86_KERNELS
+    case KERNEL_SSE2:
+      return MaxBytesSse2;
+    case KERNEL_AVX2:
+      return MaxBytesAvx2;
+    case KERNEL_AVX512BW:
+      return MaxBytesAvx512;
+#endif
+    default:
+      return MaxBytesScalar;
+  }
+}
+
+void MaxBytes(uint8_t* dest, const uint8_t* src, size_t n) {
+  static const MaxBytesKernel kernel = GetMaxBytesKernel(BestIsa());
+  kernel(dest, src, n);
+}
+
+HistogramBytesKernel GetHistogramBytesKernel(KernelIsa isa) {
+  if (!Supported(isa)) {
+    return NULL;
+  }
+  switch (isa) {
+#ifdef COUNT_X86_KERNELS
+    case KERNEL_AVX2:
+      return HistogramBytesAvx2;
+    case KERNEL_AVX512BW:
+      return HistogramBytesAvx512;
+#endif
+    default:
+      // Without byte-wise compare results in a mask or a cheap horizontal
+      // sum, SSE2 offers little over the scalar kernel.
+      return HistogramBytesScalar;
+  }
+}
+
+void HistogramBytes(const uint8_t* registers, size_t n, uint32_t* histogram) {
+  static const HistogramBytesKernel kernel = GetHistogramBytesKernel(BestIsa());
+  kernel(registers, n, histogram);
+}
+
+}  // namespace libcount
@@ -0,0 +1,68 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_KERNELS_H_
+#define COUNT_KERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace libcount {
+
+// Bulk operations over arrays of byte registers. Each operation has a
+// portable scalar implementation and, on x86, implementations that use
+// vector instructions. The best implementation supported by the CPU is
+// selected the first time an operation is called.
+
+// Instruction sets for which kernels may be provided.
+enum KernelIsa {
+  KERNEL_SCALAR,
+  KERNEL_SSE2,
+  KERNEL_AVX2,
+  KERNEL_AVX512BW
+};
+
+// Store the byte-wise maximum of 'dest' and 'src' in 'dest'.
+typedef void (*MaxBytesKernel)(uint8_t* dest, const uint8_t* src, size_t n);
+
+// Return the implementation of MaxBytes() for the given instruction set, or
+// NULL if it isn't available on this CPU. Exposed for testing.
+MaxBytesKernel GetMaxBytesKernel(KernelIsa isa);
+
+// Store the byte-wise maximum of 'dest' and 'src' in 'dest', using the best
+// kernel available.
+void MaxBytes(uint8_t* dest, const uint8_t* src, size_t n);
+
+// The number of buckets in a histogram of register values. No register can
+// hold a value above 64 - HLL_MIN_PRECISION + 1, so 64 buckets suffice.
+const int kHistogramBuckets = 64;
+
+// Add the number of occurrences of each value in 'registers' to the
+// corresponding bucket of 'histogram'. Values of kHistogramBuckets or more,
+// which only damaged input can hold, are counted in the last bucket.
+typedef void (*HistogramBytesKernel)(const uint8_t* registers, size_t n,
+                                     uint32_t* histogram);
+
+// Return the implementation of HistogramBytes() for the given instruction
+// set, or NULL if it isn't available on this CPU. Exposed for testing.
+HistogramBytesKernel GetHistogramBytesKernel(KernelIsa isa);
+
+// Add the number of occurrences of each value in 'registers' to the
+// corresponding bucket of 'histogram', using the best kernel available.
+void HistogramBytes(const uint8_t* registers, size_t n, uint32_t* histogram);
+
+}  // namespace libcount
+
+#endif  // COUNT_KERNELS_H_
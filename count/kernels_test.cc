@@ -0,0 +1,144 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using libcount::GetHistogramBytesKernel;
+using libcount::GetMaxBytesKernel;
+using libcount::HistogramBytesKernel;
+using libcount::KERNEL_AVX2;
+using libcount::KERNEL_AVX512BW;
+using libcount::KERNEL_SCALAR;
+using libcount::KERNEL_SSE2;
+using libcount::KernelIsa;
+using libcount::MaxBytesKernel;
+using libcount::kHistogramBuckets;
+
+// Every vector kernel supported by the CPU must produce exactly the same
+// output as the scalar kernel, for any length and alignment.
+
+const KernelIsa kIsas[] = {KERNEL_SSE2, KERNEL_AVX2, KERNEL_AVX512BW};
+
+bool TestMaxBytes() {
+  const size_t kMaxSize = 1000;
+  const size_t kPadding = 64;
+
+  uint8_t* src = new uint8_t[kMaxSize + kPadding];
+  uint8_t* dest = new uint8_t[kMaxSize + kPadding];
+  uint8_t* expected = new uint8_t[kMaxSize + kPadding];
+  for (size_t i = 0; i < kMaxSize + kPadding; ++i) {
+    // Use the full byte range so that unsigned comparison is exercised.
+    src[i] = static_cast<uint8_t>(rand());
+  }
+
+  MaxBytesKernel scalar = GetMaxBytesKernel(KERNEL_SCALAR);
+  for (size_t k = 0; k < sizeof(kIsas) / sizeof(kIsas[0]); ++k) {
+    MaxBytesKernel kernel = GetMaxBytesKernel(kIsas[k]);
+    if (kernel == NULL) {
+      continue;
+    }
+    for (size_t size = 0; size <= kMaxSize; size += 7) {
+      for (size_t offset = 0; offset < 4; ++offset) {
+        for (size_t i = 0; i < kMaxSize + kPadding; ++i) {
+          dest[i] = expected[i] = static_cast<uint8_t>(rand());
+        }
+        scalar(expected + offset, src, size);
+        kernel(dest + offset, src, size);
+        if (memcmp(dest, expected, kMaxSize + kPadding) != 0) {
+          fprintf(stderr, "MaxBytes: isa %d differs at size %zu\n",
+                  static_cast<int>(kIsas[k]), size);
+          return false;
+        }
+      }
+    }
+  }
+
+  delete[] src;
+  delete[] dest;
+  delete[] expected;
+  return true;
+}
+
+bool TestHistogramBytes() {
+  // Sizes span several chunks of the vector kernels, plus ragged tails.
+  const size_t kSizes[] = {0, 1, 63, 64, 65, 1000, 16384, 16384 + 17, 262144};
+  const size_t kMaxSize = 262144 + 64;
+  uint8_t* registers = new uint8_t[kMaxSize];
+  uint32_t expected[kHistogramBuckets];
+  uint32_t actual[kHistogramBuckets];
+
+  HistogramBytesKernel scalar = GetHistogramBytesKernel(KERNEL_SCALAR);
+  for (int range = 1; range <= kHistogramBuckets; range *= 4) {
+    for (size_t i = 0; i < kMaxSize; ++i) {
+      // Cluster values around a base, as the registers of a sketch would.
+      registers[i] = static_cast<uint8_t>((rand() % range) + (64 - range) / 2);
+    }
+    for (size_t k = 0; k < sizeof(kIsas) / sizeof(kIsas[0]); ++k) {
+      HistogramBytesKernel kernel = GetHistogramBytesKernel(kIsas[k]);
+      if (kernel == NULL) {
+        continue;
+      }
+      for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+        for (size_t offset = 0; offset < 3; ++offset) {
+          // Kernels add to the histogram rather than overwrite it.
+          for (int b = 0; b < kHistogramBuckets; ++b) {
+            expected[b] = actual[b] = b;
+          }
+          scalar(registers + offset, kSizes[s], expected);
+          kernel(registers + offset, kSizes[s], actual);
+          if (memcmp(expected, actual, sizeof(expected)) != 0) {
+            fprintf(stderr, "HistogramBytes: isa %d differs at size %zu\n",
+                    static_cast<int>(kIsas[k]), kSizes[s]);
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  // Values past the last bucket, as in a damaged file, are counted in it.
+  for (size_t i = 0; i < kMaxSize; ++i) {
+    registers[i] = static_cast<uint8_t>((i % 7 == 0) ? 255 - i % 3 : 20);
+  }
+  for (size_t k = 0; k < sizeof(kIsas) / sizeof(kIsas[0]); ++k) {
+    HistogramBytesKernel kernel = GetHistogramBytesKernel(kIsas[k]);
+    if (kernel == NULL) {
+      continue;
+    }
+    memset(actual, 0, sizeof(actual));
+    kernel(registers, kMaxSize, actual);
+    const uint32_t high = static_cast<uint32_t>((kMaxSize + 6) / 7);
+    if ((actual[kHistogramBuckets - 1] != high) ||
+        (actual[20] != kMaxSize - high)) {
+      fprintf(stderr, "HistogramBytes: isa %d overflows\n",
+              static_cast<int>(kIsas[k]));
+      return false;
+    }
+  }
+  delete[] registers;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  srand(42);
+  bool ok = true;
+  ok = TestMaxBytes() && ok;
+  ok = TestHistogramBytes() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,312 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/nibble_registers.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "count/utility.h"
+
+namespace {
+
+// A nibble holding this value marks a register kept in the exception table.
+const uint8_t kException = 15;
+
+const int kNibblesPerWord = 16;
+const uint64_t kNibbleOnes = 0x1111111111111111ULL;
+const uint64_t kHighBits = kNibbleOnes * 0x8;
+const uint64_t kLowBits = kNibbleOnes * 0x7;
+
+// Return a word with bit 0 of each nibble set iff the nibble is 15.
+inline uint64_t NibblesAtException(uint64_t x) {
+  return x & (x >> 1) & (x >> 2) & (x >> 3) & kNibbleOnes;
+}
+
+// Return a word with bit 3 of each nibble set iff the nibble is non-zero.
+inline uint64_t NibblesNonZero(uint64_t x) {
+  return (((x & kLowBits) + kLowBits) | x) & kHighBits;
+}
+
+// Return the nibble-wise maximum of two words; see Packed6Merge() for an
+// explanation of the technique.
+inline uint64_t NibbleMax(uint64_t x, uint64_t y) {
+  const uint64_t low_ge = (x | kHighBits) - (y & kLowBits);
+  const uint64_t ge = ((x & ~y) | (~(x ^ y) & low_ge)) & kHighBits;
+  const uint64_t mask = (ge >> 3) * 0xF;
+  return (x & mask) | (y & ~mask);
+}
+
+// Exception table slots hold ((index + 1) << 8) | value; zero means empty.
+inline int IndexOfSlot(uint64_t slot) {
+  return static_cast<int>(slot >> 8) - 1;
+}
+inline uint8_t ValueOfSlot(uint64_t slot) { return slot & 0xFF; }
+inline uint64_t MakeSlot(int index, uint8_t value) {
+  return (static_cast<uint64_t>(index + 1) << 8) | value;
+}
+
+// Return the preferred slot for a register index in a table of 'size'.
+inline size_t HomeOf(int index, size_t size) {
+  return ((static_cast<uint64_t>(index) * 0x9E3779B97F4A7C15ULL) >> 32) &
+         (size - 1);
+}
+
+}  // namespace
+
+namespace libcount {
+
+NibbleRegisters::NibbleRegisters(int register_count)
+    : register_count_(register_count),
+      word_count_(register_count / kNibblesPerWord),
+      words_(NULL),
+      offset_(0),
+      at_offset_(register_count),
+      exception_count_(0) {
+  assert(register_count % kNibblesPerWord == 0);
+  words_ = new uint64_t[word_count_];
+  memset(words_, 0, word_count_ * sizeof(words_[0]));
+}
+
+NibbleRegisters::~NibbleRegisters() { delete[] words_; }
+
+uint8_t NibbleRegisters::Get(int index) const {
+  const int shift = (index % kNibblesPerWord) * 4;
+  const uint8_t nibble = (words_[index / kNibblesPerWord] >> shift) & 0xF;
+  if (nibble == kException) {
+    return FindException(index);
+  }
+  return offset_ + nibble;
+}
+
+void NibbleRegisters::SetMax(int index, uint8_t value) {
+  const uint8_t current = Get(index);
+  if (value <= current) {
+    return;
+  }
+  if (value - offset_ >= kException) {
+    SetNibble(index, kException);
+    StoreException(index, value);
+  } else {
+    SetNibble(index, value - offset_);
+  }
+  if ((current == offset_) && (--at_offset_ == 0)) {
+    Rebase();
+  }
+}
+
+void NibbleRegisters::Merge(const NibbleRegisters& other) {
+  assert(register_count_ == other.register_count_);
+
+  // Registers with different offsets have different meanings, so in that
+  // case there is no alternative to merging them one at a time.
+  if (offset_ != other.offset_) {
+    for (int i = 0; i < register_count_; ++i) {
+      SetMax(i, other.Get(i));
+    }
+    return;
+  }
+
+  // Otherwise the nibbles can be merged a word at a time. Wherever either
+  // side holds an exception, the result is an exception; since the other
+  // side's value must then be smaller, the table entry settles the result.
+  for (int i = 0; i < word_count_; ++i) {
+    words_[i] = NibbleMax(words_[i], other.words_[i]);
+  }
+  for (size_t i = 0; i < other.exceptions_.size(); ++i) {
+    const uint64_t slot = other.exceptions_[i];
+    if (slot != 0) {
+      const int index = IndexOfSlot(slot);
+      const uint8_t value = ValueOfSlot(slot);
+      if (value > FindException(index)) {
+        StoreException(index, value);
+      }
+    }
+  }
+  CountAtOffset();
+  if (at_offset_ == 0) {
+    Rebase();
+  }
+}
+
+void NibbleRegisters::Histogram(uint32_t* histogram) const {
+  // Count the nibble values, then shift them up by the offset. Exceptions
+  // are counted separately, at their actual values.
+  uint32_t nibbles[16] = {0};
+  for (int i = 0; i < word_count_; ++i) {
+    uint64_t word = words_[i];
+    for (int lane = 0; lane < kNibblesPerWord; ++lane) {
+      ++nibbles[word & 0xF];
+      word >>= 4;
+    }
+  }
+  // Skip empty counts: at low precision, offset_ plus a large nibble can
+  // lie past the last bucket, though no register holds such a value.
+  for (uint8_t nibble = 0; nibble < kException; ++nibble) {
+    if (nibbles[nibble] != 0) {
+      histogram[offset_ + nibble] += nibbles[nibble];
+    }
+  }
+  for (size_t i = 0; i < exceptions_.size(); ++i) {
+    if (exceptions_[i] != 0) {
+      ++histogram[ValueOfSlot(exceptions_[i])];
+    }
+  }
+}
+
+void NibbleRegisters::CopyFrom(const NibbleRegisters& other) {
+  assert(register_count_ == other.register_count_);
+  memcpy(words_, other.words_, word_count_ * sizeof(words_[0]));
+  offset_ = other.offset_;
+  at_offset_ = other.at_offset_;
+  exceptions_ = other.exceptions_;
+  exception_count_ = other.exception_count_;
+}
+
+void NibbleRegisters::Clear() {
+  memset(words_, 0, word_count_ * sizeof(words_[0]));
+  offset_ = 0;
+  at_offset_ = register_count_;
+  std::fill(exceptions_.begin(), exceptions_.end(), 0);
+  exception_count_ = 0;
+}
+
+size_t NibbleRegisters::SizeInBytes() const {
+  return (word_count_ * sizeof(words_[0])) +
+         (exceptions_.capacity() * sizeof(exceptions_[0]));
+}
+
+void NibbleRegisters::Rebase() {
+  while (at_offset_ == 0) {
+    ++offset_;
+
+    // No nibble is zero, so every one short of an exception can be lowered
+    // by one without borrowing from its neighbor.
+    for (int i = 0; i < word_count_; ++i) {
+      const uint64_t x = words_[i];
+      words_[i] = x - (kNibbleOnes & ~NibblesAtException(x));
+    }
+
+    // Exceptions that fit in the window again move back into their nibbles.
+    std::vector<int> fits;
+    for (size_t i = 0; i < exceptions_.size(); ++i) {
+      const uint64_t slot = exceptions_[i];
+      if ((slot != 0) && (ValueOfSlot(slot) - offset_ < kException)) {
+        fits.push_back(IndexOfSlot(slot));
+      }
+    }
+    for (size_t i = 0; i < fits.size(); ++i) {
+      const uint8_t value = FindException(fits[i]);
+      RemoveException(fits[i]);
+      SetNibble(fits[i], value - offset_);
+    }
+
+    CountAtOffset();
+  }
+}
+
+void NibbleRegisters::CountAtOffset() {
+  int nonzero = 0;
+  for (int i = 0; i < word_count_; ++i) {
+    nonzero += PopCount(NibblesNonZero(words_[i]));
+  }
+  at_offset_ = register_count_ - nonzero;
+}
+
+void NibbleRegisters::SetNibble(int index, uint8_t nibble) {
+  assert(nibble <= kException);
+  uint64_t* const word = &words_[index / kNibblesPerWord];
+  const int shift = (index % kNibblesPerWord) * 4;
+  *word = (*word & ~(0xFULL << shift)) |
+          (static_cast<uint64_t>(nibble) << shift);
+}
+
+uint8_t NibbleRegisters::FindException(int index) const {
+  if (exceptions_.empty()) {
+    return 0;
+  }
+  const size_t mask = exceptions_.size() - 1;
+  for (size_t i = HomeOf(index, exceptions_.size());; i = (i + 1) & mask) {
+    const uint64_t slot = exceptions_[i];
+    if (slot == 0) {
+      return 0;
+    }
+    if (IndexOfSlot(slot) == index) {
+      return ValueOfSlot(slot);
+    }
+  }
+}
+
+void NibbleRegisters::StoreException(int index, uint8_t value) {
+  // Keep the load factor at or below 3/4.
+  if (4 * (exception_count_ + 1) > 3 * static_cast<int>(exceptions_.size())) {
+    GrowExceptions();
+  }
+  const size_t mask = exceptions_.size() - 1;
+  for (size_t i = HomeOf(index, exceptions_.size());; i = (i + 1) & mask) {
+    const uint64_t slot = exceptions_[i];
+    if (slot == 0) {
+      exceptions_[i] = MakeSlot(index, value);
+      ++exception_count_;
+      return;
+    }
+    if (IndexOfSlot(slot) == index) {
+      exceptions_[i] = MakeSlot(index, value);
+      return;
+    }
+  }
+}
+
+void NibbleRegisters::RemoveException(int index) {
+  const size_t size = exceptions_.size();
+  const size_t mask = size - 1;
+  size_t hole = HomeOf(index, size);
+  while (IndexOfSlot(exceptions_[hole]) != index) {
+    assert(exceptions_[hole] != 0);
+    hole = (hole + 1) & mask;
+  }
+  exceptions_[hole] = 0;
+  --exception_count_;
+
+  // Shift subsequent entries of the probe sequence back into the hole, so
+  // that lookups don't stop short at it.
+  for (size_t i = (hole + 1) & mask; exceptions_[i] != 0; i = (i + 1) & mask) {
+    const size_t home = HomeOf(IndexOfSlot(exceptions_[i]), size);
+    const size_t distance_to_hole = (hole - home) & mask;
+    const size_t distance_to_slot = (i - home) & mask;
+    if (distance_to_hole < distance_to_slot) {
+      exceptions_[hole] = exceptions_[i];
+      exceptions_[i] = 0;
+      hole = i;
+    }
+  }
+}
+
+void NibbleRegisters::GrowExceptions() {
+  const size_t kInitialSize = 8;
+  std::vector<uint64_t> old;
+  old.swap(exceptions_);
+  exceptions_.assign(old.empty() ? kInitialSize : (old.size() * 2), 0);
+  exception_count_ = 0;
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (old[i] != 0) {
+      StoreException(IndexOfSlot(old[i]), ValueOfSlot(old[i]));
+    }
+  }
+}
+
+}  // namespace libcount
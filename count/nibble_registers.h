@@ -0,0 +1,102 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_NIBBLE_REGISTERS_H_
+#define COUNT_NIBBLE_REGISTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace libcount {
+
+// Dense registers stored in 4 bits apiece, relative to a shared offset. As
+// a sketch fills up, the register values bunch together, and it is rare for
+// any register to be more than 14 above the smallest of them. The offset
+// tracks that minimum; each register stores its value less the offset, and
+// the few registers that don't fit store the value 15 in their nibble and
+// keep their actual value in a small hash table of exceptions.
+//
+// The offset is raised (and every nibble lowered to match) once no register
+// holds the offset value any longer, which keeps the window of representable
+// values sliding upward with the registers.
+class NibbleRegisters {
+ public:
+  // The 'register_count' must be a multiple of 16.
+  explicit NibbleRegisters(int register_count);
+  ~NibbleRegisters();
+
+  // Return the value of a register.
+  uint8_t Get(int index) const;
+
+  // Store 'value' in a register if it is greater than the current contents.
+  void SetMax(int index, uint8_t value);
+
+  // Store the maximum of each register and that of 'other' in this object.
+  // The two objects must have the same number of registers, but may have
+  // different offsets.
+  void Merge(const NibbleRegisters& other);
+
+  // Replace the registers with those of 'other', which must have the same
+  // number of registers.
+  void CopyFrom(const NibbleRegisters& other);
+
+  // Set every register to zero, keeping the storage allocated for them.
+  void Clear();
+
+  // Add the number of occurrences of each register value to the
+  // corresponding bucket of 'histogram', which must have kHistogramBuckets
+  // entries.
+  void Histogram(uint32_t* histogram) const;
+
+  // Return the number of bytes of storage in use.
+  size_t SizeInBytes() const;
+
+ private:
+  // No copying allowed
+  NibbleRegisters(const NibbleRegisters& no_copy);
+  NibbleRegisters& operator=(const NibbleRegisters& no_assign);
+
+  // Raise the offset until some register holds the offset value again.
+  void Rebase();
+
+  // Recount the number of registers that hold the offset value.
+  void CountAtOffset();
+
+  // Write the nibble for a register, relative to the offset.
+  void SetNibble(int index, uint8_t nibble);
+
+  // Exception table operations. Keys are register indices.
+  uint8_t FindException(int index) const;
+  void StoreException(int index, uint8_t value);
+  void RemoveException(int index);
+  void GrowExceptions();
+
+  int register_count_;
+  int word_count_;
+  uint64_t* words_;
+  uint8_t offset_;
+  int at_offset_;
+
+  // Open-addressed hash table; each slot holds ((index + 1) << 8) | value,
+  // or zero if the slot is empty.
+  std::vector<uint64_t> exceptions_;
+  int exception_count_;
+};
+
+}  // namespace libcount
+
+#endif  // COUNT_NIBBLE_REGISTERS_H_
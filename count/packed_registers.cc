@@ -0,0 +1,73 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/packed_registers.h"
+
+namespace {
+
+using libcount::kPacked6PerWord;
+
+// Replicate a 6-bit lane value across all ten lanes of a word.
+const uint64_t kLaneOnes = 0x0041041041041041ULL;
+const uint64_t kHighBits = kLaneOnes * 0x20;
+const uint64_t kLowBits = kLaneOnes * 0x1F;
+
+// Return a word whose bit 5 of each lane is set iff that lane of 'x' is
+// greater than or equal to the corresponding lane of 'y'.
+inline uint64_t LanesGreaterOrEqual(uint64_t x, uint64_t y) {
+  // Adding 32 to each lane of 'x' before subtracting the low five bits of
+  // 'y' cannot borrow across lanes; bit 5 of the result is then set iff the
+  // low five bits of 'x' are >= those of 'y'. Combine that with a comparison
+  // of the high bits to get the full unsigned comparison.
+  const uint64_t low_ge = (x | kHighBits) - (y & kLowBits);
+  return ((x & ~y) | (~(x ^ y) & low_ge)) & kHighBits;
+}
+
+}  // namespace
+
+namespace libcount {
+
+void Packed6Merge(uint64_t* dest, const uint64_t* src, int word_count) {
+  for (int i = 0; i < word_count; ++i) {
+    const uint64_t x = dest[i];
+    const uint64_t y = src[i];
+    // Widen each lane's flag bit to a full six bit mask: (2 ^ 6) - 1.
+    const uint64_t ge = LanesGreaterOrEqual(x, y);
+    const uint64_t mask = (ge << 1) - (ge >> 5);
+    dest[i] = (x & mask) | (y & ~mask);
+  }
+}
+
+void Packed6Histogram(const uint64_t* words, int register_count,
+                      uint32_t* histogram) {
+  // Count whole words with all ten lanes in use, then the partial word.
+  const int full_words = register_count / kPacked6PerWord;
+  for (int i = 0; i < full_words; ++i) {
+    uint64_t word = words[i];
+    for (int lane = 0; lane < kPacked6PerWord; ++lane) {
+      ++histogram[word & kPacked6LaneMask];
+      word >>= kPacked6Bits;
+    }
+  }
+  if (full_words * kPacked6PerWord < register_count) {
+    uint64_t word = words[full_words];
+    for (int i = full_words * kPacked6PerWord; i < register_count; ++i) {
+      ++histogram[word & kPacked6LaneMask];
+      word >>= kPacked6Bits;
+    }
+  }
+}
+
+}  // namespace libcount
@@ -0,0 +1,66 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_PACKED_REGISTERS_H_
+#define COUNT_PACKED_REGISTERS_H_
+
+#include <stdint.h>
+
+namespace libcount {
+
+// No register can ever hold a value above 64 - HLL_MIN_PRECISION + 1 = 61,
+// so six bits per register suffice. Registers are packed ten to a 64-bit
+// word, in the low 60 bits, so that none straddles a word boundary. Unused
+// lanes in the final word, and the top four bits of each word, stay zero.
+const int kPacked6Bits = 6;
+const int kPacked6PerWord = 10;
+const uint64_t kPacked6LaneMask = 0x3F;
+
+// Return the number of words needed to store 'register_count' registers.
+inline int Packed6WordCount(int register_count) {
+  return (register_count + kPacked6PerWord - 1) / kPacked6PerWord;
+}
+
+// Return the value of a register.
+inline uint8_t Packed6Get(const uint64_t* words, int index) {
+  const int shift = (index % kPacked6PerWord) * kPacked6Bits;
+  return static_cast<uint8_t>((words[index / kPacked6PerWord] >> shift) &
+                              kPacked6LaneMask);
+}
+
+// Store 'value' in a register if it is greater than the current contents.
+inline void Packed6SetMax(uint64_t* words, int index, uint8_t value) {
+  uint64_t* const word = &words[index / kPacked6PerWord];
+  const int shift = (index % kPacked6PerWord) * kPacked6Bits;
+  const uint64_t current = (*word >> shift) & kPacked6LaneMask;
+  if (value > current) {
+    *word = (*word & ~(kPacked6LaneMask << shift)) |
+            (static_cast<uint64_t>(value) << shift);
+  }
+}
+
+// Store the lane-wise maximum of 'dest' and 'src' in 'dest'. Operates on
+// whole words at a time (SWAR) without unpacking the registers.
+void Packed6Merge(uint64_t* dest, const uint64_t* src, int word_count);
+
+// Add the number of occurrences of each value among the first
+// 'register_count' registers to the corresponding bucket of 'histogram',
+// which must have kHistogramBuckets entries.
+void Packed6Histogram(const uint64_t* words, int register_count,
+                      uint32_t* histogram);
+
+}  // namespace libcount
+
+#endif  // COUNT_PACKED_REGISTERS_H_
@@ -0,0 +1,216 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/register_file.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "count/serialization.h"
+#include "count/utility.h"
+
+namespace {
+
+using libcount::LoadLittleEndian64;
+using libcount::StoreLittleEndian64;
+
+const uint8_t kMagic[4] = {'L', 'C', 'N', 'F'};
+const int kVersion = 1;
+
+// Each header slot sits in a sector of its own.
+const size_t kSlotSize = 32;
+const size_t kSlotOffsets[2] = {512, 0};
+
+// Offsets of the fields of a header slot.
+const size_t kGenerationField = 8;
+const size_t kSizeField = 16;
+const size_t kChecksumField = 24;
+
+// Return the offset of the header slot that records 'generation'.
+size_t SlotOffset(uint64_t generation) { return kSlotOffsets[generation & 1]; }
+
+// The 64-bit FNV-1a hash; enough to tell a torn or stale slot from a good
+// one.
+uint64_t Checksum(const uint8_t* data, size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+// Return the generation recorded in a header slot, or 0 if the slot isn't
+// a valid one for registers of the given precision, layout and size.
+uint64_t SlotGeneration(const uint8_t* slot, int precision, int layout,
+                        size_t size) {
+  if ((memcmp(slot, kMagic, sizeof(kMagic)) != 0) || (slot[4] != kVersion) ||
+      (slot[7] != 0) ||
+      (LoadLittleEndian64(slot + kChecksumField) !=
+       Checksum(slot, kChecksumField))) {
+    return 0;
+  }
+  if ((slot[5] != precision) || (slot[6] != layout) ||
+      (LoadLittleEndian64(slot + kSizeField) != size)) {
+    return 0;
+  }
+  return LoadLittleEndian64(slot + kGenerationField);
+}
+
+// Return true if the 'size' bytes at 'data' are all zero.
+bool IsBlank(const uint8_t* data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    if (data[i] != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+namespace libcount {
+
+RegisterFile::RegisterFile(int fd, uint8_t* mapping, size_t mapping_size,
+                           int precision, int layout, size_t size,
+                           uint64_t generation)
+    : fd_(fd),
+      mapping_(mapping),
+      mapping_size_(mapping_size),
+      precision_(precision),
+      layout_(layout),
+      size_(size),
+      generation_(generation) {}
+
+RegisterFile::~RegisterFile() {
+  munmap(mapping_, mapping_size_);
+  close(fd_);
+}
+
+RegisterFile* RegisterFile::Open(const char* path, int precision, int layout,
+                                 size_t size, int* error) {
+  assert(path != NULL);
+  const int fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    MaybeAssign(error, errno);
+    return NULL;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    MaybeAssign(error, (errno == EWOULDBLOCK) ? EBUSY : errno);
+    close(fd);
+    return NULL;
+  }
+
+  // A new (or empty) file is sized to hold the registers, which read as
+  // zero until written.
+  const size_t mapping_size = kRegistersOffset + size;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    MaybeAssign(error, errno);
+    close(fd);
+    return NULL;
+  }
+  const bool created = (st.st_size == 0);
+  if (created && (ftruncate(fd, mapping_size) != 0)) {
+    MaybeAssign(error, errno);
+    close(fd);
+    return NULL;
+  }
+  if (!created && (static_cast<size_t>(st.st_size) != mapping_size)) {
+    MaybeAssign(error, EINVAL);
+    close(fd);
+    return NULL;
+  }
+
+  void* const mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    MaybeAssign(error, errno);
+    close(fd);
+    return NULL;
+  }
+  uint8_t* const data = static_cast<uint8_t*>(mapping);
+  RegisterFile* file = new RegisterFile(fd, data, mapping_size, precision,
+                                        layout, size, 0);
+
+  // A file whose header was never written was left by a process that
+  // stopped between sizing it and the first checkpoint, before any update
+  // could reach it, and is taken up as a new one. The first checkpoint
+  // syncs its header before the object is handed out.
+  if (created || IsBlank(data, kRegistersOffset)) {
+    const int status = file->Checkpoint();
+    if (status != 0) {
+      MaybeAssign(error, status);
+      delete file;
+      return NULL;
+    }
+    return file;
+  }
+
+  // Resume from the latest valid generation.
+  for (int i = 0; i < 2; ++i) {
+    const uint64_t generation =
+        SlotGeneration(data + kSlotOffsets[i], precision, layout, size);
+    if (generation > file->generation_) {
+      file->generation_ = generation;
+    }
+  }
+  if (file->generation_ == 0) {
+    MaybeAssign(error, EINVAL);
+    delete file;
+    return NULL;
+  }
+  return file;
+}
+
+int RegisterFile::Checkpoint() {
+  // The registers must be on disk before the header that vouches for them.
+  // Clean pages cost nothing here: the kernel writes only dirty ones.
+  if (msync(registers(), size_, MS_SYNC) != 0) {
+    return errno;
+  }
+  const int status = WriteHeader(generation_ + 1);
+  if (status == 0) {
+    ++generation_;
+  }
+  return status;
+}
+
+int RegisterFile::WriteHeader(uint64_t generation) {
+  uint8_t* const slot = mapping_ + SlotOffset(generation);
+  uint8_t bytes[kSlotSize] = {0};
+  memcpy(bytes, kMagic, sizeof(kMagic));
+  bytes[4] = kVersion;
+  bytes[5] = static_cast<uint8_t>(precision_);
+  bytes[6] = static_cast<uint8_t>(layout_);
+  StoreLittleEndian64(generation, bytes + kGenerationField);
+  StoreLittleEndian64(size_, bytes + kSizeField);
+  StoreLittleEndian64(Checksum(bytes, kChecksumField),
+                      bytes + kChecksumField);
+  memcpy(slot, bytes, sizeof(bytes));
+
+  // Both slots share the first page of the mapping.
+  if (msync(mapping_, kRegistersOffset, MS_SYNC) != 0) {
+    return errno;
+  }
+  return 0;
+}
+
+}  // namespace libcount
@@ -0,0 +1,102 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_REGISTER_FILE_H_
+#define COUNT_REGISTER_FILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace libcount {
+
+// Dense registers kept in a shared memory mapping of a file, so that they
+// outlive the process. Updates are plain stores to the mapping; the kernel
+// writes the pages back to the file in its own time, and Checkpoint() forces
+// them out and records a new generation in the header.
+//
+// The file holds two header slots followed by the registers, which start on
+// a page boundary and are stored in host byte order:
+//
+//   offset  size  contents
+//        0    32  header slot for odd generations
+//      512    32  header slot for even generations
+//     4096     *  registers
+//
+// Each slot holds the magic bytes 'L', 'C', 'N', 'F', the format version
+// (currently 1), the precision, the register layout, a zero byte, then the
+// generation and the size of the registers in bytes, and a checksum of the
+// preceding 24 bytes, as little-endian 8 byte integers. Checkpoints write
+// the slot not holding the current generation, so a write torn by a crash
+// leaves the other slot intact; on opening, the valid slot with the higher
+// generation wins.
+//
+// Since registers only ever grow, the registers found after a crash are
+// those of the last checkpoint, raised by whichever later updates had
+// already reached the file: a state the sketch could have been in. A file
+// created with a crash before its first checkpoint has a blank header, and
+// is set up afresh when next opened.
+class RegisterFile {
+ public:
+  // Open the file at 'path' to hold 'size' bytes of registers for a sketch
+  // of the given precision and register layout, creating it if it doesn't
+  // exist. An existing file must have been created with the same precision
+  // and layout. The file is locked against being opened a second time.
+  // Returns NULL on failure. In the event of failure, the caller may provide
+  // a pointer to an integer to learn the reason: EINVAL if the file is not
+  // a register file for the sketch, EBUSY if it is already open, or the
+  // errno value of a failed system call.
+  static RegisterFile* Open(const char* path, int precision, int layout,
+                            size_t size, int* error);
+
+  // Unmaps and unlocks the file, without a checkpoint.
+  ~RegisterFile();
+
+  // Return the registers, which start out zero in a new file.
+  uint8_t* registers() const { return mapping_ + kRegistersOffset; }
+
+  // Return the generation of the last checkpoint.
+  uint64_t generation() const { return generation_; }
+
+  // Flush the registers to the file, then record the next generation in the
+  // header. Only the pages changed since they were last written reach the
+  // disk. Returns 0 on success, or the errno value of a failed system call;
+  // the previous checkpoint remains valid in that case.
+  int Checkpoint();
+
+ private:
+  // No copying allowed
+  RegisterFile(const RegisterFile& no_copy);
+  RegisterFile& operator=(const RegisterFile& no_assign);
+
+  static const size_t kRegistersOffset = 4096;
+
+  RegisterFile(int fd, uint8_t* mapping, size_t mapping_size, int precision,
+               int layout, size_t size, uint64_t generation);
+
+  // Write the header slot for 'generation', and flush it to the file.
+  int WriteHeader(uint64_t generation);
+
+  int fd_;
+  uint8_t* mapping_;
+  size_t mapping_size_;
+  int precision_;
+  int layout_;
+  size_t size_;
+  uint64_t generation_;
+};
+
+}  // namespace libcount
+
+#endif  // COUNT_REGISTER_FILE_H_
@@ -0,0 +1,210 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/register_file.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "count/c.h"
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::HLL;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_INCREMENTAL;
+
+// Return a path for a scratch file, unique to this process.
+std::string ScratchPath() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/register_file_test.%d", getpid());
+  return path;
+}
+
+// Overwrite a byte of a file.
+void Poke(const std::string& path, long offset, uint8_t value) {
+  FILE* file = fopen(path.c_str(), "r+b");
+  fseek(file, offset, SEEK_SET);
+  fputc(value, file);
+  fclose(file);
+}
+
+// Return the error from creating a mapped object.
+int CreateError(const std::string& path, int precision, int options) {
+  int error = 0;
+  HLL* hll = HLL::CreateMapped(path.c_str(), precision, options, &error);
+  delete hll;
+  return (hll != NULL) ? 0 : error;
+}
+
+// A mapped object counts like one in memory, and a new object mapping the
+// same file resumes where it left off.
+bool TestResume() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED6 | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_BYTE | HLL_ESTIMATOR_MLE};
+  const std::string path = ScratchPath();
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    unlink(path.c_str());
+    HLL* mapped = HLL::CreateMapped(path.c_str(), 12, kOptions[o]);
+    HLL* memory = HLL::Create(12, kOptions[o], NULL);
+    EXPECT(mapped != NULL);
+    EXPECT(mapped->CheckpointGeneration() == 1);
+    EXPECT(mapped->Estimate() == 0);
+    for (uint64_t i = 0; i < 50000; ++i) {
+      mapped->Update(Hash(i));
+      memory->Update(Hash(i));
+    }
+    EXPECT(mapped->Checkpoint() == 0);
+    EXPECT(mapped->CheckpointGeneration() == 2);
+
+    // Updates after the checkpoint reach the file as well.
+    for (uint64_t i = 50000; i < 60000; ++i) {
+      mapped->Update(Hash(i));
+      memory->Update(Hash(i));
+    }
+    delete mapped;
+    mapped = HLL::CreateMapped(path.c_str(), 12, kOptions[o]);
+    EXPECT(mapped != NULL);
+    EXPECT(mapped->CheckpointGeneration() == 2);
+    EXPECT(mapped->Estimate() == memory->Estimate());
+    HLL* copy = HLL::Create(12, kOptions[o], NULL);
+    EXPECT(copy->Merge(mapped) == 0);
+    EXPECT(copy->Estimate() == memory->Estimate());
+
+    delete copy;
+    delete mapped;
+    delete memory;
+  }
+  unlink(path.c_str());
+  return true;
+}
+
+// A damaged header slot is passed over for the other one; unsuitable files
+// and options are refused.
+bool TestRecovery() {
+  const std::string path = ScratchPath();
+  unlink(path.c_str());
+  HLL* hll = HLL::CreateMapped(path.c_str(), 10, HLL_LAYOUT_BYTE);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    hll->Update(Hash(i));
+  }
+  EXPECT(hll->Checkpoint() == 0);
+  EXPECT(hll->Checkpoint() == 0);
+  EXPECT(hll->CheckpointGeneration() == 3);
+  const uint64_t estimate = hll->Estimate();
+
+  // The file is in use.
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_BYTE) == EBUSY);
+  delete hll;
+
+  // Generation 3 is in the slot at offset 0, and 2 at offset 512.
+  Poke(path, 8, 0xFF);
+  hll = HLL::CreateMapped(path.c_str(), 10, HLL_LAYOUT_BYTE);
+  EXPECT(hll != NULL);
+  EXPECT(hll->CheckpointGeneration() == 2);
+  EXPECT(hll->Estimate() == estimate);
+  EXPECT(hll->Checkpoint() == 0);
+  EXPECT(hll->CheckpointGeneration() == 3);
+  delete hll;
+  Poke(path, 512 + 8, 0xFF);
+  hll = HLL::CreateMapped(path.c_str(), 10, HLL_LAYOUT_BYTE);
+  EXPECT(hll->CheckpointGeneration() == 3);
+  delete hll;
+
+  // Neither slot valid, a register out of range, or another sketch.
+  Poke(path, 0, 'X');
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_BYTE) == EINVAL);
+  Poke(path, 0, 'L');
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_BYTE) == 0);
+  Poke(path, 4096 + 3, 63);
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_BYTE) == EINVAL);
+  Poke(path, 4096 + 3, 0);
+  EXPECT(CreateError(path, 11, HLL_LAYOUT_BYTE) == EINVAL);
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_PACKED6) == EINVAL);
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_BYTE | HLL_ESTIMATOR_MLE) == 0);
+  unlink(path.c_str());
+
+  EXPECT(CreateError(path, 10, HLL_LAYOUT_PACKED4) == EINVAL);
+  EXPECT(CreateError(path, 3, HLL_LAYOUT_BYTE) == EINVAL);
+  EXPECT(CreateError(path, 27, HLL_LAYOUT_BYTE) == EINVAL);
+  EXPECT(CreateError("/nonexistent/registers", 10, HLL_LAYOUT_BYTE) ==
+         ENOENT);
+
+  // The C interface, too.
+  hll_t* ctx = HLL_create_mapped(path.c_str(), 10, HLL_LAYOUT_BYTE, NULL);
+  EXPECT(ctx != NULL);
+  HLL_update(ctx, Hash(1));
+  EXPECT(HLL_checkpoint(ctx) == 0);
+  HLL_free(ctx);
+  ctx = HLL_create_mapped(path.c_str(), 10, HLL_LAYOUT_BYTE, NULL);
+  EXPECT(HLL_estimate(ctx) == 1);
+  HLL_free(ctx);
+  unlink(path.c_str());
+
+  // Objects too fine for the sparse list, which start out dense, map too.
+  hll = HLL::CreateMapped(path.c_str(), 26, HLL_LAYOUT_PACKED6);
+  EXPECT(hll != NULL);
+  hll->Update(Hash(1));
+  EXPECT(hll->Checkpoint() == 0);
+  delete hll;
+  hll = HLL::CreateMapped(path.c_str(), 26, HLL_LAYOUT_PACKED6);
+  EXPECT(hll != NULL);
+  EXPECT(hll->Estimate() == 1);
+  delete hll;
+  unlink(path.c_str());
+
+  // A crash between sizing a new file and its first checkpoint leaves the
+  // header blank; the file is taken up as a new one.
+  FILE* file = fopen(path.c_str(), "wb");
+  EXPECT(file != NULL);
+  fclose(file);
+  EXPECT(truncate(path.c_str(), 4096 + 1024) == 0);
+  hll = HLL::CreateMapped(path.c_str(), 10, HLL_LAYOUT_BYTE);
+  EXPECT(hll != NULL);
+  EXPECT(hll->CheckpointGeneration() == 1);
+  EXPECT(hll->Estimate() == 0);
+  hll->Update(Hash(1));
+  EXPECT(hll->Checkpoint() == 0);
+  delete hll;
+  hll = HLL::CreateMapped(path.c_str(), 10, HLL_LAYOUT_BYTE);
+  EXPECT(hll->CheckpointGeneration() == 2);
+  EXPECT(hll->Estimate() == 1);
+  delete hll;
+  unlink(path.c_str());
+
+  // Objects in memory have no checkpoints.
+  hll = HLL::Create(10);
+  EXPECT(hll->Checkpoint() == EINVAL);
+  EXPECT(hll->CheckpointGeneration() == 0);
+  delete hll;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestResume() && ok;
+  ok = TestRecovery() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
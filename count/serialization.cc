@@ -0,0 +1,157 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/serialization.h"
+
+#include <assert.h>
+#include <errno.h>
+
+#include "count/hll_limits.h"
+#include "count/packed_registers.h"
+#include "count/sparse_registers.h"
+
+namespace {
+
+const uint8_t kMagic[4] = {'L', 'C', 'N', 'T'};
+
+// A one in the low bit of every other 6-bit lane of a packed word, starting
+// with lane zero: five lanes, each with six clear bits above it.
+const uint64_t kAlternateLaneOnes = 0x0001001001001001ULL;
+
+// Return a word with bit 6 of a lane set iff that lane of 'lanes', which
+// holds only every other lane of a packed word, is greater than 'limit'.
+// Adding (63 - limit) carries into bit 6 exactly when the lane exceeds the
+// limit, and cannot reach the next lane.
+inline uint64_t AlternateLanesAbove(uint64_t lanes, uint8_t limit) {
+  const uint64_t bias = kAlternateLaneOnes * (63 - limit);
+  return (lanes + bias) & (kAlternateLaneOnes << 6);
+}
+
+}  // namespace
+
+namespace libcount {
+
+void WriteSerializedHeader(const SerializedHeader& header, uint8_t* buffer) {
+  assert(buffer != NULL);
+  for (int i = 0; i < 4; ++i) {
+    buffer[i] = kMagic[i];
+  }
+  buffer[4] = static_cast<uint8_t>(header.version);
+  buffer[5] = static_cast<uint8_t>(header.precision);
+  buffer[6] = static_cast<uint8_t>(header.encoding);
+  buffer[7] = 0;
+  StoreLittleEndian32(static_cast<uint32_t>(header.options), buffer + 8);
+  StoreLittleEndian32(header.payload_size, buffer + 12);
+}
+
+int ReadSerializedHeader(const uint8_t* buffer, size_t size,
+                         SerializedHeader* header) {
+  assert(header != NULL);
+  if ((buffer == NULL) || (size < kSerializedHeaderSize)) {
+    return EINVAL;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (buffer[i] != kMagic[i]) {
+      return EINVAL;
+    }
+  }
+  header->version = buffer[4];
+  header->precision = buffer[5];
+  header->encoding = buffer[6];
+  header->options = static_cast<int>(LoadLittleEndian32(buffer + 8));
+  header->payload_size = LoadLittleEndian32(buffer + 12);
+
+  // Objects written by later versions of the format are rejected, rather
+  // than misinterpreted.
+  if ((header->version != kSerializedVersion) || (buffer[7] != 0)) {
+    return EINVAL;
+  }
+  if ((header->precision < HLL_MIN_PRECISION) ||
+      (header->precision > HLL_MAX_PRECISION)) {
+    return EINVAL;
+  }
+  if (size - kSerializedHeaderSize != header->payload_size) {
+    return EINVAL;
+  }
+  switch (header->encoding) {
+    case ENCODING_SPARSE:
+      // Objects finer than the sparse list are always dense.
+      if (header->precision > SparseRegisters::kPrecision) {
+        return EINVAL;
+      }
+      return (header->payload_size >= 4) ? 0 : EINVAL;
+    case ENCODING_BYTES:
+    case ENCODING_PACKED6: {
+      const size_t expected =
+          DensePayloadSize(header->encoding, header->precision);
+      return (header->payload_size == expected) ? 0 : EINVAL;
+    }
+    default:
+      return EINVAL;
+  }
+}
+
+bool ValidDensePayload(const uint8_t* payload, int encoding, int precision) {
+  const int register_count = 1 << precision;
+  const uint8_t max_rank = static_cast<uint8_t>(64 - precision + 1);
+  if (encoding == ENCODING_BYTES) {
+    uint8_t out_of_range = 0;
+    for (int i = 0; i < register_count; ++i) {
+      out_of_range |= (payload[i] > max_rank);
+    }
+    return (out_of_range == 0);
+  }
+
+  // Check all the lanes of each full word at once, as two sets of alternate
+  // lanes; the four bits above the last lane must be zero.
+  assert(encoding == ENCODING_PACKED6);
+  const uint64_t lane_mask = kAlternateLaneOnes * kPacked6LaneMask;
+  const int word_count = Packed6WordCount(register_count);
+  uint64_t invalid = 0;
+  for (int w = 0; w + 1 < word_count; ++w) {
+    const uint64_t bits = LoadLittleEndian64(payload + w * sizeof(bits));
+    invalid |= bits >> (kPacked6PerWord * kPacked6Bits);
+    const uint64_t odd_lanes = (bits >> kPacked6Bits) & lane_mask;
+    invalid |= AlternateLanesAbove(bits & lane_mask, max_rank);
+    invalid |= AlternateLanesAbove(odd_lanes, max_rank);
+  }
+  if (invalid != 0) {
+    return false;
+  }
+
+  // In the last word, lanes past the last register must be zero too.
+  const int last = word_count - 1;
+  uint64_t bits = LoadLittleEndian64(payload + last * sizeof(bits));
+  for (int index = last * kPacked6PerWord;
+       index < (last + 1) * kPacked6PerWord; ++index) {
+    const uint64_t limit = (index < register_count) ? max_rank : 0;
+    if ((bits & kPacked6LaneMask) > limit) {
+      return false;
+    }
+    bits >>= kPacked6Bits;
+  }
+  return (bits == 0);
+}
+
+size_t DensePayloadSize(int encoding, int precision) {
+  const int register_count = 1 << precision;
+  if (encoding == ENCODING_PACKED6) {
+    return Packed6WordCount(register_count) * sizeof(uint64_t);
+  }
+  assert(encoding == ENCODING_BYTES);
+  return register_count;
+}
+
+}  // namespace libcount
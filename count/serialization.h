@@ -0,0 +1,142 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_SERIALIZATION_H_
+#define COUNT_SERIALIZATION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "count/packed_registers.h"
+
+namespace libcount {
+
+// The serialized form of an HLL object is a fixed-size header followed by a
+// payload. All multi-byte integers are little-endian, whatever the host.
+//
+//   offset  size  field
+//        0     4  magic: the bytes 'L', 'C', 'N', 'T'
+//        4     1  format version, currently 1
+//        5     1  precision
+//        6     1  encoding of the payload (SerializedEncoding)
+//        7     1  reserved, zero
+//        8     4  options the object was created with, less HLL_OPTION_DENSE
+//       12     4  size of the payload in bytes
+//
+// The payload depends on the encoding:
+//
+//   ENCODING_SPARSE: the number of entries in the sparse list (4 bytes),
+//     followed by the list itself: the varint-encoded differences between
+//     successive (index << 6 | rank) keys, in ascending order of key, at the
+//     sparse precision (see sparse_registers.h). Only objects of precision
+//     up to the sparse precision are encoded this way.
+//   ENCODING_BYTES: (2 ^ precision) registers of one byte each.
+//   ENCODING_PACKED6: the registers in 6 bits apiece, ten to each 64-bit
+//     word, as in packed_registers.h.
+
+const size_t kSerializedHeaderSize = 16;
+const int kSerializedVersion = 1;
+
+enum SerializedEncoding {
+  ENCODING_SPARSE = 0,
+  ENCODING_BYTES = 1,
+  ENCODING_PACKED6 = 2
+};
+
+struct SerializedHeader {
+  int version;
+  int precision;
+  int encoding;
+  int options;
+  uint32_t payload_size;
+};
+
+// Write a header to the first kSerializedHeaderSize bytes of 'buffer'.
+void WriteSerializedHeader(const SerializedHeader& header, uint8_t* buffer);
+
+// Read and check the header of a serialized object of 'size' bytes, and
+// that the size agrees with it. Returns 0 on success, or EINVAL if the
+// buffer does not hold an object in a format this version understands.
+// The payload itself is not checked.
+int ReadSerializedHeader(const uint8_t* buffer, size_t size,
+                         SerializedHeader* header);
+
+// Return the size of the payload of a dense encoding, in bytes.
+size_t DensePayloadSize(int encoding, int precision);
+
+// Return true if the payload of a dense encoding holds only register values
+// that are possible at the given precision, and the padding of the packed
+// encoding is zero.
+bool ValidDensePayload(const uint8_t* payload, int encoding, int precision);
+
+// Little-endian stores and loads, for unaligned buffers. On little-endian
+// hosts the loads and the 64-bit store are plain unaligned accesses;
+// compilers don't reliably fuse the portable byte-at-a-time loops into one.
+inline void StoreLittleEndian32(uint32_t value, uint8_t* out) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+inline uint32_t LoadLittleEndian32(const uint8_t* in) {
+  uint32_t value = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  memcpy(&value, in, sizeof(value));
+#else
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(in[i]) << (8 * i);
+  }
+#endif
+  return value;
+}
+
+inline void StoreLittleEndian64(uint64_t value, uint8_t* out) {
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  memcpy(out, &value, sizeof(value));
+#else
+  for (int i = 0; i < 8; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+#endif
+}
+
+inline uint64_t LoadLittleEndian64(const uint8_t* in) {
+  uint64_t value = 0;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  memcpy(&value, in, sizeof(value));
+#else
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+#endif
+  return value;
+}
+
+// Return the value of a register from the payload of a dense encoding.
+inline uint8_t EncodedRegister(const uint8_t* payload, int encoding,
+                               int index) {
+  if (encoding == ENCODING_PACKED6) {
+    const int word = index / kPacked6PerWord;
+    const int shift = (index % kPacked6PerWord) * kPacked6Bits;
+    const uint64_t bits = LoadLittleEndian64(payload + word * sizeof(bits));
+    return static_cast<uint8_t>((bits >> shift) & kPacked6LaneMask);
+  }
+  return payload[index];
+}
+
+}  // namespace libcount
+
+#endif  // COUNT_SERIALIZATION_H_
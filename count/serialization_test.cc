@@ -0,0 +1,322 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/serialization.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "count/c.h"
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::HLL;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_INCREMENTAL;
+using libcount::kSerializedHeaderSize;
+
+// Return the serialized form of an object.
+std::vector<uint8_t> Serialize(const HLL* hll) {
+  std::vector<uint8_t> bytes(hll->SerializedSize());
+  if (hll->Serialize(&bytes[0], bytes.size()) != 0) {
+    bytes.clear();
+  }
+  return bytes;
+}
+
+// Return true if deserializing the bytes fails with EINVAL.
+bool Rejected(const std::vector<uint8_t>& bytes) {
+  int error = 0;
+  HLL* hll = HLL::Deserialize(bytes.empty() ? NULL : &bytes[0], bytes.size(),
+                              &error);
+  delete hll;
+  return (hll == NULL) && (error == EINVAL);
+}
+
+// Objects of every layout and representation survive a round trip, and
+// serializing the copy gives the same bytes again.
+bool TestRoundTrip() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL,
+                          HLL_LAYOUT_PACKED6 | HLL_ESTIMATOR_MLE};
+  const uint64_t kCardinalities[] = {0, 10, 1000, 100000};
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (size_t c = 0; c < sizeof(kCardinalities) / sizeof(uint64_t); ++c) {
+      HLL* hll = HLL::Create(12, kOptions[o], NULL);
+      for (uint64_t i = 0; i < kCardinalities[c]; ++i) {
+        hll->Update(Hash(i));
+      }
+      const std::vector<uint8_t> bytes = Serialize(hll);
+      EXPECT(!bytes.empty());
+      int error = 0;
+      HLL* copy = HLL::Deserialize(&bytes[0], bytes.size(), &error);
+      EXPECT(copy != NULL);
+      EXPECT(copy->Estimate() == hll->Estimate());
+      EXPECT(Serialize(copy) == bytes);
+
+      // Both must go on counting in the same way.
+      for (uint64_t i = 0; i < 1000; ++i) {
+        hll->Update(Hash(i + 7000000));
+        copy->Update(Hash(i + 7000000));
+      }
+      EXPECT(copy->Estimate() == hll->Estimate());
+      delete hll;
+      delete copy;
+    }
+  }
+  return true;
+}
+
+// The header is laid out as documented, whatever the host byte order.
+bool TestFormat() {
+  HLL* hll = HLL::Create(4, HLL_LAYOUT_PACKED6 | HLL_ESTIMATOR_MLE, NULL);
+  for (uint64_t i = 0; i < 1000; ++i) {
+    hll->Update(Hash(i));
+  }
+  const std::vector<uint8_t> bytes = Serialize(hll);
+  const uint8_t kHeader[kSerializedHeaderSize] = {
+      'L', 'C', 'N', 'T', 1, 4, 2, 0, 0x01, 0x02, 0, 0, 16, 0, 0, 0};
+  EXPECT(bytes.size() == kSerializedHeaderSize + 16);
+  EXPECT(memcmp(&bytes[0], kHeader, kSerializedHeaderSize) == 0);
+  delete hll;
+
+  // Too small a buffer is reported, and left untouched.
+  hll = HLL::Create(10);
+  uint8_t buffer[8] = {0};
+  EXPECT(hll->Serialize(buffer, sizeof(buffer)) == ERANGE);
+  EXPECT(buffer[0] == 0);
+  delete hll;
+  return true;
+}
+
+// Damaged or foreign buffers are rejected rather than trusted.
+bool TestCorruption() {
+  HLL* sparse = HLL::Create(12);
+  HLL* dense = HLL::Create(12, HLL_LAYOUT_PACKED6, NULL);
+  for (uint64_t i = 0; i < 100000; ++i) {
+    dense->Update(Hash(i));
+    if (i < 100) {
+      sparse->Update(Hash(i));
+    }
+  }
+  const std::vector<uint8_t> good_sparse = Serialize(sparse);
+  const std::vector<uint8_t> good_dense = Serialize(dense);
+  std::vector<uint8_t> bad;
+
+  EXPECT(Rejected(std::vector<uint8_t>()));
+  bad = good_dense;
+  bad[0] = 'X';  // magic
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[4] = 2;  // version
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[5] = 30;  // precision
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[6] = 9;  // encoding
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[9] = 0xFF;  // options
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad.pop_back();  // truncated
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[kSerializedHeaderSize] |= 0x3F;  // register 0 holds 63
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[kSerializedHeaderSize] &= 0x3F;  // register 1 holds 54, one past max
+  bad[kSerializedHeaderSize] |= (54 & 0x03) << 6;
+  bad[kSerializedHeaderSize + 1] &= 0xF0;
+  bad[kSerializedHeaderSize + 1] |= 54 >> 2;
+  EXPECT(Rejected(bad));
+  bad = good_dense;
+  bad[kSerializedHeaderSize + 7] |= 0x80;  // padding bits of the first word
+  EXPECT(Rejected(bad));
+
+  bad = good_sparse;
+  bad[5] = 26;  // precision finer than the sparse list
+  EXPECT(Rejected(bad));
+  bad = good_sparse;
+  bad[5] = 25;  // the finest precision of the sparse list
+  EXPECT(!Rejected(bad));
+  bad = good_sparse;
+  bad[kSerializedHeaderSize] += 1;  // entry count
+  EXPECT(Rejected(bad));
+  bad = good_sparse;
+  bad.back() |= 0x80;  // unterminated varint
+  EXPECT(Rejected(bad));
+  bad = good_sparse;
+  bad[kSerializedHeaderSize + 4 + 1] = 0;  // zero delta: repeated index
+  EXPECT(Rejected(bad));
+
+  // A single key of 1 spelled out in five bytes, then with bits past bit
+  // 31 set in the fifth byte, which would otherwise be dropped silently.
+  const uint8_t kLongKey[] = {0x81, 0x80, 0x80, 0x80, 0x00};
+  bad.assign(good_sparse.begin(),
+             good_sparse.begin() + kSerializedHeaderSize + 4);
+  bad.insert(bad.end(), kLongKey, kLongKey + sizeof(kLongKey));
+  bad[12] = 4 + sizeof(kLongKey);  // payload size
+  bad[13] = bad[14] = bad[15] = 0;
+  bad[kSerializedHeaderSize] = 1;  // entry count
+  bad[kSerializedHeaderSize + 1] = 0;
+  bad[kSerializedHeaderSize + 2] = 0;
+  bad[kSerializedHeaderSize + 3] = 0;
+  EXPECT(!Rejected(bad));
+  bad.back() = 0x10;
+  EXPECT(Rejected(bad));
+  bad.back() = 0x8F;
+  EXPECT(Rejected(bad));
+
+  delete sparse;
+  delete dense;
+  return true;
+}
+
+// Return a new object with the given options, updated with 'n' elements
+// starting from 'first'.
+HLL* Filled(int options, uint64_t first, uint64_t n) {
+  HLL* hll = HLL::Create(12, options, NULL);
+  for (uint64_t i = first; i < first + n; ++i) {
+    hll->Update(Hash(i));
+  }
+  return hll;
+}
+
+// Merging a serialized object leaves the same state as deserializing it and
+// merging the copy, for every combination of layouts and representations.
+bool TestMergeSerialized() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_PACKED6 | HLL_OPTION_INCREMENTAL};
+  const uint64_t kCardinalities[] = {0, 50, 100000};
+  const int kCount = sizeof(kOptions) / sizeof(int);
+  const int kSizes = sizeof(kCardinalities) / sizeof(uint64_t);
+  for (int so = 0; so < kCount; ++so) {
+    for (int sc = 0; sc < kSizes; ++sc) {
+      HLL* source = Filled(kOptions[so], 0, kCardinalities[sc]);
+      const std::vector<uint8_t> blob = Serialize(source);
+      HLL* copy = HLL::Deserialize(&blob[0], blob.size(), NULL);
+      for (int to = 0; to < kCount; ++to) {
+        for (int tc = 0; tc < kSizes; ++tc) {
+          HLL* actual = Filled(kOptions[to], 5000, kCardinalities[tc]);
+          HLL* expected = Filled(kOptions[to], 5000, kCardinalities[tc]);
+          EXPECT(actual->MergeSerialized(&blob[0], blob.size()) == 0);
+          EXPECT(expected->Merge(copy) == 0);
+          EXPECT(actual->Estimate() == expected->Estimate());
+          EXPECT(Serialize(actual) == Serialize(expected));
+          delete actual;
+          delete expected;
+        }
+      }
+      delete copy;
+      delete source;
+    }
+  }
+
+  // A source of higher precision is folded on the fly, as Merge() does.
+  for (int so = 0; so < kCount; ++so) {
+    for (int sc = 0; sc < kSizes; ++sc) {
+      HLL* source = HLL::Create(14, kOptions[so], NULL);
+      for (uint64_t i = 0; i < kCardinalities[sc]; ++i) {
+        source->Update(Hash(i));
+      }
+      const std::vector<uint8_t> blob = Serialize(source);
+      for (int to = 0; to < kCount; ++to) {
+        HLL* actual = Filled(kOptions[to], 5000, 1000);
+        HLL* expected = Filled(kOptions[to], 5000, 1000);
+        EXPECT(actual->MergeSerialized(&blob[0], blob.size()) == 0);
+        EXPECT(expected->Merge(source) == 0);
+        EXPECT(actual->precision() == 12);
+        EXPECT(actual->Estimate() == expected->Estimate());
+        EXPECT(Serialize(actual) == Serialize(expected));
+        delete actual;
+        delete expected;
+      }
+      delete source;
+    }
+  }
+
+  // Lower precisions, or damaged buffers, are rejected, and merge nothing.
+  HLL* target = Filled(HLL_LAYOUT_BYTE, 0, 100);
+  const std::vector<uint8_t> before = Serialize(target);
+  HLL* other = HLL::Create(11);
+  const std::vector<uint8_t> wrong_precision = Serialize(other);
+  EXPECT(target->MergeSerialized(&wrong_precision[0],
+                                 wrong_precision.size()) == EINVAL);
+  HLL* dense = Filled(HLL_LAYOUT_PACKED6, 1000, 100000);
+  std::vector<uint8_t> bad = Serialize(dense);
+  bad.back() = 0xFF;  // padding bits of the last word
+  EXPECT(target->MergeSerialized(&bad[0], bad.size()) == EINVAL);
+  HLL* sparse = Filled(HLL_LAYOUT_BYTE, 1000, 100);
+  bad = Serialize(sparse);
+  bad.back() |= 0x80;  // unterminated varint
+  EXPECT(target->MergeSerialized(&bad[0], bad.size()) == EINVAL);
+  EXPECT(target->MergeSerialized(NULL, 0) == EINVAL);
+  EXPECT(Serialize(target) == before);
+
+  // The C interface, too.
+  hll_t* ctx = HLL_create(12, NULL);
+  const std::vector<uint8_t> blob = Serialize(dense);
+  EXPECT(HLL_merge_serialized(ctx, &blob[0], blob.size()) == 0);
+  EXPECT(HLL_estimate(ctx) == dense->Estimate());
+  HLL_free(ctx);
+
+  delete target;
+  delete other;
+  delete dense;
+  delete sparse;
+  return true;
+}
+
+// The C interface round trips too.
+bool TestCInterface() {
+  hll_t* ctx = HLL_create(14, NULL);
+  for (uint64_t i = 0; i < 5000; ++i) {
+    HLL_update(ctx, Hash(i));
+  }
+  std::vector<uint8_t> bytes(HLL_serialized_size(ctx));
+  EXPECT(HLL_serialize(ctx, &bytes[0], bytes.size()) == 0);
+  int error = 0;
+  hll_t* copy = HLL_deserialize(&bytes[0], bytes.size(), &error);
+  EXPECT(copy != NULL);
+  EXPECT(HLL_estimate(copy) == HLL_estimate(ctx));
+  EXPECT(HLL_deserialize(&bytes[0], 3, &error) == NULL);
+  EXPECT(error == EINVAL);
+  HLL_free(ctx);
+  HLL_free(copy);
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestRoundTrip() && ok;
+  ok = TestFormat() && ok;
+  ok = TestCorruption() && ok;
+  ok = TestMergeSerialized() && ok;
+  ok = TestCInterface() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
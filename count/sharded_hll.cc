@@ -0,0 +1,249 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/sharded_hll.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
+
+#include "count/hll_limits.h"
+#include "count/serialization.h"
+#include "count/utility.h"
+
+namespace {
+
+// Each handle's registers start on a line of their own, and its epoch sits
+// on the line after them.
+const size_t kCacheLineSize = 64;
+
+// The handles of one thread: entry i is the handle for the object in slot i
+// of 'g_objects', if that object has the entry's serial number. Slots are
+// reused, serial numbers never are, so that the handle of a destroyed object
+// isn't mistaken for one of its successor in the slot.
+struct HandleEntry {
+  HandleEntry() : serial(0), handle(NULL) {}
+  uint64_t serial;
+  libcount::ShardedHLL::Handle* handle;
+};
+typedef std::vector<HandleEntry> HandleTable;
+
+// State shared by all objects. A process has a limited number of thread
+// specific keys, so every object uses the one key, whose value for a thread
+// is its HandleTable. The live objects are listed by slot; the mutex guards
+// the list, and is taken before that of any object.
+pthread_once_t g_once = PTHREAD_ONCE_INIT;
+int g_key_status = 0;
+pthread_key_t g_key;
+pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<libcount::ShardedHLL*>* g_objects = NULL;
+std::vector<size_t>* g_free_slots = NULL;
+uint64_t g_next_serial = 1;
+
+}  // namespace
+
+namespace libcount {
+
+void ShardedHLL::InitShared() {
+  g_key_status = pthread_key_create(&g_key, ReleaseThreadHandles);
+  g_objects = new std::vector<ShardedHLL*>;
+  g_free_slots = new std::vector<size_t>;
+}
+
+void ShardedHLL::ReleaseThreadHandles(void* arg) {
+  HandleTable* const table = static_cast<HandleTable*>(arg);
+  pthread_mutex_lock(&g_mutex);
+  for (size_t slot = 0; slot < table->size(); ++slot) {
+    const HandleEntry& entry = (*table)[slot];
+    if ((entry.handle != NULL) && (slot < g_objects->size()) &&
+        ((*g_objects)[slot] != NULL) &&
+        ((*g_objects)[slot]->serial_ == entry.serial)) {
+      (*g_objects)[slot]->RetireHandle(entry.handle);
+    }
+  }
+  pthread_mutex_unlock(&g_mutex);
+  delete table;
+}
+
+ShardedHLL::Handle::Handle(int precision, uint64_t* words, uint64_t* epoch)
+    : precision_(precision), words_(words), epoch_(epoch) {}
+
+ShardedHLL::ShardedHLL(int precision, HLL* aggregate)
+    : precision_(precision),
+      slot_(0),
+      serial_(0),
+      scratch_(size_t(1) << precision),
+      aggregate_(aggregate),
+      estimate_(0),
+      estimate_valid_(true) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_mutex_lock(&g_mutex);
+  serial_ = g_next_serial++;
+  if (g_free_slots->empty()) {
+    slot_ = g_objects->size();
+    g_objects->push_back(this);
+  } else {
+    slot_ = g_free_slots->back();
+    g_free_slots->pop_back();
+    (*g_objects)[slot_] = this;
+  }
+  pthread_mutex_unlock(&g_mutex);
+}
+
+ShardedHLL::~ShardedHLL() {
+  // Once out of the list, exiting threads leave the handles alone.
+  pthread_mutex_lock(&g_mutex);
+  (*g_objects)[slot_] = NULL;
+  g_free_slots->push_back(slot_);
+  pthread_mutex_unlock(&g_mutex);
+  pthread_mutex_destroy(&mutex_);
+  for (size_t i = 0; i < handles_.size(); ++i) {
+    free(handles_[i]->words_);
+    delete handles_[i];
+  }
+  delete aggregate_;
+}
+
+ShardedHLL* ShardedHLL::Create(int precision, int options, int* error) {
+  if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  const int estimator = options & HLL_ESTIMATOR_MASK;
+  if (((options & ~(HLL_ESTIMATOR_MASK | HLL_OPTION_DENSE)) != 0) ||
+      ((estimator != HLL_ESTIMATOR_EMPIRICAL) &&
+       (estimator != HLL_ESTIMATOR_IMPROVED) &&
+       (estimator != HLL_ESTIMATOR_MLE))) {
+    MaybeAssign(error, EINVAL);
+    return NULL;
+  }
+  pthread_once(&g_once, InitShared);
+  if (g_key_status != 0) {
+    MaybeAssign(error, g_key_status);
+    return NULL;
+  }
+  HLL* aggregate =
+      HLL::Create(precision, HLL_LAYOUT_BYTE | HLL_OPTION_DENSE | estimator,
+                  error);
+  assert(aggregate != NULL);
+  return new ShardedHLL(precision, aggregate);
+}
+
+ShardedHLL::Handle* ShardedHLL::ThreadHandle() {
+  HandleTable* table = static_cast<HandleTable*>(pthread_getspecific(g_key));
+  if ((table != NULL) && (slot_ < table->size()) &&
+      ((*table)[slot_].serial == serial_)) {
+    return (*table)[slot_].handle;
+  }
+
+  // The registers, rounded up to whole lines, then a line for the epoch.
+  const size_t size = std::max(size_t(1) << precision_, kCacheLineSize);
+  void* block = NULL;
+  if (posix_memalign(&block, kCacheLineSize, size + kCacheLineSize) != 0) {
+    throw std::bad_alloc();
+  }
+  memset(block, 0, size + kCacheLineSize);
+  uint64_t* const words = static_cast<uint64_t*>(block);
+  Handle* const handle =
+      new Handle(precision_, words, words + size / sizeof(uint64_t));
+
+  pthread_mutex_lock(&mutex_);
+  handles_.push_back(handle);
+  merged_epochs_.push_back(0);
+  pthread_mutex_unlock(&mutex_);
+
+  // An entry left by a destroyed object in the same slot is overwritten;
+  // its handle was freed with that object.
+  if (table == NULL) {
+    table = new HandleTable;
+    pthread_setspecific(g_key, table);
+  }
+  if (table->size() <= slot_) {
+    table->resize(slot_ + 1);
+  }
+  (*table)[slot_].serial = serial_;
+  (*table)[slot_].handle = handle;
+  return handle;
+}
+
+void ShardedHLL::RetireHandle(Handle* handle) {
+  pthread_mutex_lock(&mutex_);
+  Refresh();
+  for (size_t i = 0; i < handles_.size(); ++i) {
+    if (handles_[i] == handle) {
+      handles_.erase(handles_.begin() + i);
+      merged_epochs_.erase(merged_epochs_.begin() + i);
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  free(handle->words_);
+  delete handle;
+}
+
+size_t ShardedHLL::thread_count() {
+  pthread_mutex_lock(&mutex_);
+  const size_t count = handles_.size();
+  pthread_mutex_unlock(&mutex_);
+  return count;
+}
+
+void ShardedHLL::Refresh() {
+  const int word_count = static_cast<int>(scratch_.size() / sizeof(uint64_t));
+  for (size_t i = 0; i < handles_.size(); ++i) {
+    const Handle* handle = handles_[i];
+    // Reading the epoch first means that a register raised after the copy
+    // below bumps the epoch past the one recorded, and is merged next time.
+    const uint64_t epoch = __atomic_load_n(handle->epoch_, __ATOMIC_ACQUIRE);
+    if (epoch == merged_epochs_[i]) {
+      continue;
+    }
+    for (int w = 0; w < word_count; ++w) {
+      const uint64_t word =
+          __atomic_load_n(&handle->words_[w], __ATOMIC_RELAXED);
+      StoreLittleEndian64(word, &scratch_[w * sizeof(uint64_t)]);
+    }
+    aggregate_->MergeRegisters(&scratch_[0], precision_);
+    merged_epochs_[i] = epoch;
+    estimate_valid_ = false;
+  }
+}
+
+uint64_t ShardedHLL::Estimate() {
+  pthread_mutex_lock(&mutex_);
+  Refresh();
+  if (!estimate_valid_) {
+    estimate_ = aggregate_->Estimate();
+    estimate_valid_ = true;
+  }
+  const uint64_t estimate = estimate_;
+  pthread_mutex_unlock(&mutex_);
+  return estimate;
+}
+
+int ShardedHLL::MergeInto(HLL* other) {
+  assert(other != NULL);
+  pthread_mutex_lock(&mutex_);
+  Refresh();
+  const int status = other->Merge(aggregate_);
+  pthread_mutex_unlock(&mutex_);
+  return status;
+}
+
+}  // namespace libcount
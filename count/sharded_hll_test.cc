@@ -0,0 +1,174 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/sharded_hll.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/test_util.h"
+
+using libcount::HLL;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+using libcount::ShardedHLL;
+
+// Return the registers of an HLL object.
+std::vector<uint8_t> RegistersOf(const HLL* hll, int precision) {
+  std::vector<uint8_t> registers(1 << precision);
+  hll->MergeInto(&registers[0], precision);
+  return registers;
+}
+
+// A single thread gets the same estimates as a dense HLL, and estimates
+// taken between updates keep up with them.
+bool TestMatchesHLL() {
+  for (int precision = 4; precision <= 18; precision += 7) {
+    ShardedHLL* sharded = ShardedHLL::Create(precision, HLL_ESTIMATOR_MLE);
+    HLL* hll = HLL::Create(precision, HLL_OPTION_DENSE | HLL_ESTIMATOR_MLE,
+                           NULL);
+    EXPECT(sharded->Estimate() == 0);
+    EXPECT(sharded->ThreadHandle() == sharded->ThreadHandle());
+    for (uint64_t n = 0; n < 200000; n = n * 3 + 1) {
+      for (uint64_t i = n / 3; i < n; ++i) {
+        sharded->Update(Hash(i));
+        hll->Update(Hash(i));
+      }
+      EXPECT(sharded->Estimate() == hll->Estimate());
+      EXPECT(sharded->Estimate() == hll->Estimate());
+    }
+    HLL* copy = HLL::Create(precision, HLL_LAYOUT_PACKED6, NULL);
+    EXPECT(sharded->MergeInto(copy) == 0);
+    EXPECT(RegistersOf(copy, precision) == RegistersOf(hll, precision));
+
+    delete copy;
+    delete hll;
+    delete sharded;
+  }
+  return true;
+}
+
+struct Writer {
+  ShardedHLL* hll;
+  uint64_t first;
+  uint64_t count;
+};
+
+void* WriterThread(void* arg) {
+  const Writer* writer = static_cast<const Writer*>(arg);
+  ShardedHLL::Handle* handle = writer->hll->ThreadHandle();
+  for (uint64_t i = writer->first; i < writer->first + writer->count; ++i) {
+    handle->Update(Hash(i));
+  }
+  return NULL;
+}
+
+// Each thread updates registers of its own, and estimates may be taken
+// while they run; the threads' registers survive the threads, whose handles
+// are freed as they exit.
+bool TestThreads() {
+  const int kThreads = 8;
+  const uint64_t kPerThread = 200000;
+  const int kPrecision = 10;
+  ShardedHLL* sharded = ShardedHLL::Create(kPrecision);
+  pthread_t threads[kThreads];
+  Writer writers[kThreads];
+  for (int t = 0; t < kThreads; ++t) {
+    writers[t].hll = sharded;
+    writers[t].first = t * kPerThread / 2;
+    writers[t].count = kPerThread;
+    EXPECT(pthread_create(&threads[t], NULL, WriterThread, &writers[t]) == 0);
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT(sharded->Estimate() <= 2 * kThreads * kPerThread);
+  }
+  for (int t = 0; t < kThreads; ++t) {
+    pthread_join(threads[t], NULL);
+  }
+  EXPECT(sharded->thread_count() == 0);
+
+  HLL* hll = HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL);
+  for (uint64_t i = 0; i < (kThreads + 1) * kPerThread / 2; ++i) {
+    hll->Update(Hash(i));
+  }
+  HLL* copy = HLL::Create(kPrecision);
+  EXPECT(sharded->MergeInto(copy) == 0);
+  EXPECT(RegistersOf(copy, kPrecision) == RegistersOf(hll, kPrecision));
+  EXPECT(sharded->Estimate() == hll->Estimate());
+
+  delete copy;
+  delete hll;
+  delete sharded;
+  return true;
+}
+
+// Objects don't each take a thread specific key, so there can be more of
+// them than the process has keys, and those in a reused slot start afresh.
+bool TestManyObjects() {
+  const int kObjects = 2000;
+  std::vector<ShardedHLL*> objects(kObjects);
+  for (int i = 0; i < kObjects; ++i) {
+    objects[i] = ShardedHLL::Create(4);
+    EXPECT(objects[i] != NULL);
+    objects[i]->Update(Hash(i));
+  }
+  for (int i = 0; i < kObjects; ++i) {
+    EXPECT(objects[i]->Estimate() == 1);
+    EXPECT(objects[i]->thread_count() == 1);
+  }
+  for (int i = 0; i < kObjects; i += 2) {
+    delete objects[i];
+    objects[i] = ShardedHLL::Create(4);
+    EXPECT(objects[i]->Estimate() == 0);
+    EXPECT(objects[i]->thread_count() == 0);
+  }
+  for (int i = 0; i < kObjects; ++i) {
+    delete objects[i];
+  }
+  return true;
+}
+
+bool TestErrors() {
+  int error = 0;
+  EXPECT(ShardedHLL::Create(3, 0, &error) == NULL);
+  EXPECT(error == EINVAL);
+  EXPECT(ShardedHLL::Create(10, HLL_LAYOUT_PACKED6, &error) == NULL);
+  EXPECT(ShardedHLL::Create(10, 0x300, &error) == NULL);
+  ShardedHLL* sharded = ShardedHLL::Create(10, HLL_OPTION_DENSE);
+  EXPECT(sharded != NULL);
+  HLL* other = HLL::Create(11);
+  EXPECT(sharded->MergeInto(other) == 0);
+  EXPECT(other->precision() == 10);
+  delete other;
+  delete sharded;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestMatchesHLL() && ok;
+  ok = TestThreads() && ok;
+  ok = TestManyObjects() && ok;
+  ok = TestErrors() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
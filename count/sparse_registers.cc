@@ -0,0 +1,218 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/sparse_registers.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+#include "count/hll_limits.h"
+
+namespace {
+
+// Keys carry the sparse index in their upper bits and the rank in the low 6.
+inline uint32_t IndexOfKey(uint32_t key) { return key >> 6; }
+
+// Drop all but the last (and therefore highest ranked) key for each index
+// from a sorted vector of keys.
+void KeepMaxRankPerIndex(std::vector<uint32_t>* keys) {
+  std::vector<uint32_t>& k = *keys;
+  size_t out = 0;
+  for (size_t i = 0; i < k.size(); ++i) {
+    if ((i + 1 < k.size()) && (IndexOfKey(k[i + 1]) == IndexOfKey(k[i]))) {
+      continue;
+    }
+    k[out++] = k[i];
+  }
+  k.resize(out);
+}
+
+// Size the insertion buffer at 1/8th of the dense array size, in bytes.
+size_t BufferCapacity(int precision) {
+  const size_t kMinimumCapacity = 4;
+  return std::max(kMinimumCapacity, (size_t(1) << precision) / 32);
+}
+
+// Visitor that counts the keys of an encoded list.
+struct KeyCounter {
+  explicit KeyCounter(int* count) : count_(count) {}
+  void operator()(uint32_t key) const { ++*count_; }
+  int* count_;
+};
+
+// Visitor that appends the keys of an encoded list to a vector.
+struct KeyCollector {
+  explicit KeyCollector(std::vector<uint32_t>* keys) : keys_(keys) {}
+  void operator()(uint32_t key) const { keys_->push_back(key); }
+  std::vector<uint32_t>* keys_;
+};
+
+}  // namespace
+
+namespace libcount {
+
+SparseRegisters::SparseRegisters(int precision)
+    : precision_(precision),
+      buffer_capacity_(BufferCapacity(precision)),
+      list_count_(0) {
+  assert(precision >= HLL_MIN_PRECISION);
+  assert(precision <= kPrecision);
+}
+
+bool SparseRegisters::Update(uint64_t hash) {
+  // The index is formed from the leading bits of the hash, and the rank is
+  // one more than the count of leading zeroes in the remaining bits.
+  int index;
+  uint8_t rank;
+  IndexAndRankOf(hash, kPrecision, &index, &rank);
+
+  buffer_.push_back((static_cast<uint32_t>(index) << 6) | rank);
+  if (buffer_.size() >= buffer_capacity_) {
+    Flush();
+    return true;
+  }
+  return false;
+}
+
+void SparseRegisters::Merge(const SparseRegisters& other) {
+  std::vector<uint32_t> keys;
+  other.Decode(&keys);
+  keys.insert(keys.end(), buffer_.begin(), buffer_.end());
+  keys.insert(keys.end(), other.buffer_.begin(), other.buffer_.end());
+  buffer_.clear();
+  std::sort(keys.begin(), keys.end());
+  KeepMaxRankPerIndex(&keys);
+  MergeSorted(keys);
+}
+
+void SparseRegisters::Fold(int precision) {
+  assert(precision >= HLL_MIN_PRECISION);
+  assert(precision <= kPrecision);
+  precision_ = precision;
+  buffer_capacity_ = BufferCapacity(precision);
+  if (buffer_.size() >= buffer_capacity_) {
+    Flush();
+  }
+}
+
+void SparseRegisters::Clear() {
+  list_.clear();
+  buffer_.clear();
+  list_count_ = 0;
+}
+
+void SparseRegisters::Flush() {
+  if (buffer_.empty()) {
+    return;
+  }
+  std::sort(buffer_.begin(), buffer_.end());
+  KeepMaxRankPerIndex(&buffer_);
+  MergeSorted(buffer_);
+  buffer_.clear();
+}
+
+int SparseRegisters::DistinctIndices() {
+  Flush();
+  return list_count_;
+}
+
+const std::vector<uint8_t>& SparseRegisters::EncodedList() {
+  Flush();
+  return list_;
+}
+
+bool SparseRegisters::LoadEncodedList(const uint8_t* data, size_t size,
+                                      int count) {
+  if (!ValidEncodedList(data, size, count)) {
+    return false;
+  }
+  list_.assign(data, data + size);
+  list_count_ = count;
+  buffer_.clear();
+  return true;
+}
+
+bool SparseRegisters::MergeEncodedList(const uint8_t* data, size_t size,
+                                       int count) {
+  // The keys of the list are already sorted, with one per index, so they
+  // can be merged into the main list directly. Every key takes at least a
+  // byte, which bounds the space needed whatever 'count' claims.
+  std::vector<uint32_t> keys;
+  keys.reserve(std::min(static_cast<size_t>(count), size));
+  if (!ForEachEncodedKey(data, size, KeyCollector(&keys)) ||
+      (keys.size() != static_cast<size_t>(count))) {
+    return false;
+  }
+  Flush();
+  MergeSorted(keys);
+  return true;
+}
+
+bool SparseRegisters::ValidEncodedList(const uint8_t* data, size_t size,
+                                       int count) {
+  int keys = 0;
+  return ForEachEncodedKey(data, size, KeyCounter(&keys)) && (keys == count);
+}
+
+size_t SparseRegisters::SizeInBytes() const {
+  return list_.size() + (buffer_capacity_ * sizeof(buffer_[0]));
+}
+
+void SparseRegisters::Decode(std::vector<uint32_t>* keys) const {
+  keys->clear();
+  keys->reserve(list_count_);
+  uint32_t key = 0;
+  size_t pos = 0;
+  while (pos < list_.size()) {
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = list_[pos++];
+      delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    key += delta;
+    keys->push_back(key);
+  }
+}
+
+void SparseRegisters::Encode(const std::vector<uint32_t>& keys) {
+  list_.clear();
+  uint32_t last = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    uint32_t delta = keys[i] - last;
+    last = keys[i];
+    while (delta >= 0x80) {
+      list_.push_back(static_cast<uint8_t>(delta | 0x80));
+      delta >>= 7;
+    }
+    list_.push_back(static_cast<uint8_t>(delta));
+  }
+  list_count_ = static_cast<int>(keys.size());
+}
+
+void SparseRegisters::MergeSorted(const std::vector<uint32_t>& sorted) {
+  std::vector<uint32_t> current;
+  Decode(&current);
+  std::vector<uint32_t> merged(current.size() + sorted.size());
+  std::merge(current.begin(), current.end(), sorted.begin(), sorted.end(),
+             merged.begin());
+  KeepMaxRankPerIndex(&merged);
+  Encode(merged);
+}
+
+}  // namespace libcount
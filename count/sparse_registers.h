@@ -0,0 +1,238 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef COUNT_SPARSE_REGISTERS_H_
+#define COUNT_SPARSE_REGISTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "count/utility.h"
+
+namespace libcount {
+
+// Sparse register storage, as described in section 5.3 of the HyperLogLog++
+// paper. While a sketch has observed few elements it is much cheaper to keep
+// a list of the (index, rank) pairs that have been seen than to allocate the
+// full array of registers. Pairs are recorded at a higher precision than the
+// dense array, which makes LinearCounting very accurate in the sparse range.
+//
+// Each pair is packed into a 32-bit key of the form (index << 6 | rank), so
+// that sorting the keys orders them by index, then rank. New keys go into an
+// unsorted insertion buffer, which is periodically sorted and merged into
+// the main list. The main list is sorted, holds at most one key per index,
+// and is stored as a sequence of varint-encoded deltas between keys.
+class SparseRegisters {
+ public:
+  // The precision at which sparse indices are recorded.
+  static const int kPrecision = 25;
+
+  // The 'precision' argument is that of the dense register array that the
+  // sparse representation will eventually be converted to.
+  explicit SparseRegisters(int precision);
+
+  // Record the observation of an element. Returns true if the insertion
+  // buffer was merged into the main list as a side effect of the call.
+  bool Update(uint64_t hash);
+
+  // Merge the entries of another instance into this one. Entries are kept
+  // at kPrecision, so the dense precisions of the two may differ.
+  void Merge(const SparseRegisters& other);
+
+  // Change the precision of the dense register array that the entries are
+  // translated to. The entries themselves are unaffected.
+  void Fold(int precision);
+
+  // Merge the insertion buffer into the main list.
+  void Flush();
+
+  // Remove every entry, keeping the storage allocated for them.
+  void Clear();
+
+  // Return the number of distinct sparse indices that have been observed.
+  // Flushes the insertion buffer.
+  int DistinctIndices();
+
+  // Return the number of bytes of storage used by the main list, plus that
+  // of a full insertion buffer.
+  size_t SizeInBytes() const;
+
+  // Invoke 'visitor(index, rank)' for every recorded entry, translated to
+  // the precision of the dense register array. An index may be visited more
+  // than once, so the visitor should retain the maximum rank it sees.
+  template <typename Visitor>
+  void ForEach(Visitor visitor) const;
+
+  // Return the main list, once the insertion buffer has been merged into
+  // it: the varint-encoded differences between successive keys.
+  const std::vector<uint8_t>& EncodedList();
+
+  // Replace the contents of the object with an encoded list of 'count'
+  // keys, such as one returned by EncodedList(). Returns false, leaving the
+  // object unchanged, if the list is malformed.
+  bool LoadEncodedList(const uint8_t* data, size_t size, int count);
+
+  // Merge an encoded list of 'count' keys into the object. Returns false,
+  // leaving the object unchanged, if the list is malformed.
+  bool MergeEncodedList(const uint8_t* data, size_t size, int count);
+
+  // Return true if 'data' holds a well-formed encoded list of 'count' keys.
+  static bool ValidEncodedList(const uint8_t* data, size_t size, int count);
+
+  // Invoke 'visitor(key)' for each key of an encoded list, in order.
+  // Returns false if the list is malformed: truncated, not in strictly
+  // ascending order of index, or holding keys out of range. In that case
+  // the visitor may have seen some of the keys.
+  template <typename Visitor>
+  static bool ForEachEncodedKey(const uint8_t* data, size_t size,
+                                Visitor visitor);
+
+  // Invoke 'visitor(index, rank)' for each key of an encoded list, as
+  // translated to a dense register array of the given precision. The list
+  // must be well-formed (see ValidEncodedList()).
+  template <typename Visitor>
+  static void ForEachEncodedEntry(const uint8_t* data, size_t size,
+                                  int precision, Visitor visitor);
+
+ private:
+  // Translate a sparse key to the register index, rank at dense precision.
+  static int DenseIndexOf(uint32_t key, int precision);
+  static uint8_t DenseRankOf(uint32_t key, int precision);
+
+  // Adapts a visitor of (index, rank) entries to one of keys.
+  template <typename Visitor>
+  struct EntryVisitor;
+
+  // Decode the main list into a vector of keys, in ascending order.
+  void Decode(std::vector<uint32_t>* keys) const;
+
+  // Replace the main list with the sorted, de-duplicated keys given.
+  void Encode(const std::vector<uint32_t>& keys);
+
+  // Merge a sorted buffer of keys into the main list.
+  void MergeSorted(const std::vector<uint32_t>& sorted);
+
+  int precision_;
+  size_t buffer_capacity_;
+  int list_count_;
+  std::vector<uint8_t> list_;
+  std::vector<uint32_t> buffer_;
+};
+
+inline int SparseRegisters::DenseIndexOf(uint32_t key, int precision) {
+  return static_cast<int>(key >> (6 + kPrecision - precision));
+}
+
+inline uint8_t SparseRegisters::DenseRankOf(uint32_t key, int precision) {
+  // The bits of the sparse index beyond the dense index are the leading bits
+  // of the dense rank; if any of them are set, the rank is determined by
+  // them alone. Otherwise, the sparse rank is offset by their count.
+  const int extra_bits = kPrecision - precision;
+  const uint32_t extra = (key >> 6) & ((1u << extra_bits) - 1u);
+  if (extra != 0) {
+    const int width = 64 - CountLeadingZeroes(extra);
+    return static_cast<uint8_t>(extra_bits - width + 1);
+  }
+  return static_cast<uint8_t>((key & 0x3F) + extra_bits);
+}
+
+template <typename Visitor>
+void SparseRegisters::ForEach(Visitor visitor) const {
+  uint32_t key = 0;
+  size_t pos = 0;
+  while (pos < list_.size()) {
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = list_[pos++];
+      delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    key += delta;
+    visitor(DenseIndexOf(key, precision_), DenseRankOf(key, precision_));
+  }
+  for (size_t i = 0; i < buffer_.size(); ++i) {
+    const uint32_t key = buffer_[i];
+    visitor(DenseIndexOf(key, precision_), DenseRankOf(key, precision_));
+  }
+}
+
+template <typename Visitor>
+struct SparseRegisters::EntryVisitor {
+  EntryVisitor(int precision, Visitor visitor)
+      : precision_(precision), visitor_(visitor) {}
+  void operator()(uint32_t key) {
+    visitor_(DenseIndexOf(key, precision_), DenseRankOf(key, precision_));
+  }
+  int precision_;
+  Visitor visitor_;
+};
+
+template <typename Visitor>
+bool SparseRegisters::ForEachEncodedKey(const uint8_t* data, size_t size,
+                                        Visitor visitor) {
+  const uint32_t kKeyLimit = uint32_t(1) << (kPrecision + 6);
+  const uint32_t kMaxRank = 64 - kPrecision + 1;
+  uint32_t key = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    uint32_t delta = 0;
+    int shift = 0;
+    uint8_t byte = 0;
+    do {
+      // Keys fit in 31 bits, so no delta takes more than five bytes.
+      if ((pos == size) || (shift > 28)) {
+        return false;
+      }
+      byte = data[pos++];
+      // The fifth byte has room for only the top four bits of a key, and
+      // must end the delta.
+      if ((shift == 28) && (byte > 0x0F)) {
+        return false;
+      }
+      delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+
+    // Each key must be for a greater index than the last, and in range.
+    const uint32_t last = key;
+    if ((delta >= kKeyLimit) || (key + delta >= kKeyLimit)) {
+      return false;
+    }
+    key += delta;
+    if ((last != 0) && ((key >> 6) <= (last >> 6))) {
+      return false;
+    }
+    const uint32_t rank = key & 0x3F;
+    if ((rank == 0) || (rank > kMaxRank)) {
+      return false;
+    }
+    visitor(key);
+  }
+  return true;
+}
+
+template <typename Visitor>
+void SparseRegisters::ForEachEncodedEntry(const uint8_t* data, size_t size,
+                                          int precision, Visitor visitor) {
+  ForEachEncodedKey(data, size, EntryVisitor<Visitor>(precision, visitor));
+}
+
+}  // namespace libcount
+
+#endif  // COUNT_SPARSE_REGISTERS_H_
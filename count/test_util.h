@@ -0,0 +1,66 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+// Helpers shared by the unit tests. Not part of the library.
+
+#ifndef COUNT_TEST_UTIL_H_
+#define COUNT_TEST_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Report the failing condition and bail out of the enclosing test.
+#define EXPECT(condition)                                               \
+  do {                                                                  \
+    if (!(condition)) {                                                 \
+      fprintf(stderr, "%s:%d: expected: %s\n", __FILE__, __LINE__,      \
+              #condition);                                              \
+      return false;                                                     \
+    }                                                                   \
+  } while (0)
+
+// A simple, well-mixed 64-bit hash (the SplitMix64 finalizer) suitable for
+// exercising the estimator without pulling in a cryptographic library.
+inline uint64_t Hash(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// A source of test keys: the SplitMix64 generator, whose outputs are the
+// hashes of successive states.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    const uint64_t x = Hash(state_);
+    state_ += 0x9E3779B97F4A7C15ULL;
+    return x;
+  }
+
+  void Fill(uint8_t* bytes, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+      bytes[i] = static_cast<uint8_t>(Next());
+    }
+  }
+
+ private:
+  uint64_t state_;
+};
+
+#endif  // COUNT_TEST_UTIL_H_
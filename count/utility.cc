@@ -19,7 +19,7 @@
 
 namespace libcount {
 
-uint8_t CountLeadingZeroes(uint64_t x) {
+uint8_t CountLeadingZeroesPortable(uint64_t x) {
   uint64_t y = 0;
   uint64_t n = 64;
   y = x >> 32;
@@ -54,6 +54,14 @@ uint8_t CountLeadingZeroes(uint64_t x) {
   return static_cast<uint8_t>(n - x);
 }
 
+int PopCountPortable(uint64_t x) {
+  // Sum the bits in pairs, then nibbles, then add up the bytes.
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+}
+
 bool IsDoubleEqual(double a, double b, double epsilon) {
   return (fabs(a - b) < epsilon);
 }
@@ -18,10 +18,27 @@
 
 #include <stdint.h>
 
+#include "count/hll_rank.h"
+
 namespace libcount {
 
-// Return the number of leading zero bits in the unsigned value.
-uint8_t CountLeadingZeroes(uint64_t value);
+// Return the number of leading zero bits in the unsigned value; 64 if the
+// value is zero. This is a single instruction on most CPUs.
+inline uint8_t CountLeadingZeroes(uint64_t value);
+
+// Portable implementation of CountLeadingZeroes(), used where no compiler
+// intrinsic is available. Exposed for testing.
+uint8_t CountLeadingZeroesPortable(uint64_t value);
+
+// Return the number of set bits in the value.
+inline int PopCount(uint64_t value);
+
+// Portable implementation of PopCount(). Exposed for testing.
+int PopCountPortable(uint64_t value);
+
+// Hint that the cache line holding 'address' will soon be written. Does
+// nothing where the compiler has no prefetch intrinsic.
+inline void PrefetchForWrite(const void* address);
 
 // Equality test for doubles. Returns true if ((a - b) < epsilon).
 bool IsDoubleEqual(double a, double b, double epsilon);
@@ -37,6 +54,30 @@ bool MaybeAssign(Type* dest, const Type& src) {
   return false;
 }
 
+inline uint8_t CountLeadingZeroes(uint64_t value) {
+#if defined(__GNUC__)
+  return (value == 0) ? 64 : static_cast<uint8_t>(__builtin_clzll(value));
+#else
+  return CountLeadingZeroesPortable(value);
+#endif
+}
+
+inline int PopCount(uint64_t value) {
+#if defined(__GNUC__)
+  return __builtin_popcountll(value);
+#else
+  return PopCountPortable(value);
+#endif
+}
+
+inline void PrefetchForWrite(const void* address) {
+#if defined(__GNUC__)
+  __builtin_prefetch(address, 1);
+#else
+  (void)address;
+#endif
+}
+
 }  // namespace libcount
 
 #endif  // COUNT_UTILITY_H_
@@ -0,0 +1,105 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#include "count/utility.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "count/hll_limits.h"
+#include "count/test_util.h"
+
+using libcount::CountLeadingZeroes;
+using libcount::CountLeadingZeroesPortable;
+using libcount::HLL_MAX_PRECISION;
+using libcount::HLL_MIN_PRECISION;
+using libcount::IndexAndRankOf;
+using libcount::PopCount;
+using libcount::PopCountPortable;
+
+// Return an arbitrary value with exactly 'zeroes' leading zero bits.
+uint64_t WithLeadingZeroes(int zeroes, uint64_t noise) {
+  if (zeroes == 64) {
+    return 0;
+  }
+  const uint64_t top = uint64_t(1) << (63 - zeroes);
+  return top | (noise & (top - 1));
+}
+
+// The intrinsic and portable implementations must agree, including at zero.
+bool TestCountLeadingZeroes() {
+  uint64_t noise = 0x0123456789ABCDEFULL;
+  for (int zeroes = 0; zeroes <= 64; ++zeroes) {
+    for (int i = 0; i < 16; ++i) {
+      noise = noise * 6364136223846793005ULL + 1442695040888963407ULL;
+      const uint64_t value = WithLeadingZeroes(zeroes, noise);
+      EXPECT(CountLeadingZeroes(value) == zeroes);
+      EXPECT(CountLeadingZeroesPortable(value) == zeroes);
+    }
+  }
+  return true;
+}
+
+// The intrinsic and portable population counts must agree with a count
+// taken bit by bit.
+bool TestPopCount() {
+  uint64_t noise = 0x0123456789ABCDEFULL;
+  for (int i = 0; i < 1000; ++i) {
+    noise = noise * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint64_t value = (i < 2) ? -uint64_t(i) : noise;
+    int expected = 0;
+    for (int bit = 0; bit < 64; ++bit) {
+      expected += static_cast<int>((value >> bit) & 1);
+    }
+    EXPECT(PopCount(value) == expected);
+    EXPECT(PopCountPortable(value) == expected);
+  }
+  return true;
+}
+
+// The fused index and rank must match those computed the long way: the
+// leading bits, and one more than the leading zeroes of the rest, capped at
+// the number of bits remaining.
+bool TestIndexAndRankOf() {
+  uint64_t noise = 0xFEDCBA9876543210ULL;
+  const int kPrecisions[] = {HLL_MIN_PRECISION, 12, HLL_MAX_PRECISION, 25};
+  for (size_t p = 0; p < sizeof(kPrecisions) / sizeof(int); ++p) {
+    const int precision = kPrecisions[p];
+    for (int zeroes = 0; zeroes <= 64; ++zeroes) {
+      noise = noise * 6364136223846793005ULL + 1442695040888963407ULL;
+      const uint64_t rest = WithLeadingZeroes(zeroes, noise) >> precision;
+      const uint64_t hash = (noise & ~(~uint64_t(0) >> precision)) | rest;
+      const int expected_index = static_cast<int>(hash >> (64 - precision));
+      const int remaining = 64 - precision;
+      const int leading = CountLeadingZeroes(rest) - precision;
+      const int expected_rank = ((rest == 0) ? remaining : leading) + 1;
+      int index;
+      uint8_t rank;
+      IndexAndRankOf(hash, precision, &index, &rank);
+      EXPECT(index == expected_index);
+      EXPECT(rank == expected_rank);
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool ok = true;
+  ok = TestCountLeadingZeroes() && ok;
+  ok = TestPopCount() && ok;
+  ok = TestIndexAndRankOf() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
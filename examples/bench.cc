@@ -0,0 +1,850 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+// Microbenchmarks for the hot paths of libcount. For meaningful numbers,
+// build with optimizations, e.g.: make bench OPT="-O3 -DNDEBUG"
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "count/concurrent_hll.h"
+#include "count/empirical_data.h"
+#include "count/fixed_hll.h"
+#include "count/hash.h"
+#include "count/hll.h"
+#include "count/hll_archive.h"
+#include "count/hll_data.h"
+#include "count/hll_options.h"
+#include "count/hll_pool.h"
+#include "count/kernels.h"
+#include "count/sharded_hll.h"
+
+using libcount::ConcurrentHLL;
+using libcount::EmpiricalBias;
+using libcount::FixedHLL;
+using libcount::GetMaxBytesKernel;
+using libcount::HLL;
+using libcount::HashBytes;
+using libcount::HashU64;
+using libcount::HLLArchive;
+using libcount::HLLArchiveWriter;
+using libcount::HLLPool;
+using libcount::HLLView;
+using libcount::HLL_LAYOUT_BYTE;
+using libcount::HLL_LAYOUT_PACKED4;
+using libcount::HLL_LAYOUT_PACKED6;
+using libcount::HLL_OPTION_DENSE;
+using libcount::HLL_OPTION_INCREMENTAL;
+using libcount::HLL_OPTION_SNAPSHOT;
+using libcount::ShardedHLL;
+
+// The SplitMix64 finalizer; cheap, and good enough to drive the benchmarks.
+uint64_t Hash(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// Return a monotonic timestamp, in seconds.
+double Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+// Prevent the compiler from discarding results that are otherwise unused.
+volatile uint64_t sink;
+
+// Compare calling Update() in a loop against a single UpdateBatch() call.
+void BenchUpdate() {
+  const size_t kHashes = 1 << 22;
+  const int kRounds = 8;
+  uint64_t* hashes = new uint64_t[kHashes];
+  for (size_t i = 0; i < kHashes; ++i) {
+    hashes[i] = Hash(i);
+  }
+
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6};
+  const char* kLayoutNames[] = {"byte", "packed6"};
+  for (int l = 0; l < 2; ++l) {
+    for (int p = 12; p <= 18; p += 2) {
+      HLL* single = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+      HLL* batch = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+
+      double start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        for (size_t i = 0; i < kHashes; ++i) {
+          single->Update(hashes[i]);
+        }
+      }
+      const double single_ns = (Now() - start) * 1e9 / (kRounds * kHashes);
+
+      start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        batch->UpdateBatch(hashes, kHashes);
+      }
+      const double batch_ns = (Now() - start) * 1e9 / (kRounds * kHashes);
+
+      sink = single->Estimate() + batch->Estimate();
+      printf("update   %-8s p=%2d  Update: %6.2f ns  UpdateBatch: %6.2f ns"
+             "  speedup: %4.2fx\n",
+             kLayoutNames[l], p, single_ns, batch_ns, single_ns / batch_ns);
+      delete single;
+      delete batch;
+    }
+  }
+  delete[] hashes;
+}
+
+// Compare updates of a FixedHLL against those of an HLL of the same
+// precision, at the two precisions most often used for small counters.
+template <int P>
+void BenchFixedUpdate(const uint64_t* hashes, size_t n, int rounds) {
+  HLL* hll = HLL::Create(P, HLL_OPTION_DENSE, NULL);
+  FixedHLL<P>* fixed = new FixedHLL<P>;
+
+  double start = Now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < n; ++i) {
+      hll->Update(hashes[i]);
+    }
+  }
+  const double hll_ns = (Now() - start) * 1e9 / (rounds * n);
+
+  start = Now();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < n; ++i) {
+      fixed->Update(hashes[i]);
+    }
+  }
+  const double fixed_ns = (Now() - start) * 1e9 / (rounds * n);
+
+  sink = hll->Estimate() + fixed->Estimate();
+  printf("fixed    p=%2d  HLL::Update: %6.2f ns  FixedHLL::Update: %6.2f ns"
+         "  speedup: %4.2fx\n",
+         P, hll_ns, fixed_ns, hll_ns / fixed_ns);
+  delete hll;
+  delete fixed;
+}
+
+void BenchFixed() {
+  const size_t kHashes = 1 << 22;
+  uint64_t* hashes = new uint64_t[kHashes];
+  for (size_t i = 0; i < kHashes; ++i) {
+    hashes[i] = Hash(i);
+  }
+  BenchFixedUpdate<12>(hashes, kHashes, 8);
+  BenchFixedUpdate<14>(hashes, kHashes, 8);
+  delete[] hashes;
+}
+
+// Compare each byte-wise max kernel used by Merge() at typical sizes.
+void BenchMerge() {
+  const libcount::KernelIsa kIsas[] = {
+      libcount::KERNEL_SCALAR, libcount::KERNEL_SSE2, libcount::KERNEL_AVX2,
+      libcount::KERNEL_AVX512BW};
+  const char* kIsaNames[] = {"scalar", "sse2", "avx2", "avx512bw"};
+  for (int p = 14; p <= 16; ++p) {
+    const size_t size = size_t(1) << p;
+    const int kRounds = (1 << 28) / size;
+    uint8_t* dest = new uint8_t[size];
+    uint8_t* src = new uint8_t[size];
+    for (size_t i = 0; i < size; ++i) {
+      dest[i] = Hash(i) % 20;
+      src[i] = Hash(i + size) % 20;
+    }
+    double scalar_ns = 0.0;
+    for (int k = 0; k < 4; ++k) {
+      libcount::MaxBytesKernel kernel = GetMaxBytesKernel(kIsas[k]);
+      if (kernel == NULL) {
+        continue;
+      }
+      const double start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        kernel(dest, src, size);
+      }
+      const double ns = (Now() - start) * 1e9 / kRounds;
+      if (k == 0) {
+        scalar_ns = ns;
+      }
+      sink = dest[size / 2];
+      printf("merge    %-8s p=%2d  %9.0f ns/merge  speedup: %5.2fx\n",
+             kIsaNames[k], p, ns, scalar_ns / ns);
+    }
+    delete[] dest;
+    delete[] src;
+  }
+}
+
+// Compare MergeMany() with a Merge() call per source, for many dense
+// sources of the largest precision.
+void BenchMergeMany() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6};
+  const char* kLayoutNames[] = {"byte", "packed6"};
+  const int kPrecision = 18;
+  const int kSources = 400;
+  const int cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  for (int l = 0; l < 2; ++l) {
+    const int options = kLayouts[l] | HLL_OPTION_DENSE;
+    std::vector<HLL*> sources(kSources);
+    for (int i = 0; i < kSources; ++i) {
+      sources[i] = HLL::Create(kPrecision, options, NULL);
+      for (uint64_t j = 0; j < 20000; ++j) {
+        sources[i]->Update(Hash(i * 20000 + j));
+      }
+    }
+    // The best of a few rounds of each.
+    HLL* hll = HLL::Create(kPrecision, options, NULL);
+    double merge_us = 1e9;
+    double many_us = 1e9;
+    double threads_us = 1e9;
+    for (int r = 0; r < 3; ++r) {
+      double start = Now();
+      for (int i = 0; i < kSources; ++i) {
+        hll->Merge(sources[i]);
+      }
+      merge_us = std::min(merge_us, (Now() - start) * 1e6 / kSources);
+      start = Now();
+      hll->MergeMany(&sources[0], kSources);
+      many_us = std::min(many_us, (Now() - start) * 1e6 / kSources);
+      start = Now();
+      hll->MergeMany(&sources[0], kSources, std::max(cores, 1));
+      threads_us = std::min(threads_us, (Now() - start) * 1e6 / kSources);
+    }
+    sink = hll->Estimate();
+    printf("mergemany %-7s p=%2d  Merge: %6.2f us/source  MergeMany: %6.2f"
+           "  with %d threads: %6.2f\n",
+           kLayoutNames[l], kPrecision, merge_us, many_us,
+           std::max(cores, 1), threads_us);
+    delete hll;
+    for (int i = 0; i < kSources; ++i) {
+      delete sources[i];
+    }
+  }
+}
+
+// Compare Estimate() on full sketches against the raw estimate computed the
+// way it used to be: a call to pow() and a zero test per register.
+void BenchEstimate() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6,
+                          HLL_LAYOUT_PACKED4,
+                          HLL_LAYOUT_BYTE | HLL_OPTION_INCREMENTAL};
+  const char* kLayoutNames[] = {"byte", "packed6", "packed4", "byte+inc"};
+  for (int p = 14; p <= 18; p += 2) {
+    const int register_count = 1 << p;
+    const int kRounds = (1 << 26) / register_count;
+    uint8_t* registers = new uint8_t[register_count];
+    for (int i = 0; i < register_count; ++i) {
+      registers[i] = 1 + __builtin_ctzll(Hash(i) | (1ULL << 40)) % 20;
+    }
+    double start = Now();
+    for (int r = 0; r < kRounds; ++r) {
+      double sum = 0.0;
+      int zeroes = 0;
+      for (int i = 0; i < register_count; ++i) {
+        sum += 1.0 / pow(2.0, registers[i]);
+        zeroes += (registers[i] == 0);
+      }
+      sink = static_cast<uint64_t>(sum) + zeroes;
+    }
+    const double pow_ns = (Now() - start) * 1e9 / kRounds;
+    printf("estimate %-8s p=%2d  %9.0f ns/estimate\n", "pow", p, pow_ns);
+    delete[] registers;
+
+    for (int l = 0; l < 4; ++l) {
+      HLL* hll = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+      for (int i = 0; i < 8 * register_count; ++i) {
+        hll->Update(Hash(i));
+      }
+      start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        sink = hll->Estimate();
+      }
+      const double ns = (Now() - start) * 1e9 / kRounds;
+      printf("estimate %-8s p=%2d  %9.0f ns/estimate  speedup: %5.2fx\n",
+             kLayoutNames[l], p, ns, pow_ns / ns);
+      delete hll;
+    }
+  }
+}
+
+// The bias lookup as it used to be done: count the valid table entries, then
+// scan for the pair of entries that straddle the raw estimate.
+double LinearScanBias(double raw_estimate, int precision) {
+  const double* const estimates = ESTIMATE_DATA[precision - 4];
+  const double* const biases = BIAS_DATA[precision - 4];
+  const int size = libcount::ValidTableEntries(estimates, 201);
+  int rhs = 0;
+  while ((rhs < size) && (estimates[rhs] <= raw_estimate)) {
+    ++rhs;
+  }
+  if (rhs == 0) {
+    return biases[0];
+  } else if (rhs == size) {
+    return biases[size - 1];
+  }
+  const double scale = (raw_estimate - estimates[rhs - 1]) /
+                       (estimates[rhs] - estimates[rhs - 1]);
+  return biases[rhs - 1] + scale * (biases[rhs] - biases[rhs - 1]);
+}
+
+// Compare the indexed bias lookup against the linear scan, for raw estimates
+// spread over the range where bias correction applies.
+void BenchBias() {
+  const int kLookups = 1 << 20;
+  double* raw_estimates = new double[kLookups];
+  for (int p = 10; p <= 18; p += 4) {
+    const double limit = 5.0 * (1 << p);
+    for (int i = 0; i < kLookups; ++i) {
+      raw_estimates[i] = limit * (Hash(i) >> 11) * (1.0 / (1ULL << 53));
+    }
+    double sum = 0.0;
+    double start = Now();
+    for (int i = 0; i < kLookups; ++i) {
+      sum += LinearScanBias(raw_estimates[i], p);
+    }
+    const double scan_ns = (Now() - start) * 1e9 / kLookups;
+    start = Now();
+    for (int i = 0; i < kLookups; ++i) {
+      sum += EmpiricalBias(raw_estimates[i], p);
+    }
+    const double indexed_ns = (Now() - start) * 1e9 / kLookups;
+    sink = static_cast<uint64_t>(sum);
+    printf("bias     p=%2d  scan: %6.1f ns  indexed: %6.1f ns"
+           "  speedup: %5.2fx\n",
+           p, scan_ns, indexed_ns, scan_ns / indexed_ns);
+  }
+  delete[] raw_estimates;
+}
+
+// Measure serialization and deserialization of dense objects, in terms of
+// the size of the serialized form.
+void BenchSerialize() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6};
+  const char* kLayoutNames[] = {"byte", "packed6"};
+  for (int l = 0; l < 2; ++l) {
+    for (int p = 14; p <= 18; p += 2) {
+      HLL* hll = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+      for (int i = 0; i < (8 << p); ++i) {
+        hll->Update(Hash(i));
+      }
+      const size_t size = hll->SerializedSize();
+      uint8_t* buffer = new uint8_t[size];
+      const int kRounds = (1 << 28) / size;
+
+      double start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        hll->Serialize(buffer, size);
+      }
+      const double serialize_s = (Now() - start) / kRounds;
+
+      start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        delete HLL::Deserialize(buffer, size, NULL);
+      }
+      const double deserialize_s = (Now() - start) / kRounds;
+
+      printf("serial   %-8s p=%2d  Serialize: %5.2f GB/s"
+             "  Deserialize: %5.2f GB/s\n",
+             kLayoutNames[l], p, size / serialize_s * 1e-9,
+             size / deserialize_s * 1e-9);
+      delete[] buffer;
+      delete hll;
+    }
+  }
+}
+
+void BenchMergeSerialized() {
+  const int kLayouts[] = {HLL_LAYOUT_BYTE, HLL_LAYOUT_PACKED6};
+  const char* kLayoutNames[] = {"byte", "packed6"};
+  for (int l = 0; l < 2; ++l) {
+    for (int p = 14; p <= 18; p += 2) {
+      HLL* source = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+      HLL* target = HLL::Create(p, kLayouts[l] | HLL_OPTION_DENSE, NULL);
+      for (int i = 0; i < (8 << p); ++i) {
+        source->Update(Hash(i));
+      }
+      const size_t size = source->SerializedSize();
+      uint8_t* buffer = new uint8_t[size];
+      source->Serialize(buffer, size);
+      const int kRounds = (1 << 28) / size;
+
+      double start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        HLL* copy = HLL::Deserialize(buffer, size, NULL);
+        target->Merge(copy);
+        delete copy;
+      }
+      const double copy_s = (Now() - start) / kRounds;
+
+      start = Now();
+      for (int r = 0; r < kRounds; ++r) {
+        target->MergeSerialized(buffer, size);
+      }
+      const double direct_s = (Now() - start) / kRounds;
+
+      printf("merge-serialized %-8s p=%2d  Deserialize+Merge: %5.2f GB/s"
+             "  MergeSerialized: %5.2f GB/s\n",
+             kLayoutNames[l], p, size / copy_s * 1e-9,
+             size / direct_s * 1e-9);
+      delete[] buffer;
+      delete target;
+      delete source;
+    }
+  }
+}
+
+// Compare updates of an object whose registers are mapped from a file with
+// those of one in memory, and time checkpoints of the mapped object.
+void BenchMapped() {
+  const size_t kHashes = 1 << 22;
+  const int kPrecision = 16;
+  const char* const kPath = "bench_registers.tmp";
+  remove(kPath);
+  HLL* mapped = HLL::CreateMapped(kPath, kPrecision, HLL_LAYOUT_BYTE);
+  HLL* memory = HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL);
+
+  double start = Now();
+  for (size_t i = 0; i < kHashes; ++i) {
+    memory->Update(Hash(i));
+  }
+  const double memory_ns = (Now() - start) * 1e9 / kHashes;
+  start = Now();
+  for (size_t i = 0; i < kHashes; ++i) {
+    mapped->Update(Hash(i));
+  }
+  const double mapped_ns = (Now() - start) * 1e9 / kHashes;
+
+  // A checkpoint after a full pass, and one with nothing to write.
+  start = Now();
+  mapped->Checkpoint();
+  const double full_ms = (Now() - start) * 1e3;
+  start = Now();
+  mapped->Checkpoint();
+  const double clean_ms = (Now() - start) * 1e3;
+
+  sink = mapped->Estimate() + memory->Estimate();
+  printf("mapped   byte     p=%2d  Update: %5.2f ns (in memory: %5.2f ns)"
+         "  Checkpoint: %.2f ms, clean: %.2f ms\n",
+         kPrecision, mapped_ns, memory_ns, full_ms, clean_ms);
+  delete mapped;
+  delete memory;
+  remove(kPath);
+}
+
+// The work of one thread of the concurrency benchmark: update a shared
+// ConcurrentHLL, a ShardedHLL, a shared HLL under a mutex, or a private HLL.
+struct UpdateThread {
+  ConcurrentHLL* concurrent;
+  ShardedHLL* sharded;
+  HLL* hll;
+  pthread_mutex_t* mutex;
+  uint64_t first;
+  uint64_t count;
+};
+
+void* RunUpdateThread(void* arg) {
+  const UpdateThread* work = static_cast<const UpdateThread*>(arg);
+  const uint64_t end = work->first + work->count;
+  if (work->concurrent != NULL) {
+    for (uint64_t i = work->first; i < end; ++i) {
+      work->concurrent->Update(Hash(i));
+    }
+  } else if (work->sharded != NULL) {
+    ShardedHLL::Handle* handle = work->sharded->ThreadHandle();
+    for (uint64_t i = work->first; i < end; ++i) {
+      handle->Update(Hash(i));
+    }
+  } else if (work->mutex != NULL) {
+    for (uint64_t i = work->first; i < end; ++i) {
+      pthread_mutex_lock(work->mutex);
+      work->hll->Update(Hash(i));
+      pthread_mutex_unlock(work->mutex);
+    }
+  } else {
+    for (uint64_t i = work->first; i < end; ++i) {
+      work->hll->Update(Hash(i));
+    }
+  }
+  return NULL;
+}
+
+// Run 'threads' threads of the given kind over 'n' hashes in all, and
+// return the throughput in millions of updates per second. Private sketches
+// are merged at the end, and shards are merged by a final estimate; either
+// is timed with the updates.
+double RunUpdateThreads(int kind, int threads, uint64_t n) {
+  const int kPrecision = 14;
+  ConcurrentHLL* concurrent = ConcurrentHLL::Create(kPrecision);
+  ShardedHLL* sharded = ShardedHLL::Create(kPrecision);
+  HLL* shared = HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL);
+  pthread_mutex_t mutex;
+  pthread_mutex_init(&mutex, NULL);
+  std::vector<pthread_t> ids(threads);
+  std::vector<UpdateThread> work(threads);
+  for (int t = 0; t < threads; ++t) {
+    work[t].concurrent = (kind == 0) ? concurrent : NULL;
+    work[t].sharded = (kind == 1) ? sharded : NULL;
+    work[t].hll = (kind == 3) ? HLL::Create(kPrecision, HLL_OPTION_DENSE, NULL)
+                              : shared;
+    work[t].mutex = (kind == 2) ? &mutex : NULL;
+    work[t].first = t * (n / threads);
+    work[t].count = n / threads;
+  }
+
+  const double start = Now();
+  for (int t = 0; t < threads; ++t) {
+    pthread_create(&ids[t], NULL, RunUpdateThread, &work[t]);
+  }
+  for (int t = 0; t < threads; ++t) {
+    pthread_join(ids[t], NULL);
+    if (kind == 3) {
+      shared->Merge(work[t].hll);
+      delete work[t].hll;
+    }
+  }
+  sink = sharded->Estimate();
+  const double seconds = Now() - start;
+
+  sink = concurrent->Estimate() + shared->Estimate();
+  pthread_mutex_destroy(&mutex);
+  delete shared;
+  delete sharded;
+  delete concurrent;
+  return n / seconds * 1e-6;
+}
+
+// Compare the scaling of a shared ConcurrentHLL and of a ShardedHLL with
+// that of a shared HLL under a mutex, and of a private HLL per thread, from
+// one thread up to one per core.
+void BenchConcurrent() {
+  const uint64_t kHashes = uint64_t(1) << 24;
+  const int cores = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  for (int threads = 1;; threads *= 2) {
+    threads = std::min(threads, std::max(cores, 1));
+    printf("threads  %2d  ConcurrentHLL: %6.1f M/s  ShardedHLL: %6.1f M/s"
+           "  mutex: %6.1f M/s  per-thread: %6.1f M/s\n",
+           threads, RunUpdateThreads(0, threads, kHashes),
+           RunUpdateThreads(1, threads, kHashes),
+           RunUpdateThreads(2, threads, kHashes),
+           RunUpdateThreads(3, threads, kHashes));
+    if (threads >= cores) {
+      break;
+    }
+  }
+}
+
+// Time a point-in-time Snapshot() of a ConcurrentHLL against a plain copy of
+// as many bytes.
+void BenchSnapshot() {
+  const int kPrecision = 14;
+  const int kRounds = 20000;
+  ConcurrentHLL* concurrent =
+      ConcurrentHLL::Create(kPrecision, HLL_OPTION_SNAPSHOT);
+  for (uint64_t i = 0; i < 1000000; ++i) {
+    concurrent->Update(Hash(i));
+  }
+  std::vector<uint8_t> source(1 << kPrecision, 1);
+  std::vector<uint8_t> registers(1 << kPrecision);
+
+  double start = Now();
+  for (int r = 0; r < kRounds; ++r) {
+    concurrent->Snapshot(&registers[0]);
+    sink = registers[r % registers.size()];
+  }
+  const double snapshot_us = (Now() - start) * 1e6 / kRounds;
+  start = Now();
+  for (int r = 0; r < kRounds; ++r) {
+    source[r % source.size()] = static_cast<uint8_t>(r);
+    memcpy(&registers[0], &source[0], registers.size());
+    sink = registers[(r * 7) % registers.size()];
+  }
+  const double memcpy_us = (Now() - start) * 1e6 / kRounds;
+
+  printf("snapshot          p=%2d  Snapshot: %.2f us  (memcpy: %.2f us)\n",
+         kPrecision, snapshot_us, memcpy_us);
+  delete concurrent;
+}
+
+// Write an archive of sketches, then time opening it, and looking up and
+// estimating sketches at random. The first lookups fault in their pages.
+void BenchArchive() {
+  const int kPrecision = 14;
+  const int kSketches = 8192;
+  const char* const kPath = "bench_archive.tmp";
+  HLLArchiveWriter* writer = HLLArchiveWriter::Create(kPath, kPrecision);
+  FixedHLL<kPrecision> fixed;
+  for (int s = 0; s < kSketches; ++s) {
+    fixed.Update(Hash(s));
+    writer->Add(Hash(s), fixed.registers());
+  }
+  writer->Finish();
+  delete writer;
+
+  double start = Now();
+  HLLArchive* archive = HLLArchive::Open(kPath);
+  const double open_s = Now() - start;
+
+  const int kLookups = 1000;
+  uint64_t total = 0;
+  start = Now();
+  for (int i = 0; i < kLookups; ++i) {
+    HLLView view;
+    if (archive->Find(Hash(Hash(i) % kSketches), &view)) {
+      total += view.Estimate();
+    }
+  }
+  const double lookup_s = (Now() - start) / kLookups;
+  sink = total;
+
+  printf("archive  %d x p=%d (%.0f MB)  Open: %.1f us"
+         "  Find+Estimate: %.1f us\n",
+         kSketches, kPrecision, kSketches * (1 << kPrecision) * 1e-6,
+         open_s * 1e6, lookup_s * 1e6);
+  delete archive;
+  remove(kPath);
+}
+
+// Return the number of bytes allocated from the heap, chunk overhead
+// included, where the C library can tell; 0 otherwise.
+size_t HeapBytes() {
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// Compare creating, updating and freeing a large population of sketches
+// one at a time on the heap and from a pool, and the memory they take. The
+// second of two rounds is reported, so that neither pays for faulting in
+// fresh pages.
+void BenchPool() {
+  const int kPrecisions[] = {8, 12};
+  const int kSketches = 100000;
+  std::vector<HLL*> sketches(kSketches);
+  for (size_t i = 0; i < sizeof(kPrecisions) / sizeof(int); ++i) {
+    const int p = kPrecisions[i];
+    double heap_ns = 0.0;
+    double heap_free_ns = 0.0;
+    double pool_ns = 0.0;
+    double pool_free_ns = 0.0;
+    size_t heap_bytes = 0;
+    size_t pool_bytes = 0;
+    for (int round = 0; round < 2; ++round) {
+      size_t before = HeapBytes();
+      double start = Now();
+      for (int s = 0; s < kSketches; ++s) {
+        sketches[s] = HLL::Create(p, HLL_OPTION_DENSE, NULL);
+        sketches[s]->Update(Hash(s));
+      }
+      heap_ns = (Now() - start) * 1e9 / kSketches;
+      heap_bytes = HeapBytes() - before;
+      start = Now();
+      for (int s = 0; s < kSketches; ++s) {
+        delete sketches[s];
+      }
+      heap_free_ns = (Now() - start) * 1e9 / kSketches;
+
+      before = HeapBytes();
+      HLLPool* pool = HLLPool::Create(p, HLL_LAYOUT_BYTE);
+      start = Now();
+      for (int s = 0; s < kSketches; ++s) {
+        sketches[s] = pool->Allocate();
+        sketches[s]->Update(Hash(s));
+      }
+      pool_ns = (Now() - start) * 1e9 / kSketches;
+      pool_bytes = HeapBytes() - before;
+      start = Now();
+      for (int s = 0; s < kSketches; ++s) {
+        pool->Free(sketches[s]);
+      }
+      pool_free_ns = (Now() - start) * 1e9 / kSketches;
+      delete pool;
+    }
+    printf("pool     %d x p=%d  Create: %4.0f ns (pool %4.0f ns)"
+           "  Free: %3.0f ns (pool %3.0f ns)  Heap: %.1f MB (pool %.1f MB)\n",
+           kSketches, p, heap_ns, pool_ns, heap_free_ns, pool_free_ns,
+           heap_bytes * 1e-6, pool_bytes * 1e-6);
+  }
+}
+
+// The throughput of the built-in hash over keys of several sizes, and the
+// cost of the updates that hash their elements, one at a time and batched,
+// against Update() of hashes computed beforehand.
+void BenchHash() {
+  const size_t kSizes[] = {4, 8, 16, 32, 64, 256, 4096};
+  const size_t kBytes = 1 << 26;
+  std::vector<uint8_t> data(kBytes + 4096);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(Hash(i));
+  }
+  for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+    const size_t size = kSizes[s];
+    const size_t keys = kBytes / std::max(size, size_t(64));
+    uint64_t sum = 0;
+    const double start = Now();
+    for (size_t k = 0; k < keys; ++k) {
+      // Consecutive keys overlap, but each starts at a new offset.
+      sum += HashBytes(&data[(k * 61) % kBytes], size);
+    }
+    const double seconds = Now() - start;
+    sink = sum;
+    printf("hash     HashBytes %4zu bytes: %6.2f ns  %5.2f GB/s\n", size,
+           seconds * 1e9 / keys, keys * size / seconds * 1e-9);
+  }
+
+  const size_t kValues = 1 << 22;
+  const int kRounds = 8;
+  uint64_t sum = 0;
+  double start = Now();
+  for (int r = 0; r < kRounds; ++r) {
+    for (size_t i = 0; i < kValues; ++i) {
+      sum += HashU64(i + r * kValues);
+    }
+  }
+  sink = sum;
+  printf("hash     HashU64: %5.2f ns\n",
+         (Now() - start) * 1e9 / (kRounds * kValues));
+
+  std::vector<uint64_t> values(kValues);
+  std::vector<uint64_t> hashes(kValues);
+  for (size_t i = 0; i < kValues; ++i) {
+    values[i] = i;
+    hashes[i] = HashU64(i);
+  }
+  for (int p = 12; p <= 18; p += 6) {
+    HLL* hashed = HLL::Create(p, HLL_OPTION_DENSE, NULL);
+    HLL* single = HLL::Create(p, HLL_OPTION_DENSE, NULL);
+    HLL* batch = HLL::Create(p, HLL_OPTION_DENSE, NULL);
+    start = Now();
+    for (int r = 0; r < kRounds; ++r) {
+      for (size_t i = 0; i < kValues; ++i) {
+        hashed->Update(hashes[i]);
+      }
+    }
+    const double hashed_ns = (Now() - start) * 1e9 / (kRounds * kValues);
+    start = Now();
+    for (int r = 0; r < kRounds; ++r) {
+      for (size_t i = 0; i < kValues; ++i) {
+        single->UpdateU64(values[i]);
+      }
+    }
+    const double single_ns = (Now() - start) * 1e9 / (kRounds * kValues);
+    start = Now();
+    for (int r = 0; r < kRounds; ++r) {
+      batch->UpdateU64Batch(&values[0], kValues);
+    }
+    const double batch_ns = (Now() - start) * 1e9 / (kRounds * kValues);
+    sink = hashed->Estimate() + single->Estimate() + batch->Estimate();
+    printf("hash     p=%2d  Update(hash): %5.2f ns  UpdateU64: %5.2f ns"
+           "  UpdateU64Batch: %5.2f ns\n",
+           p, hashed_ns, single_ns, batch_ns);
+    delete hashed;
+    delete single;
+    delete batch;
+  }
+}
+
+// A windowed job: each window, every sketch is emptied and sees a few
+// elements. Compares recreating the sketches with resetting them, and
+// copying them by Clone() with a serialization round trip.
+void BenchWindow() {
+  const int kOptions[] = {HLL_LAYOUT_BYTE, HLL_OPTION_DENSE};
+  const char* kNames[] = {"sparse", "dense"};
+  const int kPrecision = 12;
+  const int kSketches = 10000;
+  const int kWindows = 5;
+  const int kPerWindow = 100;
+  std::vector<HLL*> sketches(kSketches);
+  std::vector<uint8_t> buffer;
+  for (size_t o = 0; o < sizeof(kOptions) / sizeof(int); ++o) {
+    for (int s = 0; s < kSketches; ++s) {
+      sketches[s] = HLL::Create(kPrecision, kOptions[o], NULL);
+    }
+    double start = Now();
+    for (int w = 0; w < kWindows; ++w) {
+      for (int s = 0; s < kSketches; ++s) {
+        delete sketches[s];
+        sketches[s] = HLL::Create(kPrecision, kOptions[o], NULL);
+        for (int i = 0; i < kPerWindow; ++i) {
+          sketches[s]->Update(Hash(s * kPerWindow + i));
+        }
+      }
+    }
+    const double recreate_ns = (Now() - start) * 1e9 / (kWindows * kSketches);
+    start = Now();
+    for (int w = 0; w < kWindows; ++w) {
+      for (int s = 0; s < kSketches; ++s) {
+        sketches[s]->Reset();
+        for (int i = 0; i < kPerWindow; ++i) {
+          sketches[s]->Update(Hash(s * kPerWindow + i));
+        }
+      }
+    }
+    const double reset_ns = (Now() - start) * 1e9 / (kWindows * kSketches);
+
+    start = Now();
+    for (int s = 0; s < kSketches; ++s) {
+      delete sketches[s]->Clone();
+    }
+    const double clone_ns = (Now() - start) * 1e9 / kSketches;
+    start = Now();
+    for (int s = 0; s < kSketches; ++s) {
+      buffer.resize(sketches[s]->SerializedSize());
+      sketches[s]->Serialize(&buffer[0], buffer.size());
+      delete HLL::Deserialize(&buffer[0], buffer.size(), NULL);
+    }
+    const double copy_ns = (Now() - start) * 1e9 / kSketches;
+    for (int s = 0; s < kSketches; ++s) {
+      delete sketches[s];
+    }
+    printf("window   p=%d %-6s  %d updates: recreate %5.0f ns  reset %5.0f ns"
+           "  Clone: %5.0f ns (serialized copy %5.0f ns)\n",
+           kPrecision, kNames[o], kPerWindow, recreate_ns, reset_ns,
+           clone_ns, copy_ns);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  BenchUpdate();
+  BenchFixed();
+  BenchMerge();
+  BenchMergeMany();
+  BenchEstimate();
+  BenchBias();
+  BenchSerialize();
+  BenchMergeSerialized();
+  BenchMapped();
+  BenchConcurrent();
+  BenchSnapshot();
+  BenchArchive();
+  BenchPool();
+  BenchWindow();
+  BenchHash();
+  return EXIT_SUCCESS;
+}
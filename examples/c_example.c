@@ -15,27 +15,9 @@
 */
 
 #include <inttypes.h>
-#include <openssl/sha.h>
 #include <stdio.h>
 #include "count/c.h"
 
-uint64_t hash(int i) {
-  // Structure that is 160 bits wide used to extract 64 bits from a SHA-1.
-  struct hashval {
-    uint64_t high64;
-    char     low96[12];
-  } hash;
-
-  // Calculate the SHA-1 hash of the integer.
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
-  SHA1_Update(&ctx, (unsigned char*)&i, sizeof(i));
-  SHA1_Final((unsigned char*)&hash, &ctx);
-
-  // Return 64 bits of the hash.
-  return hash.high64;
-}
-
 int main(int argc, char* argv[]) {
   const int kPrecision = 9;
   int error = 0;
@@ -43,12 +25,14 @@ int main(int argc, char* argv[]) {
   // Create an HLL object to track set cardinality.
   hll_t* hll = HLL_create(kPrecision, &error);
 
-  // Count 'kIterations' elements with 'kTrueCardinality' cardinality.
+  // Count 'kIterations' elements with 'kTrueCardinality' cardinality. The
+  // elements are integers, hashed by the library; HLL_update_bytes() takes
+  // elements of any other type.
   const uint64_t kIterations = 1000000;
   const uint64_t kTrueCardinality = 100;
   uint64_t i;
   for (i = 0; i < kIterations; ++i) {
-    HLL_update(hll, hash(i % kTrueCardinality));
+    HLL_update_u64(hll, i % kTrueCardinality);
   }
 
   // Obtain the cardinality estimate.
@@ -14,7 +14,6 @@
 // contributors.
 
 #include <inttypes.h>
-#include <openssl/sha.h>
 
 #include <iostream>
 
@@ -24,34 +23,19 @@ using libcount::HLL;
 using std::cout;
 using std::endl;
 
-uint64_t hash(int i) {
-  // Structure that is 160 bits wide used to extract 64 bits from a SHA-1.
-  struct hashval {
-    uint64_t high64;
-    char low96[12];
-  } hash;
-
-  // Calculate the SHA-1 hash of the integer.
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
-  SHA1_Update(&ctx, (unsigned char*)&i, sizeof(i));
-  SHA1_Final((unsigned char*)&hash, &ctx);
-
-  // Return 64 bits of the hash.
-  return hash.high64;
-}
-
 int main(int argc, char* argv[]) {
   const int kPrecision = 9;
 
   // Create an HLL object to track set cardinality.
   HLL* hll = HLL::Create(kPrecision);
 
-  // Count 'kIterations' elements with 'kTrueCardinality' cardinality.
+  // Count 'kIterations' elements with 'kTrueCardinality' cardinality. The
+  // elements are integers, hashed by the library; UpdateBytes() takes
+  // elements of any other type.
   const uint64_t kIterations = 1000000;
   const uint64_t kTrueCardinality = 100;
   for (uint64_t i = 0; i < kIterations; ++i) {
-    hll->Update(hash(i % kTrueCardinality));
+    hll->UpdateU64(i % kTrueCardinality);
   }
 
   // Obtain the cardinality estimate.
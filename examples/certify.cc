@@ -18,18 +18,25 @@
 #include <inttypes.h>
 #include <openssl/sha.h>
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <iostream>
 
 #include "count/hll.h"
 #include "count/hll_limits.h"
+#include "count/hll_options.h"
 
 using std::cerr;
 using std::cout;
 using std::endl;
 
 using libcount::HLL;
+using libcount::HLL_ESTIMATOR_EMPIRICAL;
+using libcount::HLL_ESTIMATOR_IMPROVED;
+using libcount::HLL_ESTIMATOR_MLE;
+using libcount::HLL_MAX_EMPIRICAL_PRECISION;
 using libcount::HLL_MAX_PRECISION;
 using libcount::HLL_MIN_PRECISION;
 
@@ -51,29 +58,47 @@ uint64_t hash(int i) {
   return hash.high64;
 }
 
+// The estimators compared by this program.
+const int kEstimators[] = {HLL_ESTIMATOR_EMPIRICAL, HLL_ESTIMATOR_IMPROVED,
+                           HLL_ESTIMATOR_MLE};
+const char* kEstimatorNames[] = {"empirical", "improved", "mle"};
+const int kEstimatorCount = sizeof(kEstimators) / sizeof(kEstimators[0]);
+
+// Return a monotonic timestamp, in seconds.
+double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
 struct TestResults {
+  const char* estimator;
   int precision;
   uint64_t size;
   uint64_t cardinality;
   uint64_t estimate;
   double percent_error;
+  double estimate_ns;
 };
 
 std::ostream& operator<<(std::ostream& os, const TestResults& results) {
   char buffer[1000];
   snprintf(buffer, sizeof(buffer),
-           "Precision:%2d  Size:%8lu  Actual:%8lu  Estimate:%8lu,  Error: "
-           "%7.2lf %%",
-           results.precision, results.size, results.cardinality,
-           results.estimate, results.percent_error);
+           "%-9s  Precision:%2d  Size:%8lu  Actual:%8lu  Estimate:%8lu,  "
+           "Error: %7.2lf %%  Time: %8.0lf ns",
+           results.estimator, results.precision, results.size,
+           results.cardinality, results.estimate, results.percent_error,
+           results.estimate_ns);
   os << buffer;
   return os;
 }
 
+// Count 'cardinality' distinct elements out of a stream of 'size' with each
+// estimator, storing the outcome in results[0..kEstimatorCount).
 int certify(int precision, uint64_t size, uint64_t cardinality,
             TestResults* results) {
   assert(results != NULL);
-  // The precision must be 4..18 inclusive.
+  // The precision must be 4..26 inclusive.
   if ((precision < HLL_MIN_PRECISION) || (precision > HLL_MAX_PRECISION)) {
     return EINVAL;
   }
@@ -83,37 +108,47 @@ int certify(int precision, uint64_t size, uint64_t cardinality,
     return EINVAL;
   }
 
-  // Initialize the results structure.
-  results->precision = precision;
-  results->size = size;
-  results->cardinality = cardinality;
-  results->estimate = 0;
-  results->percent_error = 0.0;
-
-  HLL* hll = HLL::Create(precision);
-  if (!hll) {
-    return EINVAL;
+  HLL* hll[kEstimatorCount];
+  for (int e = 0; e < kEstimatorCount; ++e) {
+    hll[e] = HLL::Create(precision, kEstimators[e], NULL);
+    if (!hll[e]) {
+      return EINVAL;
+    }
   }
 
-  // Push 'size' elements through the counter. We are guaranteed exactly
+  // Push 'size' elements through the counters. We are guaranteed exactly
   // 'cardinality' unique hash values.
   for (uint64_t i = 0; i < size; ++i) {
-    hll->Update(hash(i % cardinality));
+    const uint64_t h = hash(i % cardinality);
+    for (int e = 0; e < kEstimatorCount; ++e) {
+      hll[e]->Update(h);
+    }
   }
 
-  // Calculate the estimate
-  results->estimate = hll->Estimate();
-
-  // Calculate percentage difference.
-  const double actual = static_cast<double>(results->cardinality);
-  const double estimated = static_cast<double>(results->estimate);
-  const double percent = ((estimated - actual) / actual) * 100.0;
+  for (int e = 0; e < kEstimatorCount; ++e) {
+    // Initialize the results structure.
+    TestResults* r = &results[e];
+    r->estimator = kEstimatorNames[e];
+    r->precision = precision;
+    r->size = size;
+    r->cardinality = cardinality;
+
+    // Calculate the estimate, timing it over a number of calls.
+    const int kRounds = 100;
+    const double start = now();
+    for (int i = 0; i < kRounds; ++i) {
+      r->estimate = hll[e]->Estimate();
+    }
+    r->estimate_ns = (now() - start) * 1e9 / kRounds;
 
-  // Report percentage error.
-  results->percent_error = percent;
+    // Calculate percentage difference.
+    const double actual = static_cast<double>(r->cardinality);
+    const double estimated = static_cast<double>(r->estimate);
+    r->percent_error = ((estimated - actual) / actual) * 100.0;
 
-  // Cleanup.
-  delete hll;
+    // Cleanup.
+    delete hll[e];
+  }
 
   return 0;
 }
@@ -121,21 +156,41 @@ int certify(int precision, uint64_t size, uint64_t cardinality,
 int main(int argc, char* argv[]) {
   const int kMaxCardinality = 1000000;
   const int kMaxSize = kMaxCardinality * 10;
+  // Beyond the bias tables, the cardinalities go ten times higher, so that
+  // the registers fill past the linear counting range of the lower
+  // precisions; each element is then seen once, to bound the run time.
+  const int kExtendedMaxCardinality = kMaxCardinality * 10;
   size_t tests = 0;
+  double total_error[kEstimatorCount] = {0.0};
+  double total_ns[kEstimatorCount] = {0.0};
   // For every precision level...
   for (int p = HLL_MIN_PRECISION; p <= HLL_MAX_PRECISION; ++p) {
-    for (int c = 1; c <= kMaxCardinality; c *= 10) {
-      for (int s = c; s <= kMaxSize; s *= 10) {
-        TestResults results;
-        int status = certify(p, s, c, &results);
+    const bool extended = (p > HLL_MAX_EMPIRICAL_PRECISION);
+    const int max_cardinality =
+        extended ? kExtendedMaxCardinality : kMaxCardinality;
+    for (int c = 1; c <= max_cardinality; c *= 10) {
+      const int max_size = extended ? c : kMaxSize;
+      for (int s = c; s <= max_size; s *= 10) {
+        TestResults results[kEstimatorCount];
+        int status = certify(p, s, c, results);
         if (status < 0) {
           cerr << "certify: the certify() function returned an error" << endl;
           exit(EXIT_FAILURE);
         }
-        cout << results << endl;
+        for (int e = 0; e < kEstimatorCount; ++e) {
+          cout << results[e] << endl;
+          total_error[e] += fabs(results[e].percent_error);
+          total_ns[e] += results[e].estimate_ns;
+        }
         ++tests;
       }
     }
   }
+
+  // Summarize the accuracy and speed of each estimator.
+  for (int e = 0; e < kEstimatorCount; ++e) {
+    printf("%-9s  Mean absolute error: %6.3lf %%  Mean time: %8.0lf ns\n",
+           kEstimatorNames[e], total_error[e] / tests, total_ns[e] / tests);
+  }
   return EXIT_SUCCESS;
 }
@@ -14,7 +14,6 @@
 // contributors.
 
 #include <inttypes.h>
-#include <openssl/sha.h>
 
 #include <iostream>
 
@@ -24,23 +23,6 @@ using libcount::HLL;
 using std::cout;
 using std::endl;
 
-uint64_t hash(int i) {
-  // Structure that is 160 bits wide used to extract 64 bits from a SHA-1.
-  struct hashval {
-    uint64_t high64;
-    char low96[12];
-  } hash;
-
-  // Calculate the SHA-1 hash of the integer.
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
-  SHA1_Update(&ctx, (unsigned char*)&i, sizeof(i));
-  SHA1_Final((unsigned char*)&hash, &ctx);
-
-  // Return 64 bits of the hash.
-  return hash.high64;
-}
-
 int main(int argc, char* argv[]) {
   const int kPrecision = 14;
 
@@ -55,8 +37,8 @@ int main(int argc, char* argv[]) {
   const uint64_t kIterations = 10000000;
   const uint64_t kTrueCardinality = 1000;
   for (uint64_t i = 0; i < kIterations; ++i) {
-    hll_1->Update(hash(i % kTrueCardinality));
-    hll_2->Update(hash((i % kTrueCardinality) + kTrueCardinality));
+    hll_1->UpdateU64(i % kTrueCardinality);
+    hll_2->UpdateU64((i % kTrueCardinality) + kTrueCardinality);
   }
 
   // Merge contents of hll_2 into hll_1.
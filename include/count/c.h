@@ -22,31 +22,157 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "count/hll_limits.h"
+#include "count/hll_options.h"
 
 /* Exported types */
 
 typedef struct hll_t hll_t;
+typedef struct hll_pool_t hll_pool_t;
 
 /* HLL Operations */
 
-/* Create a HyperLogLog context object to estimate the cardinality of a set. */
+/* Create a HyperLogLog context object to estimate the cardinality of a set.
+   The context starts out sparse, and allocates its dense registers
+   separately when it converts to them. */
 extern hll_t* HLL_create(int precision, int* opt_error);
 
+/* As above, with a combination of the HLL_* options in hll_options.h. With
+   HLL_OPTION_DENSE, and the byte or 6-bit layout, the context and its
+   registers are a single allocation. */
+extern hll_t* HLL_create_with_options(int precision, int options,
+                                      int* opt_error);
+
+/* As above, with the registers in a shared mapping of the file at 'path',
+   which is created if need be, or else resumed from its last checkpoint.
+   See HLL::CreateMapped() in hll.h. */
+extern hll_t* HLL_create_mapped(const char* path, int precision, int options,
+                                int* opt_error);
+
+/* As HLL_create(), but construct the context in the 'len' bytes at 'buf',
+   without allocating memory. The context is dense from the start, in the
+   byte layout, and never allocates memory later. The buffer must be
+   aligned for a pointer and hold at least HLL_in_place_size() bytes, and
+   must stay at one address. Returns NULL on failure, with EINVAL stored in
+   'opt_error' if the precision is out of range, or ERANGE if the buffer is
+   too small. The context is done with by reusing or freeing the buffer,
+   not with HLL_free(). See HLL::CreateIn() in hll.h. */
+extern hll_t* HLL_create_in(void* buf, size_t len, int precision,
+                            int* opt_error);
+
+/* Return the number of bytes HLL_create_in() needs for a context of the
+   given precision. */
+extern size_t HLL_in_place_size(int precision);
+
+/* Write the registers of a mapped context to its file, and record a new
+   checkpoint. Returns 0 on success, EINVAL if the context isn't mapped, or
+   the errno value of a failed system call. */
+extern int HLL_checkpoint(hll_t* ctx);
+
 /* Update a context to record the observation of an element in the set. */
 extern void HLL_update(hll_t* ctx, uint64_t hash);
 
-/* Merge 'src' context with 'dest', storing the resulting state in 'dest'. */
+/* Update a context to record the observation of 'n' elements. Equivalent to
+   calling HLL_update() for each hash, but faster. */
+extern void HLL_update_batch(hll_t* ctx, const uint64_t* hashes, size_t n);
+
+/* Update a context to record the observation of an element given as a
+   64-bit integer, or as 'size' bytes at 'data'. The element is hashed with
+   HLL_hash_u64() or HLL_hash_bytes() with a zero seed. */
+extern void HLL_update_u64(hll_t* ctx, uint64_t value);
+extern void HLL_update_bytes(hll_t* ctx, const void* data, size_t size);
+
+/* As above, for 'n' integers, or 'n' elements of 'sizes[i]' bytes at
+   'data[i]'. Equivalent to calling HLL_update_u64() or HLL_update_bytes()
+   for each, but faster. */
+extern void HLL_update_u64_batch(hll_t* ctx, const uint64_t* values,
+                                 size_t n);
+extern void HLL_update_bytes_batch(hll_t* ctx, const void* const* data,
+                                   const size_t* sizes, size_t n);
+
+/* Return the 64-bit hash of the 'size' bytes at 'data', or of an integer,
+   with a fast non-cryptographic function that suits HLL_update(). See
+   hash.h. */
+extern uint64_t HLL_hash_bytes(const void* data, size_t size, uint64_t seed);
+extern uint64_t HLL_hash_u64(uint64_t value, uint64_t seed);
+
+/* Merge 'src' context with 'dest', storing the resulting state in 'dest'.
+   If their precisions differ, the result has the lower one. */
 extern int HLL_merge(hll_t* dest, const hll_t* src);
 
+/* Merge 'n' contexts into 'dest' in a single pass over its registers,
+   optionally split among 'threads' threads. See HLL::MergeMany(). */
+extern int HLL_merge_many(hll_t* dest, const hll_t* const* srcs, size_t n,
+                          int threads);
+
+/* Reduce the precision of a context. See HLL::Fold(). */
+extern int HLL_fold(hll_t* ctx, int precision);
+
+/* Return a new context with the same contents as 'ctx'. See HLL::Clone(). */
+extern hll_t* HLL_clone(const hll_t* ctx);
+
+/* Empty a context without freeing or allocating memory, so that it can be
+   reused. See HLL::Reset(). */
+extern void HLL_reset(hll_t* ctx);
+
+/* Exchange the contents of two contexts. Returns 0 on success, or EINVAL
+   if a context in a pool or a caller's buffer can't take the other's
+   registers. See HLL::Swap(). */
+extern int HLL_swap(hll_t* a, hll_t* b);
+
 /* Return an estimate of the cardinality of the set using HyperLogLog++ */
 extern uint64_t HLL_estimate(hll_t* ctx);
 
+/* Return the number of bytes needed to serialize a context. */
+extern size_t HLL_serialized_size(const hll_t* ctx);
+
+/* Serialize a context into 'buffer', which has room for 'size' bytes, in a
+   versioned format independent of the host's byte order. Returns 0 on
+   success, or ERANGE if the buffer is smaller than HLL_serialized_size(). */
+extern int HLL_serialize(const hll_t* ctx, void* buffer, size_t size);
+
+/* Create a context from the 'size' bytes written by HLL_serialize(). Returns
+   NULL on failure, with EINVAL stored in 'opt_error' if the buffer does not
+   hold a valid serialized context. */
+extern hll_t* HLL_deserialize(const void* buffer, size_t size,
+                              int* opt_error);
+
+/* Merge the context serialized in the 'size' bytes of 'buffer' into 'dest',
+   without creating a context for it. A context of higher precision is
+   folded to that of 'dest'. Returns 0 on success, or EINVAL if the buffer
+   does not hold a valid serialized context of at least that precision. */
+extern int HLL_merge_serialized(hll_t* dest, const void* buffer,
+                                size_t size);
+
 /* Free resources associated with a context. */
 extern void HLL_free(hll_t* ctx);
 
+/* Pool Operations */
+
+/* Create a pool of contexts of one precision and set of options, whose
+   registers are allocated from large slabs. See HLLPool in hll_pool.h. */
+extern hll_pool_t* HLL_pool_create(int precision, int options,
+                                   int* opt_error);
+
+/* Return a new, empty context from the pool. It must be released with
+   HLL_pool_release(), or freed with the pool, rather than HLL_free().
+   Returns NULL on failure, with ENOMEM stored in 'opt_error' if the pool
+   needed a new slab and couldn't allocate one. */
+extern hll_t* HLL_pool_alloc(hll_pool_t* pool, int* opt_error);
+
+/* Return a context to the pool it was allocated from. */
+extern void HLL_pool_release(hll_pool_t* pool, hll_t* ctx);
+
+/* Release every context allocated from the pool at once, keeping the
+   slabs for reuse. */
+extern void HLL_pool_reset(hll_pool_t* pool);
+
+/* Free the pool, and every context allocated from it. */
+extern void HLL_pool_free(hll_pool_t* pool);
+
 #ifdef __cplusplus
 } /* end extern "C" */
 #endif
@@ -0,0 +1,144 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_CONCURRENT_HLL_H_
+#define INCLUDE_COUNT_CONCURRENT_HLL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/hll_rank.h"
+
+namespace libcount {
+
+// A HyperLogLog cardinality estimator that any number of threads may update
+// at once, without locks. The registers are always dense, a byte apiece,
+// and packed eight to a 64-bit word. An update raises its register with a
+// relaxed atomic compare-and-swap of the word, and most updates don't raise
+// the register at all: they cost a single load, and leave the cache line
+// shared between cores.
+//
+// Estimate() and MergeInto() may be called while other threads update the
+// object. They read each word atomically, and so see every register as it
+// was at some point during the call; since registers only grow, the result
+// lies between the states before and after the call. Created with
+// HLL_OPTION_SNAPSHOT, Snapshot() goes further and copies the registers as
+// they all were at a single point in time.
+//
+// The registers hold the same values as those of an HLL object of the same
+// precision in the byte layout, and the estimates agree with those of the
+// HLL once it is dense. Atomic operations use the GCC builtins, which GCC
+// and Clang provide on every platform they support.
+class ConcurrentHLL {
+ public:
+  // Create an instance. Valid values for precision are as for HLL. The
+  // 'options' may select an estimator with one of the HLL_ESTIMATOR_*
+  // values in hll_options.h, and include HLL_OPTION_SNAPSHOT; other options
+  // are not supported. Returns NULL on failure; the caller may provide a
+  // pointer to an integer to learn the reason.
+  static ConcurrentHLL* Create(int precision, int options = 0,
+                               int* error = 0);
+
+  ~ConcurrentHLL();
+
+  // Record the observation of an element. Safe to call from any number of
+  // threads at once, and concurrently with the other member functions.
+  void Update(uint64_t hash) {
+    int index;
+    uint8_t rank;
+    IndexAndRankOf(hash, precision_, &index, &rank);
+    SetMax(&words_[index >> 3], (index & 7) * 8, rank);
+  }
+
+  // Copy the registers, a byte apiece, into the (2 ^ precision) bytes at
+  // 'registers'. The copy may be estimated or merged through an HLLView
+  // (hll_view.h). Returns true if the copy is of the registers as they were
+  // at one point in time during the call.
+  //
+  // With HLL_OPTION_SNAPSHOT, the registers are guarded by a sequence lock
+  // that only writers raising a register touch, and then without waiting:
+  // each raise bumps one counter before it and another after. The copy is
+  // retried a few times, until no raise began or ended while it was taken.
+  // Raises grow rare as a sketch fills, so retries are too. When they run
+  // out, as they may while a new sketch warms up, and always without the
+  // option, the copy is of each register as it was at some point during the
+  // call, as with MergeInto(): a sketch of a subset of the elements added,
+  // and of all those added before the call. Returns false then.
+  bool Snapshot(uint8_t* registers) const;
+
+  // Merge an HLL object into this one. Returns 0 on success, or EINVAL if
+  // the precision doesn't match. Safe to call concurrently with updates.
+  int Merge(const HLL* other);
+
+  // Merge this object into an HLL object. Returns 0 on success, or EINVAL if
+  // the precision doesn't match.
+  int MergeInto(HLL* other) const;
+
+  // Compute the estimate with the estimator selected at creation.
+  uint64_t Estimate() const;
+
+  int precision() const { return precision_; }
+
+ private:
+  // No copying allowed
+  ConcurrentHLL(const ConcurrentHLL& no_copy);
+  ConcurrentHLL& operator=(const ConcurrentHLL& no_assign);
+
+  ConcurrentHLL(int precision, int options);
+
+  // Raise the byte at 'shift' within '*word' to 'value' if it is less.
+  void SetMax(uint64_t* word, int shift, uint64_t value) {
+    uint64_t current = __atomic_load_n(word, __ATOMIC_RELAXED);
+    if (((current >> shift) & 0xFF) >= value) {
+      return;
+    }
+    // The store is a release, so that a Snapshot() that sees it also sees
+    // the bump of 'begun_' before it.
+    if (begun_ != NULL) {
+      __atomic_fetch_add(begun_, 1, __ATOMIC_RELAXED);
+    }
+    while (((current >> shift) & 0xFF) < value) {
+      const uint64_t desired =
+          (current & ~(uint64_t(0xFF) << shift)) | (value << shift);
+      // On failure, 'current' is reloaded, and the loop rechecks it.
+      if (__atomic_compare_exchange_n(word, &current, desired, true,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        break;
+      }
+    }
+    if (ended_ != NULL) {
+      __atomic_fetch_add(ended_, 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  // Copy the registers of 'count' words, starting with word 'first', into
+  // 'registers', a byte apiece.
+  void CopyWords(int first, int count, uint8_t* registers) const;
+
+  int precision_;
+  int estimator_;
+  int word_count_;
+  uint64_t* words_;
+  // With HLL_OPTION_SNAPSHOT, the counts of raises begun and ended, on a
+  // cache line of their own after the registers; otherwise NULL.
+  uint64_t* begun_;
+  uint64_t* ended_;
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_CONCURRENT_HLL_H_
@@ -0,0 +1,113 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_FIXED_HLL_H_
+#define INCLUDE_COUNT_FIXED_HLL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "count/hll.h"
+#include "count/hll_limits.h"
+#include "count/hll_options.h"
+#include "count/hll_rank.h"
+
+namespace libcount {
+
+// A HyperLogLog cardinality estimator whose precision is fixed at compile
+// time. The (2 ^ P) byte registers are stored inline, so an instance needs
+// no heap allocation and may live on the stack, in a struct, or in an array;
+// and since the shifts and masks used by Update() are constants, the update
+// inlines into the caller's loop as a handful of instructions.
+//
+// The registers are always dense, and hold the same values as those of an
+// HLL object of the same precision in the byte layout. FixedHLL and HLL
+// objects of the same precision can be merged with each other, and give the
+// same estimates for the same elements once the HLL is dense.
+template <int P>
+class FixedHLL {
+ public:
+  // The precision, and the number of registers.
+  static const int kPrecision = P;
+  static const int kRegisterCount = 1 << P;
+
+  FixedHLL() { Reset(); }
+
+  // Forget all of the elements observed so far.
+  void Reset() { memset(registers_, 0, sizeof(registers_)); }
+
+  // Update the instance to record the observation of an element. As with
+  // HLL::Update(), the caller is expected to use a high-quality hash.
+  void Update(uint64_t hash) {
+    int index;
+    uint8_t rank;
+    IndexAndRankOf(hash, P, &index, &rank);
+    if (rank > registers_[index]) {
+      registers_[index] = rank;
+    }
+  }
+
+  // Merge count tracking information from another instance into this one.
+  void Merge(const FixedHLL& other) {
+    for (int i = 0; i < kRegisterCount; ++i) {
+      if (other.registers_[i] > registers_[i]) {
+        registers_[i] = other.registers_[i];
+      }
+    }
+  }
+
+  // Merge an HLL object into this one. Returns 0 on success, or EINVAL if
+  // the HLL object was not created with precision P.
+  int Merge(const HLL& other) { return other.MergeInto(registers_, P); }
+
+  // Merge this object into an HLL object. Returns 0 on success, or EINVAL if
+  // the HLL object was not created with precision P.
+  int MergeInto(HLL* other) const {
+    return other->MergeRegisters(registers_, P);
+  }
+
+  // Return a new HLL object with the same registers as this one, created
+  // with the given options (see hll_options.h). Returns NULL on failure.
+  HLL* ToHLL(int options = HLL_LAYOUT_BYTE) const {
+    HLL* hll = HLL::Create(P, options, NULL);
+    if (hll != NULL) {
+      MergeInto(hll);
+    }
+    return hll;
+  }
+
+  // Compute the estimate, using the estimator selected by the HLL_ESTIMATOR_*
+  // value in 'options'; the HyperLogLog++ estimator by default.
+  uint64_t Estimate(int options = HLL_ESTIMATOR_EMPIRICAL) const {
+    return HLL::EstimateRegisters(registers_, P, options);
+  }
+
+  // Return the register array, of kRegisterCount bytes.
+  const uint8_t* registers() const { return registers_; }
+
+ private:
+  // The precision must be in the range supported by HLL.
+  typedef char PrecisionCheck[((P >= HLL_MIN_PRECISION) &&
+                               (P <= HLL_MAX_PRECISION))
+                                  ? 1
+                                  : -1];
+
+  uint8_t registers_[1 << P];
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_FIXED_HLL_H_
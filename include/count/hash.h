@@ -0,0 +1,91 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_HASH_H_
+#define INCLUDE_COUNT_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace libcount {
+
+// Fast, non-cryptographic 64-bit hashing of the elements of a set into the
+// hashes HLL::Update() expects. The function is wyhash (final version 4, by
+// Wang Yi) with its default secret. It passes the SMHasher suite, and hashes
+// a short key in a few nanoseconds, where SHA-1 takes hundreds. Different
+// seeds give independent functions. The result doesn't depend on the byte
+// order of the host, so sketches built on different hosts can be merged.
+//
+// Keys chosen to collide can be found for any function of this kind; where
+// an adversary controls the elements, use a secret seed.
+
+// Return the hash of the 'size' bytes at 'data'.
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Return the hash of a 64-bit integer: the same as HashBytes() of its eight
+// bytes in little-endian order, but computed without touching memory.
+inline uint64_t HashU64(uint64_t value, uint64_t seed = 0);
+
+// The secret of wyhash, and its mixing primitives: the 128-bit product of
+// '*a' and '*b', with the low half stored in '*a' and the high in '*b'; and
+// the two halves of the product of 'a' and 'b' XORed together.
+const uint64_t kHashSecret[4] = {0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+                                 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+inline void HashMultiply(uint64_t* a, uint64_t* b);
+inline uint64_t HashMix(uint64_t a, uint64_t b);
+
+inline void HashMultiply(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  const __uint128_t product = static_cast<__uint128_t>(*a) * *b;
+  *a = static_cast<uint64_t>(product);
+  *b = static_cast<uint64_t>(product >> 64);
+#else
+  // Schoolbook multiplication of 32-bit halves.
+  const uint64_t a_high = *a >> 32;
+  const uint64_t a_low = *a & 0xFFFFFFFFULL;
+  const uint64_t b_high = *b >> 32;
+  const uint64_t b_low = *b & 0xFFFFFFFFULL;
+  const uint64_t high = a_high * b_high;
+  const uint64_t middle0 = a_high * b_low;
+  const uint64_t middle1 = b_high * a_low;
+  const uint64_t low = a_low * b_low;
+  const uint64_t t = low + (middle0 << 32);
+  uint64_t carry = (t < low) ? 1 : 0;
+  const uint64_t sum = t + (middle1 << 32);
+  carry += (sum < t) ? 1 : 0;
+  *a = sum;
+  *b = high + (middle0 >> 32) + (middle1 >> 32) + carry;
+#endif
+}
+
+inline uint64_t HashMix(uint64_t a, uint64_t b) {
+  HashMultiply(&a, &b);
+  return a ^ b;
+}
+
+inline uint64_t HashU64(uint64_t value, uint64_t seed) {
+  // HashBytes() reads a key of four to sixteen bytes as overlapping 32-bit
+  // words; for eight bytes, that yields the value with its halves swapped,
+  // and the value itself.
+  seed ^= HashMix(seed ^ kHashSecret[0], kHashSecret[1]);
+  uint64_t a = ((value << 32) | (value >> 32)) ^ kHashSecret[1];
+  uint64_t b = value ^ seed;
+  HashMultiply(&a, &b);
+  return HashMix(a ^ kHashSecret[0] ^ 8, b ^ kHashSecret[1]);
+}
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_HASH_H_
@@ -16,53 +16,352 @@
 #ifndef INCLUDE_COUNT_HLL_H_
 #define INCLUDE_COUNT_HLL_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "count/hash.h"
 #include "count/hll_limits.h"
+#include "count/hll_options.h"
 
 namespace libcount {
 
+class NibbleRegisters;
+class RegisterFile;
+class SparseRegisters;
+
 class HLL {
  public:
   ~HLL();
 
+  // Create() may allocate an object together with its registers, so delete
+  // frees the whole block, whatever the size of the object.
+  static void* operator new(size_t size);
+  static void* operator new(size_t size, void* where) { return where; }
+  static void operator delete(void* object);
+  static void operator delete(void* object, void* where) {}
+
   // Create an instance of a HyperLogLog++ cardinality estimator. Valid values
-  // for precision are [4..18] inclusive, and govern the precision of the
+  // for precision are [4..26] inclusive, and govern the precision of the
   // estimate. Returns NULL on failure. In the event of failure, the caller
   // may provide a pointer to an integer to learn the reason.
+  //
+  // The instance starts out using the sparse representation described in
+  // the HyperLogLog++ paper, and switches to a dense array of registers once
+  // that would take less space. Sparse entries are recorded at precision 25,
+  // so instances of precision 26 are dense from the start. Above precision
+  // 18, where HyperLogLog++ has no bias tables, the default estimator is
+  // HLL_ESTIMATOR_IMPROVED.
   static HLL* Create(int precision, int* error = 0);
 
+  // As above, but with a combination of the HLL_* values defined in
+  // hll_options.h. For example, passing HLL_LAYOUT_PACKED6 stores the dense
+  // registers in 6 bits apiece rather than a byte, saving a fifth of the
+  // memory at the cost of slightly more work per update. HLL_LAYOUT_PACKED4
+  // goes further, storing registers in 4 bits relative to a common offset.
+  // HLL_OPTION_INCREMENTAL makes Estimate() a constant-time operation, and
+  // HLL_ESTIMATOR_IMPROVED or HLL_ESTIMATOR_MLE select an estimator that
+  // does without the empirical bias correction of HyperLogLog++.
+  //
+  // An object that is dense from the start, in the byte or 6-bit layout, is
+  // a single allocation: the registers follow the object, on a cache line
+  // boundary.
+  static HLL* Create(int precision, int options, int* error);
+
+  // As above, but construct the object in the 'size' bytes at 'buffer', with
+  // the same options. No memory is allocated: the object is dense from the
+  // start, and only the byte and 6-bit layouts may be used. The buffer must
+  // be aligned for a pointer and hold at least InPlaceSize() bytes. Returns
+  // NULL on failure, with EINVAL for bad options or ERANGE for too small a
+  // buffer.
+  //
+  // The object owns nothing outside the buffer, so it is done with by
+  // reusing or freeing the buffer rather than deleting the object. It holds
+  // pointers into the buffer, which must therefore stay at one address, and
+  // it can't be folded to a lower precision.
+  static HLL* CreateIn(void* buffer, size_t size, int precision,
+                       int options = HLL_LAYOUT_BYTE, int* error = 0);
+
+  // Return the number of bytes CreateIn() needs for an object with the given
+  // precision and options.
+  static size_t InPlaceSize(int precision, int options = HLL_LAYOUT_BYTE);
+
+  // As above, but with the dense registers in a shared memory mapping of
+  // the file at 'path', so that a restarted process resumes where the last
+  // one left off, without replaying its input. If the file doesn't exist, it
+  // is created; otherwise the object resumes from the file's last good
+  // checkpoint, and the file must have been created with the same precision
+  // and register layout. The object is always dense, and only the byte and
+  // 6-bit layouts may be used. Updates cost the same as those of an object
+  // in memory. Returns NULL on failure: EINVAL for an unsuitable file or
+  // options, EBUSY if the file is already in use, or the errno value of a
+  // failed system call.
+  static HLL* CreateMapped(const char* path, int precision, int options,
+                           int* error = 0);
+
+  // Make the registers of a mapped object durable: write the pages changed
+  // since the last checkpoint to the file, then record a new generation in
+  // its header. After a crash, the object resumes with at least the
+  // registers as of the last checkpoint. Returns 0 on success, EINVAL if the
+  // object was not created by CreateMapped(), or the errno value of a failed
+  // system call.
+  int Checkpoint();
+
+  // Return the generation of the last checkpoint of a mapped object, which
+  // increases by one with each checkpoint; zero for other objects.
+  uint64_t CheckpointGeneration() const;
+
   // Update the instance to record the observation of an element. It is
   // assumed that the caller uses a high-quality 64-bit hash function that
-  // is free of bias. Empirically, using a subset of bits from a well-known
-  // cryptographic hash function such as SHA1, is a good choice.
+  // is free of bias, such as HashBytes() in hash.h, or a subset of the bits
+  // of a cryptographic hash function such as SHA1.
   void Update(uint64_t hash);
 
+  // As above, but for an element given as the 'size' bytes at 'data', or as
+  // a 64-bit integer, which is hashed with HashBytes() or HashU64().
+  void UpdateBytes(const void* data, size_t size) {
+    Update(HashBytes(data, size));
+  }
+  void UpdateU64(uint64_t value) { Update(HashU64(value)); }
+
+  // Update the instance to record the observation of 'n' elements. This is
+  // equivalent to calling Update() for each hash, but considerably faster
+  // for large register arrays: register indices are computed a block at a
+  // time, and the registers are prefetched ahead of being updated.
+  void UpdateBatch(const uint64_t* hashes, size_t n);
+
+  // As above, for 'n' integers, or 'n' elements of 'sizes[i]' bytes at
+  // 'data[i]'. The elements are hashed a block at a time, and each block is
+  // passed to UpdateBatch().
+  void UpdateU64Batch(const uint64_t* values, size_t n);
+  void UpdateBytesBatch(const void* const* data, const size_t* sizes,
+                        size_t n);
+
   // Merge count tracking information from another instance into the object.
-  // The object being merged in must have been instantiated with the same
-  // precision. Returns 0 on success, EINVAL otherwise.
+  // If the precisions differ, the result has the lower of the two: an object
+  // of higher precision being merged in is folded on the fly, and this object
+  // is folded first if it has the higher precision (see Fold()). Returns 0 on
+  // success, or EINVAL if this object would have to be folded and can't be.
   int Merge(const HLL* other);
 
-  // Compute the bias-corrected estimate using the HyperLogLog++ algorithm.
+  // Merge 'n' objects into this one, with the same result as calling Merge()
+  // for each, but in a single pass over the registers where they share this
+  // object's precision and layout. The registers are taken a block small
+  // enough to stay in cache at a time, and every source is folded into the
+  // block before moving on, so that the registers of the object are read and
+  // written once rather than n times. With 'threads' greater than one, the
+  // blocks are shared among that many threads, the calling one included.
+  // Returns 0 on success, or EINVAL if Merge() would fail for any of the
+  // sources; the object is then left unchanged.
+  int MergeMany(const HLL* const* sources, size_t n, int threads = 1);
+
+  // Reduce the precision of the object, with the same result as if it had
+  // been created with the lower precision and seen the same elements: the
+  // index bits dropped become the leading bits of the rank. A sketch folded
+  // from p to (p - k) takes 2 ^ k times less space, and its error grows by a
+  // factor of 2 ^ (k / 2). Returns 0 on success, or EINVAL if 'precision' is
+  // out of range or above the object's, or if the object's registers are
+  // mapped from a file (see CreateMapped()) or held by an HLLPool or the
+  // caller (see CreateIn()).
+  int Fold(int precision);
+
+  // Return a new object with the same precision, options and contents as
+  // this one. The sparse list or the dense registers are copied wholesale,
+  // and a dense copy is a single allocation, as with Create(). The copy of
+  // a mapped object, or of one in an HLLPool or a caller's buffer, is an
+  // ordinary object that owns its memory.
+  HLL* Clone() const;
+
+  // Forget every element observed, as though the object had just been
+  // created, but without freeing or allocating memory: the registers are
+  // zeroed in place, and the sparse list keeps its capacity. An object that
+  // has gone dense stays dense. Suits a sketch reused for each window of a
+  // stream.
+  void Reset();
+
+  // Exchange the contents of two objects. Registers that live with their
+  // object, in its own allocation (see Create()), an HLLPool slot or a
+  // caller's buffer, can't change hands: if both objects are dense with
+  // the same precision and options, the register values are exchanged
+  // instead. Otherwise registers in an object's own allocation are first
+  // copied to the heap. Returns 0 on success, or EINVAL if an object in a
+  // pool or a caller's buffer would have to take memory from the heap.
+  int Swap(HLL* other);
+
+#if __cplusplus >= 201103L
+  // Move the contents of 'other' into a new object, which takes over its
+  // memory, save registers that live with it (see Swap()), which are
+  // copied. 'other' is left fit only to be destroyed or assigned to, or,
+  // if it is held by an HLLPool or a caller's buffer, empty. This allows
+  // objects to be kept by value, such as in a std::vector, once moved out
+  // of those returned by Create().
+  HLL(HLL&& other);
+
+  // Replace the contents of the object with those of 'other', as the
+  // constructor above does. An object held by an HLLPool or a caller's
+  // buffer keeps its registers there: the register values of 'other' are
+  // merged into them once they have been cleared, and 'other' is left as
+  // it was. That requires the same precision, and the process is aborted
+  // otherwise.
+  HLL& operator=(HLL&& other);
+#endif
+
+  int precision() const { return precision_; }
+
+  // Compute the estimate using the HyperLogLog++ algorithm, or the estimator
+  // selected when the object was created. This scans the registers, unless
+  // the object was created with HLL_OPTION_INCREMENTAL.
   uint64_t Estimate() const;
 
+  // Return the number of bytes needed to serialize the object.
+  size_t SerializedSize() const;
+
+  // Serialize the object into 'buffer', which has room for 'size' bytes.
+  // The format is versioned, and independent of the byte order of the host
+  // (see count/serialization.h); no memory is allocated. Returns 0 on
+  // success, or ERANGE if the buffer is smaller than SerializedSize().
+  int Serialize(void* buffer, size_t size) const;
+
+  // Create an instance from the 'size' bytes of 'buffer' written by
+  // Serialize(). It has the same precision, register layout and options as
+  // the object that was serialized. Returns NULL on failure; EINVAL if the
+  // buffer does not hold a valid serialized object. As with Create(), the
+  // caller may provide a pointer to an integer to learn the reason.
+  static HLL* Deserialize(const void* buffer, size_t size, int* error = 0);
+
+  // Merge the object serialized in the 'size' bytes of 'buffer' into this
+  // one, reading its registers straight from the buffer rather than
+  // creating an object for them. A serialized object of higher precision is
+  // folded on the fly, as with Merge(); one of lower precision is refused.
+  // Returns 0 on success, or EINVAL if the buffer does not hold a valid
+  // serialized object of at least this object's precision; the object is
+  // then left unchanged.
+  int MergeSerialized(const void* buffer, size_t size);
+
+  // The functions below operate on a plain array of (2 ^ precision) byte
+  // registers, such as that of a FixedHLL (see fixed_hll.h), so that such
+  // arrays can be merged with and estimated like HLL objects. Each returns
+  // EINVAL if 'precision' does not match that of the object.
+
+  // Merge the registers into the object.
+  int MergeRegisters(const uint8_t* registers, int precision);
+
+  // Merge the object into the registers: store the maximum of each of the
+  // object's registers and the corresponding element of 'registers' there.
+  int MergeInto(uint8_t* registers, int precision) const;
+
+  // Compute the estimate for an array of registers, using the estimator
+  // selected by the HLL_ESTIMATOR_* value in 'options'. The result is the
+  // same as that of a dense HLL object with the same registers.
+  static uint64_t EstimateRegisters(const uint8_t* registers, int precision,
+                                    int options);
+
+  // As above, but from a histogram of the register values: the number of
+  // registers holding each value, in 64 entries. This suits callers that
+  // tally the registers themselves, such as ConcurrentHLL.
+  static uint64_t EstimateHistogram(const uint32_t* histogram, int precision,
+                                    int options);
+
  private:
   // No copying allowed
   HLL(const HLL& no_copy);
   HLL& operator=(const HLL& no_assign);
 
   // Constructor is private: we validate the precision in the Create function.
-  explicit HLL(int precision);
+  HLL(int precision, int options);
+
+  // Construct a dense object whose registers, and running histogram if any,
+  // live in the StorageSize() bytes at 'storage', which the object does not
+  // own. The storage is 'borrowed' if it belongs to someone else, and not
+  // to the object's own allocation. HLL_LAYOUT_PACKED4 is not supported.
+  friend class HLLPool;
+  HLL(int precision, int options, uint8_t* storage, bool borrowed);
+  static size_t StorageSize(int precision, int options);
+
+  // Construct a dense object whose registers are those of a mapped file,
+  // which it owns, without allocating any of its own.
+  HLL(int precision, int options, RegisterFile* file);
+
+  // Allocate an object with vetted arguments, together with its registers
+  // if it is dense from the start and they don't live on the heap anyway.
+  static HLL* New(int precision, int options);
+
+  // Construct a dense object at the start of a block of InPlaceSize()
+  // bytes, with its registers on the first cache line past it.
+  static HLL* Place(void* block, int precision, int options, bool borrowed);
+
+  // Move dense registers that live with the object to the heap, so that
+  // they may be handed to another object.
+  void OwnRegisters();
+
+  // Exchange every member with those of 'other'.
+  void SwapMembers(HLL* other);
 
-  // Compute the raw estimate based on the HyperLogLog algorithm.
-  double RawEstimate() const;
 
-  // Return the number of registers equal to zero; used in LinearCounting.
-  int RegistersEqualToZero() const;
+  // Fold sparse register entries into the dense registers, or into an array
+  // of byte registers, respectively.
+  struct MaxVisitor;
+  struct ArrayMaxVisitor;
+
+  // A range of register blocks for MergeMany() to merge on a thread, and
+  // the functions that merge them.
+  struct MergeBlocks;
+  static void* MergeBlocksThread(void* arg);
+  void MergeBlockRange(const HLL* const* sources, size_t n, int first,
+                       int last);
+
+  // Switch from the sparse representation to the dense register array.
+  void ConvertToDense();
+
+  // Convert to the dense representation if the sparse one has outgrown it.
+  void MaybeConvertToDense();
+
+  // Return the size of the dense registers in the configured layout.
+  size_t DenseSizeInBytes() const;
+
+  // Read a dense register, or update it if 'value' is greater than it holds,
+  // irrespective of the layout in use. SetRegisterMax() keeps the running
+  // histogram, if any, up to date.
+  uint8_t GetRegister(int index) const;
+  void SetRegisterMax(int index, uint8_t value);
+
+  // Return the options the object was created with, less HLL_OPTION_DENSE.
+  int Options() const;
+
+  // Return the encoding used to serialize the object (SerializedEncoding).
+  int SerializedEncoding() const;
+
+  // Fill the dense registers of a new object from the payload of a dense
+  // serialized object, or merge the payload into them, respectively. The
+  // payload must be valid.
+  void LoadDense(const uint8_t* payload, int encoding);
+  void MergeDense(const uint8_t* payload, int encoding);
+
+  // Count the number of registers holding each value. The 'histogram' must
+  // have room for kHistogramBuckets (64) entries.
+  void RegisterHistogram(uint32_t* histogram) const;
 
   int precision_;
   int register_count_;
+  int layout_;
+  int estimator_;
+  bool incremental_;
+  // True if the dense registers and running histogram live in storage not
+  // allocated for them: after the object in its own allocation, or, if
+  // 'borrowed_' is also true, in a slot of an HLLPool or a caller's buffer.
+  bool external_;
+  bool borrowed_;
   uint8_t* registers_;
+  uint64_t* words_;
+  NibbleRegisters* nibbles_;
+  SparseRegisters* sparse_;
+
+  // The file holding the dense registers of a mapped object; NULL otherwise.
+  RegisterFile* file_;
+
+  // With HLL_OPTION_INCREMENTAL, the number of dense registers holding each
+  // value, maintained as the registers change. NULL otherwise, and while
+  // the object is sparse.
+  uint32_t* histogram_;
 };
 
 }  // namespace libcount
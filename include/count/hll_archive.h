@@ -0,0 +1,150 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_HLL_ARCHIVE_H_
+#define INCLUDE_COUNT_HLL_ARCHIVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <utility>
+#include <vector>
+
+#include "count/hll.h"
+#include "count/hll_view.h"
+
+namespace libcount {
+
+// An archive is a single file holding many sketches of the same precision,
+// each identified by a 64-bit key, laid out so that it can be memory-mapped
+// and queried in place. All integers are little-endian.
+//
+//   offset        size  contents
+//        0          64  header
+//   blocks_offset    *  register blocks of (2 ^ precision) bytes each
+//   index_offset     *  index: one (key, offset) pair of 8 byte integers
+//                       per sketch, in ascending order of key
+//
+// The header holds the magic bytes 'L', 'C', 'N', 'A', the format version
+// (one byte, currently 1), the precision (one byte), two zero bytes, and
+// then the number of sketches, blocks_offset and index_offset as 8 byte
+// integers; the rest is zero. The register blocks start on a 4096 byte
+// boundary, so that blocks of 4096 bytes or more (precision 12 and up)
+// each start on a page of their own.
+//
+// Opening an archive maps the file and reads the header, and nothing else:
+// a lookup then touches only the pages of the index its binary search
+// visits and those of the block it finds.
+
+// Writes an archive, one sketch at a time, in any order of key.
+class HLLArchiveWriter {
+ public:
+  // Create the file at 'path', or truncate it, to write an archive of
+  // sketches of the given precision. Returns NULL on failure. In the event
+  // of failure, the caller may provide a pointer to an integer to learn the
+  // reason: EINVAL for a bad precision, or the errno value of the failure.
+  static HLLArchiveWriter* Create(const char* path, int precision,
+                                  int* error = 0);
+
+  // Closes the file. Unless Finish() succeeded, the archive is incomplete,
+  // and cannot be opened.
+  ~HLLArchiveWriter();
+
+  // Append a sketch to the archive under 'key'. Returns 0 on success,
+  // EINVAL if the precision does not match or the registers hold values not
+  // possible at that precision, or EIO if the write failed.
+  int Add(uint64_t key, const HLL* hll);
+  int Add(uint64_t key, const uint8_t* registers);
+
+  // Write the index and the header, and close the file. Returns 0 on
+  // success, EINVAL if a key was added more than once, or EIO.
+  int Finish();
+
+ private:
+  // No copying allowed
+  HLLArchiveWriter(const HLLArchiveWriter& no_copy);
+  HLLArchiveWriter& operator=(const HLLArchiveWriter& no_assign);
+
+  HLLArchiveWriter(FILE* file, int precision);
+
+  // Append a block of registers that is known to be valid.
+  int AddBlock(uint64_t key, const uint8_t* registers);
+
+  FILE* file_;
+  int precision_;
+  size_t block_size_;
+  uint64_t offset_;
+  std::vector<uint8_t> scratch_;
+  std::vector<std::pair<uint64_t, uint64_t> > index_;
+};
+
+// A read-only, memory-mapped archive.
+class HLLArchive {
+ public:
+  // Map the archive at 'path'. Returns NULL on failure. In the event of
+  // failure, the caller may provide a pointer to an integer to learn the
+  // reason: EINVAL if the file is not an archive in a format this version
+  // understands, or the errno value of the failure.
+  static HLLArchive* Open(const char* path, int* error = 0);
+
+  // Unmaps the file. Any views obtained from the archive become invalid.
+  ~HLLArchive();
+
+  // Return the precision of the sketches, and the number of them.
+  int precision() const { return precision_; }
+  size_t size() const { return count_; }
+
+  // Return the key of the i'th sketch, in ascending order of key, and a
+  // view of its registers.
+  uint64_t key(size_t i) const;
+  HLLView view(size_t i) const;
+
+  // Look up the sketch stored under 'key'. Returns true, and stores a view
+  // of its registers in 'view', if there is one.
+  bool Find(uint64_t key, HLLView* view) const;
+
+  // Read the whole archive, and check that the index is in order and that
+  // each register block holds only values possible at the precision. Open()
+  // doesn't, as that would mean reading every page of the file; archives
+  // from an untrusted source should be checked before use; views of damaged
+  // blocks are safe to estimate, but the estimates mean nothing. Returns 0
+  // if the archive is sound, or EINVAL.
+  int Verify() const;
+
+ private:
+  // No copying allowed
+  HLLArchive(const HLLArchive& no_copy);
+  HLLArchive& operator=(const HLLArchive& no_assign);
+
+  HLLArchive(const uint8_t* data, size_t size, int precision, size_t count,
+             uint64_t blocks_offset, uint64_t index_offset);
+
+  // Return the offset of the register block of the i'th index entry, or 0
+  // if it doesn't refer to a block of the block region.
+  uint64_t BlockOffset(size_t i) const;
+
+  const uint8_t* data_;
+  size_t size_;
+  int precision_;
+  size_t count_;
+  size_t block_size_;
+  uint64_t blocks_offset_;
+  uint64_t index_offset_;
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_HLL_ARCHIVE_H_
@@ -25,7 +25,12 @@ namespace libcount {
 enum {
   /* Minimum and maximum precision values allowed. */
   HLL_MIN_PRECISION = 4,
-  HLL_MAX_PRECISION = 18
+  HLL_MAX_PRECISION = 26,
+
+  /* The highest precision for which the empirical bias tables of
+     HyperLogLog++ exist. Above it, HLL_ESTIMATOR_EMPIRICAL selects the
+     table-free HLL_ESTIMATOR_IMPROVED instead. */
+  HLL_MAX_EMPIRICAL_PRECISION = 18
 };
 
 #ifdef __cplusplus
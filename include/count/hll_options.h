@@ -0,0 +1,82 @@
+/*
+   Copyright 2015-2022 The libcount Authors.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License. See the AUTHORS file for names of
+   contributors.
+*/
+
+#ifndef INCLUDE_COUNT_HLL_OPTIONS_H_
+#define INCLUDE_COUNT_HLL_OPTIONS_H_
+
+#ifdef __cplusplus
+namespace libcount {
+#endif
+
+/* Options that may be passed when creating an HLL object. At most one
+   register layout may be selected; it governs how the dense registers are
+   stored in memory. Likewise at most one estimator. These may be combined
+   with the HLL_OPTION_* flags. */
+enum {
+  /* One byte per register. This is the default. */
+  HLL_LAYOUT_BYTE = 0x00,
+
+  /* Six bits per register, packed ten to a 64-bit word. */
+  HLL_LAYOUT_PACKED6 = 0x01,
+
+  /* Four bits per register, relative to an offset shared by all registers,
+     with a small table for the rare registers that don't fit. */
+  HLL_LAYOUT_PACKED4 = 0x02,
+
+  /* Mask used to extract the register layout from the options. */
+  HLL_LAYOUT_MASK = 0x0F,
+
+  /* Allocate the dense registers immediately, rather than starting out in
+     the sparse representation. Useful when large cardinalities are
+     expected. */
+  HLL_OPTION_DENSE = 0x10,
+
+  /* Keep a running tally of register values as the registers change, so
+     that Estimate() takes constant time regardless of the precision. This
+     makes updates that raise a register slightly more expensive, and is
+     worthwhile when estimates are requested often. */
+  HLL_OPTION_INCREMENTAL = 0x20,
+
+  /* For ConcurrentHLL only: have each update that raises a register bump a
+     pair of counters shared by all writers, so that Snapshot() can copy the
+     registers as they all stood at one point in time. Raises then contend
+     for the counters' cache line; leave it off unless such copies are
+     needed. HLL objects don't accept it. */
+  HLL_OPTION_SNAPSHOT = 0x40,
+
+  /* The HyperLogLog++ estimator, with empirical bias correction. This is the
+     default. Above HLL_MAX_EMPIRICAL_PRECISION, where there are no bias
+     tables, it is the same as HLL_ESTIMATOR_IMPROVED. */
+  HLL_ESTIMATOR_EMPIRICAL = 0x000,
+
+  /* Otmar Ertl's improved raw estimator, which needs no bias correction and
+     is nearly unbiased at every cardinality. */
+  HLL_ESTIMATOR_IMPROVED = 0x100,
+
+  /* Otmar Ertl's maximum likelihood estimator; a little more accurate than
+     the improved estimator, and a little slower. */
+  HLL_ESTIMATOR_MLE = 0x200,
+
+  /* Mask used to extract the estimator from the options. */
+  HLL_ESTIMATOR_MASK = 0xF00
+};
+
+#ifdef __cplusplus
+}  // namespace libcount
+#endif
+
+#endif  // INCLUDE_COUNT_HLL_OPTIONS_H_
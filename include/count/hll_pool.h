@@ -0,0 +1,103 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_HLL_POOL_H_
+#define INCLUDE_COUNT_HLL_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+
+namespace libcount {
+
+// Allocates HLL objects of one precision and set of options, for programs
+// that keep very many of them. Each object shares a fixed-size slot with
+// its dense registers, which follow it directly, and slots are carved out
+// of slabs of about a megabyte. Allocating an object takes no memory from
+// the heap once a slab has room, there are no per-allocation headers, and
+// freed slots are reused before the slabs grow.
+//
+// Objects from a pool are dense from the start: a pool suits populations
+// that will mostly fill their registers, where the sparse representation
+// would only add a conversion. They behave as other HLL objects, except
+// that they can't be folded to a lower precision, and must be returned to
+// the pool rather than deleted.
+class HLLPool {
+ public:
+  // Create a pool of objects of the given precision and options, which are
+  // as for HLL::Create(), except that HLL_LAYOUT_PACKED4 is not supported.
+  // Returns NULL on failure; the caller may provide a pointer to an integer
+  // to learn the reason.
+  static HLLPool* Create(int precision, int options = HLL_LAYOUT_BYTE,
+                         int* error = 0);
+
+  // Free the slabs, and with them every object allocated from the pool.
+  ~HLLPool();
+
+  // Return a new object with all registers zero. Returns NULL with ENOMEM
+  // if a new slab is needed and can't be allocated; as with Create(), the
+  // caller may provide a pointer to an integer to learn the reason.
+  HLL* Allocate(int* error = 0);
+
+  // Return an object allocated from this pool, for its slot to be reused.
+  void Free(HLL* hll);
+
+  // Free every object allocated from the pool at once, keeping the slabs to
+  // allocate from again. Objects allocated before the call are invalid
+  // after it. Their destructors aren't run, which is safe because a pooled
+  // object never owns memory outside its slot.
+  void Reset();
+
+  // Return the number of objects allocated and not yet freed.
+  size_t size() const { return live_; }
+
+  // Return the number of bytes held in slabs.
+  size_t SizeInBytes() const { return slabs_.size() * slab_size_; }
+
+  int precision() const { return precision_; }
+
+ private:
+  // No copying allowed
+  HLLPool(const HLLPool& no_copy);
+  HLLPool& operator=(const HLLPool& no_assign);
+
+  HLLPool(int precision, int options);
+
+  // Return an unused slot, from the free list or the slabs.
+  uint8_t* NextSlot();
+
+  int precision_;
+  int options_;
+  size_t header_size_;
+  size_t slot_size_;
+  size_t slots_per_slab_;
+  size_t slab_size_;
+  std::vector<uint8_t*> slabs_;
+  // Slots are handed out in order from slab 'slab_', at index 'slot_',
+  // once the free list, linked through the first word of each free slot,
+  // is empty.
+  size_t slab_;
+  size_t slot_;
+  void* free_list_;
+  size_t live_;
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_HLL_POOL_H_
@@ -0,0 +1,46 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_HLL_RANK_H_
+#define INCLUDE_COUNT_HLL_RANK_H_
+
+#include <stdint.h>
+
+namespace libcount {
+
+// Split a hash into the index of the register it updates, taken from its
+// leading 'precision' bits, and its rank: one more than the number of
+// leading zeroes in the remaining bits. A sentinel bit placed just past the
+// end of the remaining bits bounds the rank at (64 - precision + 1) when
+// they are all zero, so no special case is needed. Every sketch in the
+// library, including the header-only ones, updates its registers this way.
+inline void IndexAndRankOf(uint64_t hash, int precision, int* index,
+                           uint8_t* rank) {
+  const uint64_t bits = (hash << precision) | (uint64_t(1) << (precision - 1));
+  *index = static_cast<int>(hash >> (64 - precision));
+#if defined(__GNUC__)
+  *rank = static_cast<uint8_t>(__builtin_clzll(bits) + 1);
+#else
+  uint8_t count = 1;
+  for (uint64_t bit = uint64_t(1) << 63; (bits & bit) == 0; bit >>= 1) {
+    ++count;
+  }
+  *rank = count;
+#endif
+}
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_HLL_RANK_H_
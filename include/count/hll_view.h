@@ -0,0 +1,66 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_HLL_VIEW_H_
+#define INCLUDE_COUNT_HLL_VIEW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+
+namespace libcount {
+
+// A read-only view of a block of (2 ^ precision) byte registers owned by
+// someone else, such as a register block of a memory-mapped HLLArchive (see
+// hll_archive.h). The view copies nothing: the registers are read in place
+// each time it is estimated or merged, and must outlive the view.
+//
+// The registers hold the same values as those of a dense HLL object of the
+// same precision in the byte layout, and the view gives the same estimates.
+class HLLView {
+ public:
+  // An empty view, which refers to no registers.
+  HLLView() : registers_(NULL), precision_(0) {}
+
+  HLLView(const uint8_t* registers, int precision)
+      : registers_(registers), precision_(precision) {}
+
+  // Compute the estimate, using the estimator selected by the HLL_ESTIMATOR_*
+  // value in 'options'; the HyperLogLog++ estimator by default.
+  uint64_t Estimate(int options = HLL_ESTIMATOR_EMPIRICAL) const {
+    return HLL::EstimateRegisters(registers_, precision_, options);
+  }
+
+  // Merge the registers into an HLL object. Returns 0 on success, or EINVAL
+  // if the HLL object was not created with the same precision.
+  int MergeInto(HLL* other) const {
+    return other->MergeRegisters(registers_, precision_);
+  }
+
+  // Return the register block, of (2 ^ precision()) bytes.
+  const uint8_t* registers() const { return registers_; }
+
+  int precision() const { return precision_; }
+
+ private:
+  const uint8_t* registers_;
+  int precision_;
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_HLL_VIEW_H_
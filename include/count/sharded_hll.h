@@ -0,0 +1,160 @@
+// Copyright 2015-2022 The libcount Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License. See the AUTHORS file for names of
+// contributors.
+
+#ifndef INCLUDE_COUNT_SHARDED_HLL_H_
+#define INCLUDE_COUNT_SHARDED_HLL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "count/hll.h"
+#include "count/hll_options.h"
+#include "count/hll_rank.h"
+
+namespace libcount {
+
+// A HyperLogLog cardinality estimator for many writer threads, each of which
+// updates registers of its own. A thread's registers, a byte apiece, start
+// on a cache line boundary and share no line with those of another thread,
+// so writers never contend: an update is a load and, when it raises the
+// register, a plain store. No locks or read-modify-write instructions are
+// involved.
+//
+// Estimate() merges the threads' registers, taking the maximum of each, into
+// an aggregate HLL object that it keeps between calls. Each thread bumps a
+// dirty epoch when it raises a register, and only the registers of threads
+// whose epoch changed since the last call are merged again; when none did,
+// the previous estimate is returned.
+//
+// Compared with ConcurrentHLL (concurrent_hll.h), updates are cheaper where
+// many cores write at once, at the cost of (2 ^ precision) bytes per writer
+// thread and an estimate that takes longer after heavy updating.
+//
+// A thread's handle is freed when the thread exits, once its registers have
+// been merged into the aggregate, so memory follows the number of live
+// writer threads rather than of all those that ever wrote. Every object
+// shares one thread specific key, so the number of objects isn't bounded by
+// PTHREAD_KEYS_MAX.
+class ShardedHLL {
+ public:
+  // The registers of one writer thread. A Handle must only be updated by one
+  // thread at a time.
+  class Handle {
+   public:
+    // Record the observation of an element.
+    void Update(uint64_t hash) {
+      int index;
+      uint8_t count;
+      IndexAndRankOf(hash, precision_, &index, &count);
+      const uint64_t rank = count;
+      uint64_t* const word = &words_[index >> 3];
+      const int shift = (index & 7) * 8;
+      // This thread is the only writer, so the word can be read plainly;
+      // the stores are atomic for the sake of Estimate() in other threads.
+      const uint64_t current = *word;
+      if (((current >> shift) & 0xFF) < rank) {
+        const uint64_t desired =
+            (current & ~(uint64_t(0xFF) << shift)) | (rank << shift);
+        __atomic_store_n(word, desired, __ATOMIC_RELAXED);
+        __atomic_store_n(epoch_, *epoch_ + 1, __ATOMIC_RELEASE);
+      }
+    }
+
+   private:
+    friend class ShardedHLL;
+
+    // No copying allowed
+    Handle(const Handle& no_copy);
+    Handle& operator=(const Handle& no_assign);
+
+    Handle(int precision, uint64_t* words, uint64_t* epoch);
+
+    int precision_;
+    uint64_t* words_;
+    uint64_t* epoch_;
+  };
+
+  // Create an instance. Valid values for precision and options are as for
+  // ConcurrentHLL. Returns NULL on failure; the caller may provide a pointer
+  // to an integer to learn the reason.
+  static ShardedHLL* Create(int precision, int options = 0, int* error = 0);
+
+  // Free the object and the registers of all its handles.
+  ~ShardedHLL();
+
+  // Return the calling thread's handle, creating one on the first call from
+  // each thread. The handle lasts until the thread exits or the object is
+  // destroyed, so writers that update often should keep the pointer rather
+  // than look it up each time, but must not pass it to another thread.
+  Handle* ThreadHandle();
+
+  // Record the observation of an element in the calling thread's registers.
+  void Update(uint64_t hash) { ThreadHandle()->Update(hash); }
+
+  // Compute the estimate with the estimator selected at creation. May be
+  // called while other threads update the object; updates that complete
+  // before the call are counted.
+  uint64_t Estimate();
+
+  // Merge this object into an HLL object, as HLL::Merge() would: an object
+  // of higher precision is folded to this one's. Returns 0 on success, or
+  // EINVAL if it can't be.
+  int MergeInto(HLL* other);
+
+  int precision() const { return precision_; }
+
+  // Return the number of threads that currently hold a handle.
+  size_t thread_count();
+
+ private:
+  // No copying allowed
+  ShardedHLL(const ShardedHLL& no_copy);
+  ShardedHLL& operator=(const ShardedHLL& no_assign);
+
+  ShardedHLL(int precision, HLL* aggregate);
+
+  // Create the thread specific key shared by all objects, once.
+  static void InitShared();
+
+  // Retire the handles of an exiting thread, whose handle table is 'arg'.
+  static void ReleaseThreadHandles(void* arg);
+
+  // Merge the registers of a handle into the aggregate, and free it.
+  void RetireHandle(Handle* handle);
+
+  // Merge the registers of handles whose epoch has changed into the
+  // aggregate. The mutex must be held.
+  void Refresh();
+
+  int precision_;
+  // The object's index in the list of live objects, and a number that no
+  // other object in the process has.
+  size_t slot_;
+  uint64_t serial_;
+  pthread_mutex_t mutex_;
+  std::vector<Handle*> handles_;
+  std::vector<uint64_t> merged_epochs_;
+  std::vector<uint8_t> scratch_;
+  HLL* aggregate_;
+  uint64_t estimate_;
+  bool estimate_valid_;
+};
+
+}  // namespace libcount
+
+#endif  // INCLUDE_COUNT_SHARDED_HLL_H_